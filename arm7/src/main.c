@@ -28,6 +28,7 @@
 
 ---------------------------------------------------------------------------------*/
 #include "my_sdmmc.h"
+#include "my_sha1.h"
 
 #include <nds.h>
 #include <string.h>
@@ -39,6 +40,15 @@ void VcountHandler()
 	inputGetAndSend();
 }
 
+volatile u32 frameCount = 0;
+
+//---------------------------------------------------------------------------------
+void VblankHandler()
+//---------------------------------------------------------------------------------
+{
+	frameCount++;
+}
+
 volatile bool exitflag = false;
 volatile bool reboot = false;
 
@@ -168,26 +178,43 @@ int main()
 
 	installSystemFIFO();
 
+	// Replace the blocking libnds SD/MMC handlers with the IRQ driven ones
+	if (isDSiMode())
+	{
+		my_sdmmc_install();
+		my_sha1_install();
+	}
+
 	irqSet(IRQ_VCOUNT, VcountHandler);
+	irqSet(IRQ_VBLANK, VblankHandler);
 
 	irqEnable( IRQ_VBLANK | IRQ_VCOUNT | IRQ_NETWORK);
 
 	// Keep the ARM7 mostly idle
+	u32 lastFrame = frameCount - 1;
 	while (!exitflag)
 	{
-		if ( 0 == (REG_KEYINPUT & (KEY_SELECT | KEY_START | KEY_L | KEY_R)))
+		my_sha1_service();
+
+		if (lastFrame != frameCount)
 		{
-			exitflag = true;
-		}
+			lastFrame = frameCount;
 
-		int batteryStatus;
-		if (isDSiMode() || REG_SCFG_EXT != 0)
-			batteryStatus = i2cReadRegister(I2C_PM, I2CREGPM_BATTERY);
-		else
-			batteryStatus = (readPowerManagement(PM_BATTERY_REG) & 1) ? 0x3 : 0xF;
-		fifoSendValue32(FIFO_USER_03, batteryStatus);
+			if ( 0 == (REG_KEYINPUT & (KEY_SELECT | KEY_START | KEY_L | KEY_R)))
+			{
+				exitflag = true;
+			}
+
+			int batteryStatus;
+			if (isDSiMode() || REG_SCFG_EXT != 0)
+				batteryStatus = i2cReadRegister(I2C_PM, I2CREGPM_BATTERY);
+			else
+				batteryStatus = (readPowerManagement(PM_BATTERY_REG) & 1) ? 0x3 : 0xF;
+			fifoSendValue32(FIFO_USER_03, batteryStatus);
+		}
 
-		swiWaitForVBlank();
+		// Wake up for SHA-1 requests as well as once per frame
+		swiIntrWait(0, IRQ_VBLANK | IRQ_FIFO_NOT_EMPTY);
 	}
 
 	// Tell ARM9 to safely exit
@@ -6,6 +6,7 @@
 #include <nds/fifomessages.h>
 
 #include <stddef.h>
+#include <string.h>
 
 static struct mmcdevice deviceSD;
 static struct mmcdevice deviceNAND;
@@ -573,35 +574,429 @@ void my_sdmmc_get_cid(int devicenumber, u32 *cid)
 	leaveCriticalSection(oldIME);
 }
 
+// Requests from the ARM9 are queued and driven by the SD/MMC controller IRQ
+// instead of being polled inside a critical section, so the ARM7 keeps
+// servicing input, the battery and the FIFO during long transfers. Each
+// request is answered on FIFO_SDMMC in the order it was received.
+typedef struct {
+	struct mmcdevice *device;
+	u32 sector;
+	u32 numsectors;
+	u8 *buffer;
+	bool write;
+} sdmmcRequest;
+
+static sdmmcRequest sdmmcQueue[SDMMC_QUEUE_LEN];
+static volatile u32 sdmmcQueueHead = 0;
+static volatile u32 sdmmcQueueCount = 0;
+
+static sdmmcRequest * volatile sdmmcActive = NULL;
+static u8 *sdmmcDataPtr = NULL;
+static u32 sdmmcRemaining = 0;
+static u32 sdmmcSector = 0;
+static u32 sdmmcSectorsLeft = 0;
+static u32 sdmmcPieceSectors = 0;
+static bool sdmmcBounce = false;
+
+static volatile u32 sdmmcDataPath = SDMMC_PATH_DEFAULT;
+
+// NDMA can only move whole words, unaligned callers go through this
+static u32 sdmmcBounceBuf[SDMMC_BOUNCE_SECTORS * 512 / sizeof(u32)];
+
+static void my_sdmmc_start_next();
+
+//---------------------------------------------------------------------------------
+static void my_sdmmc_set_fifo32(bool enable)
+//---------------------------------------------------------------------------------
+{
+	if (enable)
+	{
+		sdmmc_mask16(REG_SDDATACTL, 0x22, 0x2);
+		sdmmc_mask16(REG_SDDATACTL32, 0, 0x2);
+		sdmmc_write16(REG_SDBLKLEN32, 0x200);
+	}
+	else
+	{
+		sdmmc_mask16(REG_SDDATACTL, 0x22, 0);
+		sdmmc_mask16(REG_SDDATACTL32, 0x2, 0);
+	}
+}
+
+//---------------------------------------------------------------------------------
+static void my_sdmmc_read_block()
+//---------------------------------------------------------------------------------
+{
+	if (sdmmcDataPath == SDMMC_PATH_32)
+	{
+		if (!((u32)sdmmcDataPtr & 3))
+		{
+			u32 *ptr32 = (u32*)sdmmcDataPtr;
+			for (u32 i = 0; i < 0x200; i += 4)
+				*ptr32++ = sdmmc_read32(REG_SDFIFO32);
+		}
+		else
+		{
+			u8 *ptr8 = sdmmcDataPtr;
+			for (u32 i = 0; i < 0x200; i += 4)
+			{
+				u32 data = sdmmc_read32(REG_SDFIFO32);
+				*ptr8++ = data;
+				*ptr8++ = data >> 8;
+				*ptr8++ = data >> 16;
+				*ptr8++ = data >> 24;
+			}
+		}
+	}
+	else
+	{
+		if (!((u32)sdmmcDataPtr & 1))
+		{
+			u16 *ptr16 = (u16*)sdmmcDataPtr;
+			for (u32 i = 0; i < 0x200; i += 2)
+				*ptr16++ = sdmmc_read16(REG_SDFIFO);
+		}
+		else
+		{
+			u8 *ptr8 = sdmmcDataPtr;
+			for (u32 i = 0; i < 0x200; i += 2)
+			{
+				u16 data = sdmmc_read16(REG_SDFIFO);
+				*ptr8++ = data;
+				*ptr8++ = data >> 8;
+			}
+		}
+	}
+	sdmmcDataPtr += 0x200;
+	sdmmcRemaining -= 0x200;
+}
+
+//---------------------------------------------------------------------------------
+static void my_sdmmc_write_block()
+//---------------------------------------------------------------------------------
+{
+	if (sdmmcDataPath == SDMMC_PATH_32)
+	{
+		if (!((u32)sdmmcDataPtr & 3))
+		{
+			const u32 *ptr32 = (const u32*)sdmmcDataPtr;
+			for (u32 i = 0; i < 0x200; i += 4)
+				sdmmc_write32(REG_SDFIFO32, *ptr32++);
+		}
+		else
+		{
+			const u8 *ptr8 = sdmmcDataPtr;
+			for (u32 i = 0; i < 0x200; i += 4)
+			{
+				u32 data = *ptr8++;
+				data |= (u32)*ptr8++ << 8;
+				data |= (u32)*ptr8++ << 16;
+				data |= (u32)*ptr8++ << 24;
+				sdmmc_write32(REG_SDFIFO32, data);
+			}
+		}
+	}
+	else
+	{
+		if (!((u32)sdmmcDataPtr & 1))
+		{
+			const u16 *ptr16 = (const u16*)sdmmcDataPtr;
+			for (u32 i = 0; i < 0x200; i += 2)
+				sdmmc_write16(REG_SDFIFO, *ptr16++);
+		}
+		else
+		{
+			const u8 *ptr8 = sdmmcDataPtr;
+			for (u32 i = 0; i < 0x200; i += 2)
+			{
+				u16 data = *ptr8++;
+				data |= (u16)(*ptr8++ << 8);
+				sdmmc_write16(REG_SDFIFO, data);
+			}
+		}
+	}
+	sdmmcDataPtr += 0x200;
+	sdmmcRemaining -= 0x200;
+}
+
+// Issues one multi block command for the next piece of the active request.
+// Requests are split only when NDMA has to go through the bounce buffer.
+//---------------------------------------------------------------------------------
+static void my_sdmmc_start_piece()
+//---------------------------------------------------------------------------------
+{
+	sdmmcRequest *req = sdmmcActive;
+	struct mmcdevice *device = req->device;
+	const u32 path = sdmmcDataPath;
+
+	sdmmcPieceSectors = sdmmcSectorsLeft;
+	if (sdmmcBounce && sdmmcPieceSectors > SDMMC_BOUNCE_SECTORS)
+		sdmmcPieceSectors = SDMMC_BOUNCE_SECTORS;
+
+	u32 sector_no = sdmmcSector;
+	if (device->isSDHC == 0)
+		sector_no <<= 9;
+
+	sdmmc_write16(REG_SDSTOP,0x100);
+	sdmmc_write16(REG_SDBLKCOUNT32,sdmmcPieceSectors);
+	sdmmc_write16(REG_SDBLKCOUNT,sdmmcPieceSectors);
+
+	sdmmcRemaining = sdmmcPieceSectors << 9;
+
+	while ((sdmmc_read16(REG_SDSTATUS1) & TMIO_STAT1_CMD_BUSY)); //mmc working?
+	sdmmc_write16(REG_SDSTATUS0,0);
+	sdmmc_write16(REG_SDSTATUS1,0);
+
+	// Unmask data end and errors, plus the FIFO request for this direction
+	sdmmc_write16(REG_SDIRMASK0,(u16)~TMIO_STAT0_DATAEND);
+	if (path == SDMMC_PATH_16)
+	{
+		sdmmc_write16(REG_SDIRMASK1,(u16)~(TMIO_MASK_GW | (req->write ? TMIO_STAT1_TXRQ : TMIO_STAT1_RXRDY)));
+		sdmmc_mask16(REG_SDDATACTL32,0x1800,0x400);
+	}
+	else
+	{
+		sdmmc_write16(REG_SDIRMASK1,(u16)~TMIO_MASK_GW);
+		sdmmc_mask16(REG_SDDATACTL32,0x1800,0x400 | (req->write ? 0x1000 : 0x800)); // Clear fifo, enable TX32RQ or RX32RDY IRQ.
+	}
+
+	if (path == SDMMC_PATH_NDMA)
+	{
+		// The FIFO request starts one NDMA block per sector
+		u32 target = sdmmcBounce ? (u32)sdmmcBounceBuf : (u32)sdmmcDataPtr;
+		const u32 fifo = SDMMC_BASE + REG_SDFIFO32;
+
+		if (req->write && sdmmcBounce)
+			memcpy(sdmmcBounceBuf, sdmmcDataPtr, sdmmcPieceSectors << 9);
+
+		SDMMC_NDMA_SAD = req->write ? target : fifo;
+		SDMMC_NDMA_DAD = req->write ? fifo : target;
+		SDMMC_NDMA_TCNT = sdmmcPieceSectors << 7;
+		SDMMC_NDMA_WCNT = 0x80;
+		SDMMC_NDMA_BCNT = 0;
+		SDMMC_NDMA_CNT = req->write ? SDMMC_NDMA_WRITE : SDMMC_NDMA_READ;
+	}
+
+	const u32 cmd = req->write ? 0x52C19 : 0x33C12;
+	sdmmc_write16(REG_SDCMDARG0,sector_no &0xFFFF);
+	sdmmc_write16(REG_SDCMDARG1,sector_no >> 16);
+	sdmmc_write16(REG_SDCMD,cmd &0xFFFF);
+}
+
+//---------------------------------------------------------------------------------
+static void my_sdmmc_start_transfer(sdmmcRequest *req)
+//---------------------------------------------------------------------------------
+{
+	struct mmcdevice *device = req->device;
+
+	my_setTarget(device);
+	my_sdmmc_set_fifo32(sdmmcDataPath != SDMMC_PATH_16);
+
+	device->error = 0;
+	sdmmcDataPtr = req->buffer;
+	sdmmcSector = req->sector;
+	sdmmcSectorsLeft = req->numsectors;
+	sdmmcBounce = sdmmcDataPath == SDMMC_PATH_NDMA && ((u32)req->buffer & 3);
+
+	my_sdmmc_start_piece();
+}
+
+//---------------------------------------------------------------------------------
+static void my_sdmmc_finish_transfer()
+//---------------------------------------------------------------------------------
+{
+	struct mmcdevice *device = sdmmcActive->device;
+
+	SDMMC_NDMA_CNT = 0;
+
+	sdmmc_write16(REG_SDIRMASK0,TMIO_MASK_ALL & 0xFFFF);
+	sdmmc_write16(REG_SDIRMASK1,TMIO_MASK_ALL >> 16);
+	sdmmc_mask16(REG_SDDATACTL32,0x1800,0);
+
+	device->stat0 = sdmmc_read16(REG_SDSTATUS0);
+	device->stat1 = sdmmc_read16(REG_SDSTATUS1);
+	sdmmc_write16(REG_SDSTATUS0,0);
+	sdmmc_write16(REG_SDSTATUS1,0);
+	my_sdmmc_set_fifo32(SDMMC_PATH_DEFAULT != SDMMC_PATH_16);
+	my_setTarget(&deviceSD);
+
+	sdmmcActive = NULL;
+	sdmmcQueueHead = (sdmmcQueueHead + 1) % SDMMC_QUEUE_LEN;
+	sdmmcQueueCount--;
+
+	fifoSendValue32(FIFO_SDMMC, my_geterror(device));
+
+	my_sdmmc_start_next();
+}
+
+// Must be called with interrupts disabled
+//---------------------------------------------------------------------------------
+static void my_sdmmc_start_next()
+//---------------------------------------------------------------------------------
+{
+	while (sdmmcActive == NULL && sdmmcQueueCount > 0)
+	{
+		sdmmcRequest *req = &sdmmcQueue[sdmmcQueueHead];
+
+		if (req->device == NULL || req->numsectors == 0)
+		{
+			// Nothing to transfer, answer right away to keep replies in order
+			sdmmcQueueHead = (sdmmcQueueHead + 1) % SDMMC_QUEUE_LEN;
+			sdmmcQueueCount--;
+			fifoSendValue32(FIFO_SDMMC, 0);
+			continue;
+		}
+
+		sdmmcActive = req;
+		my_sdmmc_start_transfer(req);
+	}
+}
+
+//---------------------------------------------------------------------------------
+void my_sdmmcIrqHandler()
+//---------------------------------------------------------------------------------
+{
+	sdmmcRequest *req = sdmmcActive;
+
+	// Stray interrupt from a polled command
+	if (req == NULL)
+		return;
+
+	const u32 path = sdmmcDataPath;
+	u16 status1 = sdmmc_read16(REG_SDSTATUS1);
+
+	if (status1 & TMIO_MASK_GW)
+	{
+		req->device->error |= 4;
+		my_sdmmc_finish_transfer();
+		return;
+	}
+
+	if (path == SDMMC_PATH_32)
+	{
+		u16 ctl32 = sdmmc_read16(REG_SDDATACTL32);
+		if (!req->write && (ctl32 & 0x100) && sdmmcRemaining > 0)
+		{
+			sdmmc_mask16(REG_SDSTATUS1, TMIO_STAT1_RXRDY, 0);
+			my_sdmmc_read_block();
+		}
+		else if (req->write && !(ctl32 & 0x200) && sdmmcRemaining > 0)
+		{
+			sdmmc_mask16(REG_SDSTATUS1, TMIO_STAT1_TXRQ, 0);
+			my_sdmmc_write_block();
+
+			// The FIFO stays empty while the card programs the last block
+			if (sdmmcRemaining == 0)
+				sdmmc_mask16(REG_SDDATACTL32, 0x1000, 0);
+		}
+	}
+	else if (path == SDMMC_PATH_16)
+	{
+		if (!req->write && (status1 & TMIO_STAT1_RXRDY) && sdmmcRemaining > 0)
+		{
+			sdmmc_mask16(REG_SDSTATUS1, TMIO_STAT1_RXRDY, 0);
+			my_sdmmc_read_block();
+		}
+		else if (req->write && (status1 & TMIO_STAT1_TXRQ) && sdmmcRemaining > 0)
+		{
+			sdmmc_mask16(REG_SDSTATUS1, TMIO_STAT1_TXRQ, 0);
+			my_sdmmc_write_block();
+
+			if (sdmmcRemaining == 0)
+				sdmmc_mask16(REG_SDIRMASK1, 0, TMIO_STAT1_TXRQ);
+		}
+	}
+
+	if (!(sdmmc_read16(REG_SDSTATUS0) & TMIO_STAT0_DATAEND))
+		return;
+
+	req->device->error |= 0x2;
+
+	if (path == SDMMC_PATH_NDMA)
+	{
+		// Let the channel drain the last words out of the FIFO
+		while (SDMMC_NDMA_CNT & SDMMC_NDMA_ENABLE);
+
+		if (!req->write && sdmmcBounce)
+			memcpy(sdmmcDataPtr, sdmmcBounceBuf, sdmmcPieceSectors << 9);
+		sdmmcDataPtr += sdmmcPieceSectors << 9;
+	}
+
+	sdmmcSector += sdmmcPieceSectors;
+	sdmmcSectorsLeft -= sdmmcPieceSectors;
+
+	if (sdmmcSectorsLeft > 0)
+		my_sdmmc_start_piece();
+	else
+		my_sdmmc_finish_transfer();
+}
+
 //---------------------------------------------------------------------------------
 void my_sdmmcMsgHandler(int bytes, void *user_data)
 //---------------------------------------------------------------------------------
 {
 	FifoMessage msg;
-	int retval = 0;
+	sdmmcRequest req = { NULL, 0, 0, NULL, false };
 
 	fifoGetDatamsg(FIFO_SDMMC, bytes, (u8*)&msg);
 
-	int oldIME = enterCriticalSection();
 	switch (msg.type)
 	{
 		case SDMMC_SD_READ_SECTORS:
-			retval = my_sdmmc_readsectors(&deviceSD, msg.sdParams.startsector, msg.sdParams.numsectors, msg.sdParams.buffer);
+			req.device = &deviceSD;
 			break;
 		case SDMMC_SD_WRITE_SECTORS:
-			retval = my_sdmmc_writesectors(&deviceSD, msg.sdParams.startsector, msg.sdParams.numsectors, msg.sdParams.buffer);
+			req.device = &deviceSD;
+			req.write = true;
 			break;
 		case SDMMC_NAND_READ_SECTORS:
-			retval = my_sdmmc_readsectors(&deviceNAND, msg.sdParams.startsector, msg.sdParams.numsectors, msg.sdParams.buffer);
+			req.device = &deviceNAND;
 			break;
 		case SDMMC_NAND_WRITE_SECTORS:
-			retval = my_sdmmc_writesectors(&deviceNAND, msg.sdParams.startsector, msg.sdParams.numsectors, msg.sdParams.buffer);
+			req.device = &deviceNAND;
+			req.write = true;
 			break;
 	}
 
+	req.sector = msg.sdParams.startsector;
+	req.numsectors = msg.sdParams.numsectors;
+	req.buffer = msg.sdParams.buffer;
+
+	// FIFO handlers run with interrupts enabled, so a full queue drains
+	while (sdmmcQueueCount == SDMMC_QUEUE_LEN);
+
+	int oldIME = enterCriticalSection();
+
+	sdmmcQueue[(sdmmcQueueHead + sdmmcQueueCount) % SDMMC_QUEUE_LEN] = req;
+	sdmmcQueueCount++;
+	my_sdmmc_start_next();
+
 	leaveCriticalSection(oldIME);
+}
 
-	fifoSendValue32(FIFO_SDMMC, retval);
+//---------------------------------------------------------------------------------
+void my_sdmmc_install()
+//---------------------------------------------------------------------------------
+{
+	irqSetAUX(IRQ_SDMMC, my_sdmmcIrqHandler);
+	irqEnableAUX(IRQ_SDMMC);
+
+	fifoSetDatamsgHandler(FIFO_SDMMC, my_sdmmcMsgHandler, NULL);
+	fifoSetValue32Handler(FIFO_SDMMC, my_sdmmcValueHandler, NULL);
+	fifoSetValue32Handler(FIFO_USER_04, my_sdmmcPathHandler, NULL);
+}
+
+// Selects how sector data moves through the controller, for benchmarking
+//---------------------------------------------------------------------------------
+void my_sdmmcPathHandler(u32 value, void* user_data)
+//---------------------------------------------------------------------------------
+{
+	// Only switch between transfers
+	while (sdmmcQueueCount > 0);
+
+	if (value < SDMMC_PATH_COUNT)
+		sdmmcDataPath = value;
+
+	fifoSendValue32(FIFO_USER_04, sdmmcDataPath);
 }
 
 //---------------------------------------------------------------------------------
@@ -626,6 +1021,10 @@ void my_sdmmcValueHandler(u32 value, void* user_data)
 {
 	int result = 0;
 	int sdflag = 0;
+
+	// Let queued transfers finish before touching the controller
+	while (sdmmcQueueCount > 0);
+
 	int oldIME = enterCriticalSection();
 
 	switch (value)
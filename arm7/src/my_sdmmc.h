@@ -151,6 +151,43 @@ int my_sdmmc_sdcard_writesectors(u32 sector_no, u32 numsectors, void *in);
 int my_sdmmc_nand_readsectors(u32 sector_no, u32 numsectors, void *out);
 int my_sdmmc_nand_writesectors(u32 sector_no, u32 numsectors, void *in);
 
+#define SDMMC_QUEUE_LEN 8
+#define SDMMC_BOUNCE_SECTORS 4
+
+// Data paths for queued transfers, selected over FIFO_USER_04
+enum {
+	SDMMC_PATH_16,
+	SDMMC_PATH_32,
+	SDMMC_PATH_NDMA,
+	SDMMC_PATH_COUNT
+};
+
+#ifdef DATA32_SUPPORT
+#define SDMMC_PATH_DEFAULT SDMMC_PATH_32
+#else
+#define SDMMC_PATH_DEFAULT SDMMC_PATH_16
+#endif
+
+// NDMA channel used for SD/MMC transfers
+#define SDMMC_NDMA_BASE   (0x04004104 + 1 * 0x1C)
+#define SDMMC_NDMA_SAD    (*(vu32*)(SDMMC_NDMA_BASE + 0x00))
+#define SDMMC_NDMA_DAD    (*(vu32*)(SDMMC_NDMA_BASE + 0x04))
+#define SDMMC_NDMA_TCNT   (*(vu32*)(SDMMC_NDMA_BASE + 0x08))
+#define SDMMC_NDMA_WCNT   (*(vu32*)(SDMMC_NDMA_BASE + 0x0C))
+#define SDMMC_NDMA_BCNT   (*(vu32*)(SDMMC_NDMA_BASE + 0x10))
+#define SDMMC_NDMA_CNT    (*(vu32*)(SDMMC_NDMA_BASE + 0x18))
+
+#define SDMMC_NDMA_ENABLE 0x80000000
+// enable, SD/MMC startup, 64 word bursts, FIFO address fixed
+#define SDMMC_NDMA_READ   (SDMMC_NDMA_ENABLE | (0x08 << 24) | (6 << 16) | (2 << 13))
+#define SDMMC_NDMA_WRITE  (SDMMC_NDMA_ENABLE | (0x08 << 24) | (6 << 16) | (2 << 10))
+
+void my_sdmmcMsgHandler(int bytes, void *user_data);
+void my_sdmmcValueHandler(u32 value, void* user_data);
+void my_sdmmcIrqHandler();
+void my_sdmmcPathHandler(u32 value, void* user_data);
+void my_sdmmc_install();
+
 extern u32 sdmmc_cid[];
 extern int sdmmc_curdevice;
 
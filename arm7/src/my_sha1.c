@@ -0,0 +1,92 @@
+#include "my_sha1.h"
+
+#include <nds.h>
+
+// Give up on a block after this many polls, the ARM9 then falls back to the BIOS
+#define SHA1_TIMEOUT 0x10000
+
+static Sha1Request* volatile sha1Pending = NULL;
+
+//---------------------------------------------------------------------------------
+static bool sha1WaitIdle()
+//---------------------------------------------------------------------------------
+{
+	for (int i = 0; i < SHA1_TIMEOUT; i++)
+	{
+		if ((REG_SHA_CNT & SHA_CNT_START) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+//---------------------------------------------------------------------------------
+static bool sha1Blocks(Sha1Request* req)
+//---------------------------------------------------------------------------------
+{
+	const u32* src = (const u32*)req->data;
+
+	if (!sha1WaitIdle())
+		return false;
+
+	for (int i = 0; i < 5; i++)
+		REG_SHA_HASH[i] = req->state[i];
+
+	for (u32 block = 0; block < req->blocks; block++, src += 16)
+	{
+		if (req->flags & SHA1_REQ_DMA)
+		{
+			SHA1_NDMA_SAD = (u32)src;
+			SHA1_NDMA_DAD = (u32)REG_SHA_IN;
+			SHA1_NDMA_TCNT = 16;
+			SHA1_NDMA_WCNT = 16;
+			SHA1_NDMA_BCNT = 0;
+			SHA1_NDMA_CNT = SHA1_NDMA_BLOCK;
+			while (SHA1_NDMA_CNT & SHA1_NDMA_ENABLE);
+		}
+		else
+		{
+			for (int i = 0; i < 16; i++)
+				REG_SHA_IN[i] = src[i];
+		}
+
+		REG_SHA_CNT = SHA_CNT_START;
+
+		if (!sha1WaitIdle())
+			return false;
+	}
+
+	for (int i = 0; i < 5; i++)
+		req->state[i] = REG_SHA_HASH[i];
+
+	return true;
+}
+
+// Hashing can take a while, so only note the request here and leave the
+// work to the main loop where the SD/MMC interrupts still get through
+//---------------------------------------------------------------------------------
+static void my_sha1AddressHandler(void* address, void* user_data)
+//---------------------------------------------------------------------------------
+{
+	sha1Pending = (Sha1Request*)address;
+}
+
+//---------------------------------------------------------------------------------
+void my_sha1_install()
+//---------------------------------------------------------------------------------
+{
+	REG_SHA_CNT = 0;
+	fifoSetAddressHandler(FIFO_USER_05, my_sha1AddressHandler, NULL);
+}
+
+//---------------------------------------------------------------------------------
+void my_sha1_service()
+//---------------------------------------------------------------------------------
+{
+	Sha1Request* req = sha1Pending;
+	if (!req)
+		return;
+
+	sha1Pending = NULL;
+	fifoSendValue32(FIFO_USER_05, sha1Blocks(req) ? 1 : 0);
+}
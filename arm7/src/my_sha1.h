@@ -0,0 +1,42 @@
+#ifndef __MY_SHA1_H__
+#define __MY_SHA1_H__
+
+#include <nds/ndstypes.h>
+
+// DSi SHA-1 engine, only mapped on the ARM7
+#define REG_SHA_CNT     (*(vu32*)0x04004700)
+#define REG_SHA_BLKCNT  (*(vu32*)0x04004704)
+#define REG_SHA_IN      ((vu32*)0x04004740)
+#define REG_SHA_HASH    ((vu32*)0x04004780)
+
+#define SHA_CNT_START   BIT(0)	// hashes the 64 bytes in SHA_IN into SHA_HASH, reads 1 while busy
+#define SHA_CNT_FINAL   BIT(1)	// let the engine pad, unused as the ARM9 pads itself
+
+// NDMA channel used to feed the engine, channel 1 belongs to the SD/MMC driver
+#define SHA1_NDMA_BASE   (0x04004104 + 2 * 0x1C)
+#define SHA1_NDMA_SAD    (*(vu32*)(SHA1_NDMA_BASE + 0x00))
+#define SHA1_NDMA_DAD    (*(vu32*)(SHA1_NDMA_BASE + 0x04))
+#define SHA1_NDMA_TCNT   (*(vu32*)(SHA1_NDMA_BASE + 0x08))
+#define SHA1_NDMA_WCNT   (*(vu32*)(SHA1_NDMA_BASE + 0x0C))
+#define SHA1_NDMA_BCNT   (*(vu32*)(SHA1_NDMA_BASE + 0x10))
+#define SHA1_NDMA_CNT    (*(vu32*)(SHA1_NDMA_BASE + 0x18))
+
+#define SHA1_NDMA_ENABLE 0x80000000
+// start immediately, one 16 word burst
+#define SHA1_NDMA_BLOCK  (SHA1_NDMA_ENABLE | (0x10 << 24) | (4 << 16))
+
+// Request flags, must match SHA1_REQ_* in the arm9 sha1.h
+#define SHA1_REQ_DMA     BIT(0)
+
+// Sent by address on FIFO_USER_05, lives in main RAM
+typedef struct {
+	u32 flags;
+	const void* data;	// word aligned
+	u32 blocks;			// 64 byte blocks
+	u32 state[5];		// loaded before and read back after the blocks
+} Sha1Request;
+
+void my_sha1_install();
+void my_sha1_service();
+
+#endif
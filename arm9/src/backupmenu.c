@@ -1,4 +1,5 @@
 #include "install.h"
+#include "lz.h"
 #include "main.h"
 #include "menu.h"
 #include "rom.h"
@@ -157,7 +158,8 @@ static void generateList(Menu* m)
 			}
 			else
 			{
-				if (strcasecmp(strrchr(ent->d_name, '.'), ".tad") == 0) 
+				char* extension = strrchr(ent->d_name, '.');
+				if (extension && strcasecmp(extension, ".tlz") == 0)
 				{
 					if (count < m->page * ITEMS_PER_PAGE)
 						count += 1;
@@ -200,10 +202,18 @@ static void printItem(Menu* m)
 	if (!m) return;
 	if (m->itemCount <= 0) return;
 
-	if (m->items[m->cursor].directory)
-		clearScreen(&topScreen);
-	else
-		printRomInfo(m->items[m->cursor].value);
+	clearScreen(&topScreen);
+
+	//the rom header is compressed, so only the sizes are shown
+	if (!m->items[m->cursor].directory)
+	{
+		iprintf("%s\n\n", m->items[m->cursor].label);
+		iprintf("Size: ");
+		printBytes(lzGetRawSize(m->items[m->cursor].value));
+		iprintf("\nCompressed: ");
+		printBytes(getFileSizePath(m->items[m->cursor].value));
+		iprintf("\n");
+	}
 }
 
 static bool delete(Menu* m)
@@ -260,6 +270,14 @@ static bool delete(Menu* m)
 				strcpy(strrchr(fpath, '.'), ".bnr");
 				remove(fpath);
 
+				//ticket
+				strcpy(strrchr(fpath, '.'), ".tik");
+				remove(fpath);
+
+				//manifest
+				strcpy(strrchr(fpath, '.'), ".man");
+				remove(fpath);
+
 				result = true;
 				messagePrint("\x1B[42m\nBackup deleted.\n\x1B[47m");
 			}
@@ -0,0 +1,365 @@
+#include "benchmark.h"
+#include "main.h"
+#include "message.h"
+#include "nand/crypto.h"
+#include "nand/nandio.h"
+#include "nand/tcm.h"
+#include "nand/twltool/dsi.h"
+#include "sha1.h"
+#include "stagetime.h"
+#include "version.h"
+#include <malloc.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BENCH_FILE_SIZE  (1024 * 1024)
+#define BENCH_RANDOM_OPS 32
+#define BENCH_BUF_SIZE   (128 * 1024)
+#define BENCH_CRYPT_SIZE (64 * 1024)
+#define BENCH_CRYPT_RUNS 4
+#define BENCH_TCM_SIZE   2048
+
+//the default four tables each way or "make AES_TABLES=fewer"
+#if defined(POLARSSL_AES_FEWER_TABLES)
+#define BENCH_AES_TABLES "small"
+#else
+#define BENCH_AES_TABLES "full"
+#endif
+
+#define BENCH_SD_PATH   "sd:/_nds/TADDeliveryTool/bench.tmp"
+#define BENCH_NAND_PATH "nand:/tmp/bench.tmp"
+
+enum {
+	BENCH_SEQ_READ,
+	BENCH_SEQ_WRITE,
+	BENCH_RANDOM_READ,
+	BENCH_RANDOM_WRITE,
+	BENCH_TEST_COUNT
+};
+
+static const u32 blockSizes[] = { 512, 4 * 1024, 32 * 1024, 128 * 1024 };
+
+static FILE* logFile = NULL;
+static u32 startTicks = 0;
+
+//prints to the screen and the log file
+static void _out(char const* fmt, ...)
+{
+	char line[64];
+
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+
+	iprintf("%s", line);
+
+	if (logFile)
+		fputs(line, logFile);
+}
+
+static void _timerStart()
+{
+	startTicks = stageTicks();
+}
+
+static u32 _timerEnd()
+{
+	return stageTicks() - startTicks;
+}
+
+static u32 _kbps(u32 bytes, u32 ticks)
+{
+	u32 us = stageTicksToUsec(ticks);
+	return (us == 0) ? 0 : (u32)(((u64)bytes * 1000000 / 1024) / us);
+}
+
+static bool _createFile(char const* path, u8* buffer)
+{
+	FILE* f = fopen(path, "wb");
+	if (!f) return false;
+
+	bool ok = true;
+	for (u32 i = 0; i < BENCH_FILE_SIZE && ok; i += BENCH_BUF_SIZE)
+		ok = fwrite(buffer, BENCH_BUF_SIZE, 1, f) == 1;
+
+	fclose(f);
+	return ok;
+}
+
+//returns KiB/s, 0 on failure
+static u32 _fileTest(char const* path, int test, u32 blockSize, u8* buffer)
+{
+	bool write = (test == BENCH_SEQ_WRITE || test == BENCH_RANDOM_WRITE);
+	bool random = (test == BENCH_RANDOM_READ || test == BENCH_RANDOM_WRITE);
+
+	FILE* f = fopen(path, write ? "r+b" : "rb");
+	if (!f) return 0;
+
+	//stdio buffering would hide the block size
+	setvbuf(f, NULL, _IONBF, 0);
+
+	u32 blocks = BENCH_FILE_SIZE / blockSize;
+	u32 count = random ? BENCH_RANDOM_OPS : blocks;
+	bool ok = true;
+
+	_timerStart();
+
+	for (u32 i = 0; i < count && ok; i++)
+	{
+		if (random)
+			ok = fseek(f, (rand() % blocks) * blockSize, SEEK_SET) == 0;
+
+		if (ok)
+			ok = (write ? fwrite(buffer, blockSize, 1, f) : fread(buffer, blockSize, 1, f)) == 1;
+	}
+
+	if (ok && write)
+		ok = fsync(fileno(f)) == 0;
+
+	u32 ticks = _timerEnd();
+	fclose(f);
+
+	return ok ? _kbps(count * blockSize, ticks) : 0;
+}
+
+//reads through the NAND disc interface when no test file can be written
+static u32 _rawTest(int test, u32 blockSize, u8* buffer)
+{
+	bool random = (test == BENCH_RANDOM_READ);
+
+	u32 sectors = blockSize / 512;
+	u32 blocks = BENCH_FILE_SIZE / blockSize;
+	u32 count = random ? BENCH_RANDOM_OPS : blocks;
+	bool ok = true;
+
+	_timerStart();
+
+	for (u32 i = 0; i < count && ok; i++)
+	{
+		u32 block = random ? (rand() % blocks) : i;
+		ok = io_dsi_nand.readSectors(block * sectors, sectors, buffer);
+	}
+
+	u32 ticks = _timerEnd();
+
+	return ok ? _kbps(count * blockSize, ticks) : 0;
+}
+
+static void _storageTests(char const* name, char const* path, u8* buffer)
+{
+	_out("\n%s KiB/s\n", name);
+
+	bool raw = (path == NULL);
+
+	if (!raw && !_createFile(path, buffer))
+	{
+		_out("  could not create test file\n");
+		return;
+	}
+
+	_out("block   seqR  seqW  rndR  rndW\n");
+
+	for (int i = 0; i < sizeof(blockSizes) / sizeof(blockSizes[0]) && !programEnd; i++)
+	{
+		u32 size = blockSizes[i];
+
+		if (size < 1024)
+			_out("%5lu ", size);
+		else
+			_out("%4luK ", size / 1024);
+
+		for (int test = 0; test < BENCH_TEST_COUNT; test++)
+		{
+			bool write = (test == BENCH_SEQ_WRITE || test == BENCH_RANDOM_WRITE);
+
+			if (raw && write)
+			{
+				_out("     -");
+				continue;
+			}
+
+			u32 kbps = raw ? _rawTest(test, size, buffer) : _fileTest(path, test, size, buffer);
+
+			if (kbps == 0)
+				_out("  fail");
+			else
+				_out("%6lu", kbps);
+		}
+
+		_out("\n");
+	}
+
+	if (!raw)
+		remove(path);
+}
+
+static void _cryptoResult(char const* name, u32 ticks)
+{
+	_out("%-12s %8lu\n", name, _kbps(BENCH_CRYPT_SIZE * BENCH_CRYPT_RUNS, ticks));
+}
+
+static void _cryptoTests(u8* buffer)
+{
+	u8* in = buffer;
+	u8* out = buffer + BENCH_CRYPT_SIZE;
+
+	u8 key[16] = { 0 };
+	u8 nonce[16] = { 0 };
+	u8 iv[16] = { 0 };
+	u8 mac[16];
+	u8 digest[20];
+
+	aes_context aes;
+	dsi_context dsi;
+
+	_out("\nCrypto          KiB/s\n");
+#if defined(CRYPTO_TCM_OFF)
+	_out("%s AES tables, all in main RAM\n", BENCH_AES_TABLES);
+#else
+	_out("%s AES tables, %d in DTCM\n", BENCH_AES_TABLES, AES_DTCM_TABLES);
+#endif
+
+	aes_setkey_enc(&aes, key, 128);
+
+	//AES-ECB, one block per call like the rest of the code
+	_timerStart();
+	repeat(BENCH_CRYPT_RUNS)
+	{
+		for (u32 i = 0; i < BENCH_CRYPT_SIZE; i += 16)
+			aes_crypt_ecb(&aes, AES_ENCRYPT, in + i, out + i);
+	}
+	_cryptoResult("AES-ECB", _timerEnd());
+
+	//AES-CBC
+	_timerStart();
+	repeat(BENCH_CRYPT_RUNS)
+		aes_crypt_cbc(&aes, AES_ENCRYPT, BENCH_CRYPT_SIZE, iv, in, out);
+	_cryptoResult("AES-CBC", _timerEnd());
+
+	//AES-CBC decryption as for TAD contents, the only user of the reverse tables
+	aes_setkey_dec(&aes, key, 128);
+	_timerStart();
+	repeat(BENCH_CRYPT_RUNS)
+		aes_crypt_cbc(&aes, AES_DECRYPT, BENCH_CRYPT_SIZE, iv, in, out);
+	_cryptoResult("AES-CBC dec", _timerEnd());
+
+	//AES-CTR, this PolarSSL has no CTR mode so use the dsi.c one
+	dsi_init_ctr(&dsi, key, nonce);
+	_timerStart();
+	repeat(BENCH_CRYPT_RUNS)
+		dsi_crypt_ctr(&dsi, in, out, BENCH_CRYPT_SIZE);
+	_cryptoResult("AES-CTR", _timerEnd());
+
+	//the same on a buffer in DTCM, where the stack lives
+	u8 tcm[BENCH_TCM_SIZE];
+	memcpy(tcm, in, sizeof(tcm));
+	_timerStart();
+	repeat(BENCH_CRYPT_RUNS)
+	{
+		for (u32 i = 0; i < BENCH_CRYPT_SIZE; i += sizeof(tcm))
+			dsi_crypt_ctr(&dsi, tcm, tcm, sizeof(tcm));
+	}
+	_cryptoResult("AES-CTR DTCM", _timerEnd());
+
+	//AES-CCM as used for tickets and TAD sections
+	_timerStart();
+	repeat(BENCH_CRYPT_RUNS)
+	{
+		dsi_init_ccm(&dsi, key, 16, BENCH_CRYPT_SIZE, 0, nonce);
+		dsi_encrypt_ccm(&dsi, in, out, BENCH_CRYPT_SIZE, mac);
+	}
+	_cryptoResult("AES-CCM", _timerEnd());
+
+	//BIOS SHA-1
+	_timerStart();
+	repeat(BENCH_CRYPT_RUNS)
+		swiSHA1Calc(digest, in, BENCH_CRYPT_SIZE);
+	_cryptoResult("SHA-1", _timerEnd());
+
+	//SHA-1 engine on the ARM7, fed by the CPU and then by NDMA
+	if (sha1Hardware())
+	{
+		sha1SetDma(false);
+		_timerStart();
+		repeat(BENCH_CRYPT_RUNS)
+			sha1Calc(digest, in, BENCH_CRYPT_SIZE);
+		_cryptoResult("SHA-1 engine", _timerEnd());
+
+		if (sha1SetDma(true))
+		{
+			_timerStart();
+			repeat(BENCH_CRYPT_RUNS)
+				sha1Calc(digest, in, BENCH_CRYPT_SIZE);
+			_cryptoResult("SHA-1 NDMA", _timerEnd());
+		}
+	}
+
+	//NAND sector crypt
+	_timerStart();
+	repeat(BENCH_CRYPT_RUNS)
+		dsi_nand_crypt(out, in, 0, BENCH_CRYPT_SIZE / 16);
+	_cryptoResult("NAND crypt", _timerEnd());
+}
+
+void benchmarkSuite()
+{
+	clearScreen(&topScreen);
+	iprintf("Benchmark Suite\n\n");
+	iprintf("Sequential and random file I/O\n");
+	iprintf("on SD and NAND, then crypto.\n\n");
+	iprintf("Results are appended to:\n%s\n", BENCHMARK_LOG_PATH);
+
+	if (choiceBox("Run the benchmark suite?\n\nThis writes a 1 MiB test file\nand may take a minute.") == NO)
+		return;
+
+	//without writing unlocked NAND is only read, through the disc interface
+	bool nandWrite = false;
+	if (!sdnandMode && choiceBox("Include NAND write tests?") == YES)
+		nandWrite = nandio_unlock_writing();
+
+	u8* buffer = (u8*)memalign(32, BENCH_BUF_SIZE);
+	if (!buffer)
+	{
+		if (nandWrite)
+			nandio_lock_writing();
+
+		messageBox("\x1B[31mError:\x1B[33m Not enough memory.\n");
+		return;
+	}
+
+	for (int i = 0; i < BENCH_BUF_SIZE; i++)
+		buffer[i] = rand();
+
+	mkdir("sd:/_nds", 0777);
+	mkdir("sd:/_nds/TADDeliveryTool", 0777);
+	logFile = fopen(BENCHMARK_LOG_PATH, "a");
+
+	clearScreen(&bottomScreen);
+	_out("%s %s\n", VERSION, sdnandMode ? "sdnand" : "sysnand");
+
+	_storageTests("SD", BENCH_SD_PATH, buffer);
+
+	if (!programEnd)
+		_storageTests(nandWrite ? "NAND" : "NAND (raw read)", nandWrite ? BENCH_NAND_PATH : NULL, buffer);
+
+	if (nandWrite)
+		nandio_lock_writing();
+
+	if (!programEnd)
+		_cryptoTests(buffer);
+
+	free(buffer);
+
+	if (logFile)
+	{
+		fputs("\n", logFile);
+		fclose(logFile);
+		logFile = NULL;
+	}
+
+	iprintf("\nBack - [B]\n");
+	keyWait(KEY_B);
+}
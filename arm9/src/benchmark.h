@@ -0,0 +1,12 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <nds/ndstypes.h>
+
+//storage and crypto throughput tests, results are shown on screen and
+//appended to a text file on SD so runs can be compared between builds
+#define BENCHMARK_LOG_PATH "sd:/_nds/TADDeliveryTool/benchmark.txt"
+
+void benchmarkSuite();
+
+#endif
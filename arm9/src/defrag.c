@@ -0,0 +1,368 @@
+#include "defrag.h"
+#include "main.h"
+#include "fatmap.h"
+#include "message.h"
+#include "nand/nandio.h"
+#include "progress.h"
+#include "task.h"
+#include "storage.h"
+#include <dirent.h>
+#include <unistd.h>
+
+//the journal names the file being moved and how far the move got, so an
+//interrupted run can be finished or rolled back the next time
+#define DEFRAG_JOURNAL "sd:/_nds/TADDeliveryTool/defrag.txt"
+#define DEFRAG_BUFF_SIZE (64 * 1024)
+
+enum {
+	DEFRAG_STAGE_COPY,
+	DEFRAG_STAGE_SWAP
+};
+
+static void _writeJournal(int stage, char const* path)
+{
+	mkdir("sd:/_nds", 0777);
+	mkdir("sd:/_nds/TADDeliveryTool", 0777);
+
+	FILE* f = fopen(DEFRAG_JOURNAL, "w");
+	if (f)
+	{
+		fprintf(f, "%d\n%s\n", stage, path);
+		fclose(f);
+	}
+}
+
+static bool _readJournal(int* stage, char* path, int len)
+{
+	FILE* f = fopen(DEFRAG_JOURNAL, "r");
+	if (!f) return false;
+
+	bool result = fscanf(f, "%d\n", stage) == 1 && fgets(path, len, f) != NULL;
+	fclose(f);
+
+	if (result)
+		path[strcspn(path, "\n")] = '\0';
+
+	return result && path[0] != '\0';
+}
+
+static void _tmpPath(char const* path, char* out)
+{
+	strcpy(out, path);
+	char* slash = strrchr(out, '/');
+	strcpy(slash ? slash + 1 : out, "defrag.tmp");
+}
+
+//libfat keeps FAT and directory changes cached until a file is synced
+static void _flushFat(char const* path)
+{
+	FILE* f = fopen(path, "rb");
+	if (f)
+	{
+		fsync(fileno(f));
+		fclose(f);
+	}
+}
+
+bool defragPending()
+{
+	return fileExists(DEFRAG_JOURNAL);
+}
+
+//the journal is only dropped once the file is back in one piece
+static bool _recover()
+{
+	int stage = 0;
+	char path[PATH_MAX];
+	char tmpPath[PATH_MAX];
+
+	if (!_readJournal(&stage, path, sizeof(path)))
+	{
+		remove(DEFRAG_JOURNAL);
+		return true;
+	}
+
+	_tmpPath(path, tmpPath);
+	iprintf("Recovering %s...", path);
+
+	//the run may have been on NAND while this one is in SDNAND mode
+	bool unlocked = false;
+	if (sdnandMode && strncmp(path, "nand:", 5) == 0)
+	{
+		if (!nandio_unlock_writing())
+		{
+			iprintf("\x1B[31m");	//red
+			iprintf("Failed\n");
+			iprintf("\x1B[47m");	//white
+			return false;
+		}
+
+		unlocked = true;
+	}
+
+	//before the swap the original is still intact, after it the copy is
+	bool result;
+	if (stage == DEFRAG_STAGE_COPY)
+	{
+		remove(tmpPath);
+		result = !fileExists(tmpPath);
+	}
+	else
+	{
+		if (fileExists(tmpPath))
+		{
+			if (fileExists(path))
+				remove(path);
+			rename(tmpPath, path);
+		}
+
+		result = fileExists(path) && !fileExists(tmpPath);
+	}
+
+	_flushFat(path);
+
+	if (unlocked)
+		nandio_lock_writing();
+
+	if (result)
+	{
+		remove(DEFRAG_JOURNAL);
+
+		iprintf("\x1B[42m");	//green
+		iprintf("Done\n");
+		iprintf("\x1B[47m");	//white
+	}
+	else
+	{
+		iprintf("\x1B[31m");	//red
+		iprintf("Failed\n");
+		iprintf("\x1B[47m");	//white
+	}
+
+	return result;
+}
+
+static bool _copyContents(char const* src, char const* dst, unsigned long long size)
+{
+	FILE* fin = fopen(src, "rb");
+	FILE* fout = fopen(dst, "r+b");
+	u8* buffer = (u8*)malloc(DEFRAG_BUFF_SIZE);
+
+	bool result = fin && fout && buffer;
+	unsigned long long done = 0;
+
+	progressStart(size, true);
+
+	//a cancel only stops the run between files, this just polls for it
+	while (result && done < size && !programEnd)
+	{
+		taskYield();
+
+		unsigned int toRead = DEFRAG_BUFF_SIZE;
+		if (size - done < DEFRAG_BUFF_SIZE)
+			toRead = size - done;
+
+		if (fread(buffer, 1, toRead, fin) != toRead || fwrite(buffer, 1, toRead, fout) != toRead)
+			result = false;
+
+		done += toRead;
+		progressSet(done);
+	}
+
+	progressEnd();
+	consoleSelect(&bottomScreen);
+
+	free(buffer);
+	if (fout) fclose(fout);
+	if (fin) fclose(fin);
+
+	return result && done == size;
+}
+
+//returns 0 when moved, 1 when skipped and -1 on failure
+static int _defragFile(char const* path)
+{
+	char tmpPath[PATH_MAX];
+	_tmpPath(path, tmpPath);
+
+	unsigned long long size = getFileSizePath(path);
+
+	_writeJournal(DEFRAG_STAGE_COPY, path);
+
+	//no contiguous run large enough, leave the file as it is
+	if (!allocateContiguous(tmpPath, size))
+	{
+		remove(tmpPath);
+		remove(DEFRAG_JOURNAL);
+		return 1;
+	}
+
+	if (!_copyContents(path, tmpPath, size))
+	{
+		remove(tmpPath);
+		remove(DEFRAG_JOURNAL);
+		return -1;
+	}
+
+	//the run can still be lost to another allocation, then the copy is no better
+	if (getFileFragments(tmpPath, NULL) != 1)
+	{
+		remove(tmpPath);
+		remove(DEFRAG_JOURNAL);
+		return 1;
+	}
+
+	_writeJournal(DEFRAG_STAGE_SWAP, path);
+
+	int attr = FAT_getAttr(path);
+	if (remove(path) != 0 || rename(tmpPath, path) != 0)
+		return -1;
+
+	FAT_setAttr(path, attr);
+	_flushFat(path);
+	remove(DEFRAG_JOURNAL);
+	return 0;
+}
+
+static char** _listFragmented(int* count)
+{
+	const char* dirs[] = {
+		"00030004",
+		"00030005",
+		"00030015",
+		"00030017"
+	};
+
+	char** list = NULL;
+	*count = 0;
+
+	for (int i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++)
+	{
+		char dirPath[32];
+		sprintf(dirPath, "%s:/title/%s", sdnandMode ? "sd" : "nand", dirs[i]);
+
+		DIR* dir = opendir(dirPath);
+		if (!dir)
+			continue;
+
+		struct dirent* ent;
+		while ((ent = readdir(dir)))
+		{
+			if (ent->d_type != DT_DIR || ent->d_name[0] == '.')
+				continue;
+
+			char contentPath[64];
+			sprintf(contentPath, "%s/%s/content", dirPath, ent->d_name);
+
+			DIR* content = opendir(contentPath);
+			if (!content)
+				continue;
+
+			struct dirent* app;
+			while ((app = readdir(content)))
+			{
+				if (!strstr(app->d_name, ".app"))
+					continue;
+
+				char appPath[96];
+				sprintf(appPath, "%s/%s", contentPath, app->d_name);
+
+				if (getFileFragments(appPath, NULL) > 1)
+				{
+					list = (char**)realloc(list, (*count + 1) * sizeof(char*));
+					list[*count] = strdup(appPath);
+					*count += 1;
+				}
+			}
+
+			closedir(content);
+		}
+
+		closedir(dir);
+	}
+
+	return list;
+}
+
+void defragTitles()
+{
+	if (!sdnandMode && !nandio_unlock_writing())
+		return;
+
+	clearScreen(&bottomScreen);
+	iprintf("Defragmenting titles\n");
+	iprintf("Cancel - hold [B]\n\n");
+
+	//a new run would overwrite the journal of the one still pending
+	if (defragPending() && !_recover())
+	{
+		if (!sdnandMode)
+			nandio_lock_writing();
+
+		messagePrint("\x1B[31m\nThe interrupted run could not\nbe recovered.\n\x1B[47m");
+		return;
+	}
+
+	iprintf("Scanning...");
+	swiWaitForVBlank();
+
+	int count = 0;
+	char** list = _listFragmented(&count);
+
+	iprintf("%d fragmented\n\n", count);
+
+	int moved = 0;
+	bool stopped = false;
+	taskBegin(true);
+
+	for (int i = 0; i < count; i++)
+	{
+		if (!taskStopped() && !stopped)
+		{
+			iprintf("%s...", list[i]);
+			swiWaitForVBlank();
+
+			switch (_defragFile(list[i]))
+			{
+				case 0:
+					moved++;
+					iprintf("\x1B[42m");	//green
+					iprintf("Done\n");
+					break;
+
+				case 1:
+					iprintf("\x1B[33m");	//yellow
+					iprintf("No space\n");
+					break;
+
+				default:
+					iprintf("\x1B[31m");	//red
+					iprintf("Failed\n");
+					break;
+			}
+			iprintf("\x1B[47m");	//white
+
+			//a failed swap keeps its journal, the next run finishes it first
+			stopped = defragPending();
+		}
+
+		free(list[i]);
+	}
+	free(list);
+
+	bool cancelled = taskEnd();
+
+	if (!sdnandMode)
+	{
+		//bring the other FAT copies up to date before locking again
+		nandio_sync_fat_copies();
+		nandio_lock_writing();
+	}
+
+	if (cancelled)
+		iprintf("\x1B[33m\nDefragmenting cancelled.\n\x1B[47m");
+
+	iprintf("\n%d of %d files defragmented.\n", moved, count);
+	iprintf("Back - [B]\n");
+	keyWait(KEY_B);
+}
@@ -0,0 +1,9 @@
+#ifndef DEFRAG_H
+#define DEFRAG_H
+
+#include <nds/ndstypes.h>
+
+bool defragPending();
+void defragTitles();
+
+#endif
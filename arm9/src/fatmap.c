@@ -0,0 +1,286 @@
+#include "fatmap.h"
+#include "main.h"
+#include "nand/nandio.h"
+#include <sys/iosupport.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static inline u16 _le16(u8 const* p) { return p[0] | (p[1] << 8); }
+static inline u32 _le32(u8 const* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24); }
+
+static bool _isVbr(u8 const* sector)
+{
+	return (sector[0] == 0xEB || sector[0] == 0xE9) && _le16(sector + 0x0B) == 512 && sector[0x0D] != 0 && sector[0x10] != 0;
+}
+
+bool fatMapOpen(FatMap* fm, bool nand)
+{
+	if (!fm) return false;
+
+	fm->disc = nand ? &io_dsi_nand : get_io_dsisd();
+	fm->cachedSector = 0xFFFFFFFF;
+
+	if (!fm->disc || !fm->disc->readSectors(0, 1, fm->cache))
+		return false;
+
+	//sector 0 is either the volume itself or an MBR
+	u32 partitionStart = 0;
+	if (!_isVbr(fm->cache))
+	{
+		partitionStart = _le32(fm->cache + 0x1C6);
+		if (!fm->disc->readSectors(partitionStart, 1, fm->cache) || !_isVbr(fm->cache))
+			return false;
+	}
+
+	u8 const* vbr = fm->cache;
+	u32 reserved = _le16(vbr + 0x0E);
+	u32 numFats = vbr[0x10];
+	u32 rootSectors = (_le16(vbr + 0x11) * 32 + 511) / 512;
+	u32 totalSectors = _le16(vbr + 0x13) ? _le16(vbr + 0x13) : _le32(vbr + 0x20);
+	u32 fatSize = _le16(vbr + 0x16) ? _le16(vbr + 0x16) : _le32(vbr + 0x24);
+
+	fm->sectorsPerCluster = vbr[0x0D];
+	fm->bytesPerCluster = fm->sectorsPerCluster * 512;
+	fm->fatStart = partitionStart + reserved;
+	fm->dataStart = fm->fatStart + numFats * fatSize + rootSectors;
+	fm->clusterCount = (totalSectors - (reserved + numFats * fatSize + rootSectors)) / fm->sectorsPerCluster;
+
+	if (fm->clusterCount < 4085)
+		fm->fatBits = 12;
+	else if (fm->clusterCount < 65525)
+		fm->fatBits = 16;
+	else
+		fm->fatBits = 32;
+
+	fm->cachedSector = 0xFFFFFFFF;
+	return true;
+}
+
+//FAT12 entries can straddle two sectors, so two are cached together
+static u8* _fatEntry(FatMap* fm, u32 offset)
+{
+	u32 sector = fm->fatStart + offset / 512;
+
+	if (sector != fm->cachedSector)
+	{
+		if (!fm->disc->readSectors(sector, 2, fm->cache))
+		{
+			fm->cachedSector = 0xFFFFFFFF;
+			return NULL;
+		}
+
+		fm->cachedSector = sector;
+	}
+
+	return fm->cache + offset % 512;
+}
+
+u32 fatMapNext(FatMap* fm, u32 cluster)
+{
+	if (!fm || cluster < 2 || cluster > fm->clusterCount + 1)
+		return FATMAP_EOC;
+
+	u32 value;
+	u8* entry;
+
+	switch (fm->fatBits)
+	{
+		case 12:
+			entry = _fatEntry(fm, cluster + cluster / 2);
+			if (!entry) return FATMAP_EOC;
+
+			value = _le16(entry);
+			value = (cluster & 1) ? (value >> 4) : (value & 0xFFF);
+			return (value >= 0xFF7) ? FATMAP_EOC : value;
+
+		case 16:
+			entry = _fatEntry(fm, cluster * 2);
+			if (!entry) return FATMAP_EOC;
+
+			value = _le16(entry);
+			return (value >= 0xFFF7) ? FATMAP_EOC : value;
+
+		default:
+			entry = _fatEntry(fm, cluster * 4);
+			if (!entry) return FATMAP_EOC;
+
+			value = _le32(entry) & 0x0FFFFFFF;
+			return (value >= 0x0FFFFFF7) ? FATMAP_EOC : value;
+	}
+}
+
+u32 fatMapFragments(FatMap* fm, u32 firstCluster, u32* clusters)
+{
+	u32 fragments = 0;
+	u32 count = 0;
+
+	if (fm && firstCluster >= 2)
+	{
+		fragments = 1;
+		u32 cluster = firstCluster;
+
+		//the count limit guards against loops in a damaged FAT
+		while (count <= fm->clusterCount)
+		{
+			count++;
+
+			u32 next = fatMapNext(fm, cluster);
+			if (next == FATMAP_EOC || next == 0)
+				break;
+
+			if (next != cluster + 1)
+				fragments++;
+
+			cluster = next;
+		}
+	}
+
+	if (clusters)
+		*clusters = count;
+
+	return fragments;
+}
+
+//finds the lowest run of free clusters that is long enough
+bool fatMapFindFree(FatMap* fm, u32 count, u32 maxFreeBefore, u32* start, u32* freeBefore)
+{
+	if (!fm || count == 0) return false;
+
+	u32 runStart = 0;
+	u32 runLength = 0;
+	u32 freeTotal = 0;
+
+	for (u32 cluster = 2; cluster < fm->clusterCount + 2; cluster++)
+	{
+		if (fatMapNext(fm, cluster) == 0)
+		{
+			if (runLength == 0)
+				runStart = cluster;
+
+			runLength++;
+			freeTotal++;
+
+			if (runLength >= count)
+			{
+				if (start) *start = runStart;
+				if (freeBefore) *freeBefore = freeTotal - runLength;
+				return true;
+			}
+		}
+		else
+		{
+			runLength = 0;
+
+			if (freeTotal > maxFreeBefore)
+				return false;
+		}
+	}
+
+	return false;
+}
+
+u32 getFileCluster(char const* path)
+{
+	struct stat st;
+	if (!path || stat(path, &st) != 0)
+		return 0;
+
+	//libfat reports the first cluster as the inode
+	return (u32)st.st_ino;
+}
+
+int getFileFragments(char const* path, u32* clusters)
+{
+	if (clusters) *clusters = 0;
+	if (!path) return -1;
+
+	u32 first = getFileCluster(path);
+	if (first == 0)
+		return 0;
+
+	FatMap* fm = (FatMap*)malloc(sizeof(FatMap));
+	if (!fm) return -1;
+
+	int fragments = -1;
+	if (fatMapOpen(fm, strncmp(path, "nand:", 5) == 0))
+		fragments = fatMapFragments(fm, first, clusters);
+
+	free(fm);
+	return fragments;
+}
+
+//the start of libfat's PARTITION and its FAT struct (source/partition.h),
+//only used to move the allocator's search start
+typedef struct {
+	sec_t fatStart;
+	u32 sectorsPerFat;
+	u32 lastCluster;
+	u32 firstFree;
+	u32 numberFreeCluster;
+	u32 numberLastAllocCluster;
+} LibfatFat;
+
+typedef struct {
+	const DISC_INTERFACE* disc;
+	void* cache;
+	int filesysType;
+	u64 totalSize;
+	sec_t rootDirStart;
+	u32 rootDirCluster;
+	u32 numberOfSectors;
+	sec_t dataStart;
+	u32 bytesPerSector;
+	u32 sectorsPerCluster;
+	u32 bytesPerCluster;
+	u32 fsInfoSector;
+	LibfatFat fat;
+} LibfatPartition;
+
+//libfat takes each new cluster from the lowest free one at or after
+//fat.firstFree, so pointing that at a long enough free run makes a file
+//written straight after land in one piece. Nothing is written to reserve
+//the run: growing a file with ftruncate() or a seek would zero fill it first.
+//If the run is taken meanwhile libfat just skips on, so this can only cost
+//contiguity, never corrupt the FAT.
+bool allocateContiguous(char const* path, unsigned long long size)
+{
+	if (!path) return false;
+
+	const devoptab_t* devops = GetDeviceOpTab(path);
+	LibfatPartition* partition = devops ? (LibfatPartition*)devops->deviceData : NULL;
+	if (!partition) return false;
+
+	FatMap* fm = (FatMap*)malloc(sizeof(FatMap));
+	if (!fm) return false;
+
+	bool result = false;
+
+	//create the entry first, growing the directory must not split the run,
+	//and sync so the FAT on disc matches libfat's cache
+	FILE* f = fopen(path, "wb");
+
+	if (f && fsync(fileno(f)) == 0 && fatMapOpen(fm, strncmp(path, "nand:", 5) == 0))
+	{
+		u32 count = (size + fm->bytesPerCluster - 1) / fm->bytesPerCluster;
+		u32 start = 0;
+
+		//only touch libfat if the layout matches what the FAT says
+		bool layout = partition->fat.fatStart == fm->fatStart &&
+					  partition->dataStart == fm->dataStart &&
+					  partition->bytesPerCluster == fm->bytesPerCluster &&
+					  partition->fat.lastCluster == fm->clusterCount + 1;
+
+		if (layout && count > 0 && fatMapFindFree(fm, count, fm->clusterCount, &start, NULL))
+		{
+			partition->fat.firstFree = start;
+			result = true;
+		}
+	}
+
+	if (f)
+		fclose(f);
+
+	free(fm);
+
+	return result;
+}
@@ -0,0 +1,35 @@
+#ifndef FATMAP_H
+#define FATMAP_H
+
+#include <nds/ndstypes.h>
+#include <nds/disc_io.h>
+
+//read-only view of the FAT behind sd: or nand:, used to find and
+//measure cluster chains that libfat does not expose
+#define FATMAP_EOC 0xFFFFFFFF
+
+typedef struct {
+	const DISC_INTERFACE* disc;
+	int fatBits;
+	u32 fatStart;
+	u32 dataStart;
+	u32 sectorsPerCluster;
+	u32 bytesPerCluster;
+	u32 clusterCount;
+	u32 cachedSector;
+	u8 cache[1024];
+} FatMap;
+
+bool fatMapOpen(FatMap* fm, bool nand);
+
+u32 fatMapNext(FatMap* fm, u32 cluster);
+u32 fatMapFragments(FatMap* fm, u32 firstCluster, u32* clusters);
+bool fatMapFindFree(FatMap* fm, u32 count, u32 maxFreeBefore, u32* start, u32* freeBefore);
+
+u32 getFileCluster(char const* path);
+int getFileFragments(char const* path, u32* clusters);
+
+//creates path empty, the next file written on its device goes into one free run
+bool allocateContiguous(char const* path, unsigned long long size);
+
+#endif
@@ -1,17 +1,100 @@
 #include "install.h"
+#include "fatmap.h"
+#include "lz.h"
 #include "sav.h"
 #include "main.h"
 #include "message.h"
 #include "maketmd.h"
 #include "nand/crypto.h"
+#include "progress.h"
+#include "task.h"
 #include "nand/nandio.h"
 #include "nand/ticket0.h"
 #include "rom.h"
+#include "sha1.h"
+#include "stagetime.h"
 #include "storage.h"
 #include "tad.h"
 #include <dirent.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+//the journal records the last durable stage of an install, so one cut short
+//by a power loss can continue from there on the next launch
+#define INSTALL_JOURNAL "sd:/_nds/TADDeliveryTool/install.txt"
+#define INSTALL_BUFF_SIZE (64 * 1024)
+#define INSTALL_CHECKPOINT (1024 * 1024)
+
+enum {
+	INSTALL_STAGE_EXTRACT,
+	INSTALL_STAGE_DECRYPTED,
+	INSTALL_STAGE_APP,
+	INSTALL_STAGE_TMD,
+	INSTALL_STAGE_SAVES,
+	INSTALL_STAGE_TICKET
+};
+
+typedef struct {
+	int stage;
+	bool sdnand;
+	unsigned long long offset;
+	char tadPath[PATH_MAX];
+	char appPath[PATH_MAX];
+} InstallJournal;
+
+static InstallJournal journal;
+static bool resuming = false;
+
+static void _writeJournal(int stage, unsigned long long offset)
+{
+	journal.stage = stage;
+	journal.offset = offset;
+
+	mkdir("sd:/_nds", 0777);
+	mkdir("sd:/_nds/TADDeliveryTool", 0777);
+
+	FILE* f = fopen(INSTALL_JOURNAL, "w");
+	if (f)
+	{
+		fprintf(f, "%d\n%d\n%llu\n%s\n%s\n", journal.stage, journal.sdnand, journal.offset, journal.tadPath, journal.appPath);
+		fflush(f);
+		fsync(fileno(f));
+		fclose(f);
+	}
+}
+
+static bool _readJournal()
+{
+	FILE* f = fopen(INSTALL_JOURNAL, "r");
+	if (!f) return false;
+
+	int sdnand = 0;
+	bool result = fscanf(f, "%d\n%d\n%llu\n", &journal.stage, &sdnand, &journal.offset) == 3 &&
+				  fgets(journal.tadPath, sizeof(journal.tadPath), f) != NULL &&
+				  fgets(journal.appPath, sizeof(journal.appPath), f) != NULL;
+	fclose(f);
+
+	journal.sdnand = sdnand;
+	journal.tadPath[strcspn(journal.tadPath, "\n")] = '\0';
+	journal.appPath[strcspn(journal.appPath, "\n")] = '\0';
+
+	return result && journal.tadPath[0] != '\0';
+}
+
+static void _removeTempFiles()
+{
+	remove(INSTALL_JOURNAL);
+    remove("sd:/_nds/TADDeliveryTool/tmp/temp.tmd");
+    remove("sd:/_nds/TADDeliveryTool/tmp/temp.tik");
+    remove("sd:/_nds/TADDeliveryTool/tmp/temp.srl.enc");
+    remove("sd:/_nds/TADDeliveryTool/tmp/temp.srl");
+    remove("sd:/_nds/TADDeliveryTool/tmp/temp.pub");
+    remove("sd:/_nds/TADDeliveryTool/tmp/temp.prv");
+    remove("sd:/_nds/TADDeliveryTool/tmp/temp.bnr");
+    rmdir("sd:/_nds/TADDeliveryTool/tmp");
+    rmdir("sd:/_nds/TADDeliveryTool");
+}
 
 static bool _titleIsUsed(tDSiHeader* h)
 {
@@ -31,7 +114,6 @@ static bool _patchGameCode(tDSiHeader* h)
 	if ((strcmp(h->ndshdr.gameCode, "####") == 0 && h->tid_low == 0x23232323) || (!*h->ndshdr.gameCode && h->tid_low == 0))
 	{
 		iprintf("Fixing Game Code...");
-		swiWaitForVBlank();
 
 		//set as standard app
 		h->tid_high = 0x00030004;
@@ -97,7 +179,6 @@ static unsigned long long _getSaveDataSize(tDSiHeader* h)
 static bool _checkSdSpace(unsigned long long size)
 {
 	iprintf("Enough room on SD card?...");
-	swiWaitForVBlank();
 
 	if (getSDCardFree() < size)
 	{
@@ -116,7 +197,6 @@ static bool _checkSdSpace(unsigned long long size)
 static bool _checkDsiSpace(unsigned long long size, bool systemApp)
 {
 	iprintf("Enough room on DSi?...");
-	swiWaitForVBlank();
 
 	//ensure there's at least 1 MiB free, to leave margin for error
 	if (((systemApp ? getDsiRealFree() : getDsiFree()) < size) || (((systemApp ? getDsiRealFree() : getDsiFree()) - size) < (1 << 20)))
@@ -136,7 +216,6 @@ static bool _checkDsiSpace(unsigned long long size, bool systemApp)
 static bool _openMenuSlot()
 {
 	iprintf("Open DSi menu slot?...");
-	swiWaitForVBlank();
 
 	if (getMenuSlotsFree() <= 0)
 	{
@@ -159,7 +238,6 @@ static void _createPublicSav(tDSiHeader* h, char* dataPath)
 	if (h->public_sav_size > 0)
 	{
 		iprintf("Creating public.sav...");
-		swiWaitForVBlank();
 
 		if (!dataPath)
 		{
@@ -204,7 +282,6 @@ static void _createPrivateSav(tDSiHeader* h, char* dataPath)
 	if (h->private_sav_size > 0)
 	{
 		iprintf("Creating private.sav...");
-		swiWaitForVBlank();
 
 		if (!dataPath)
 		{
@@ -249,7 +326,6 @@ static void _createBannerSav(tDSiHeader* h, char* dataPath)
 	if (h->appflags & 0x4)
 	{
 		iprintf("Creating banner.sav...");
-		swiWaitForVBlank();
 
 		if (!dataPath)
 		{
@@ -291,7 +367,6 @@ static void _createTicket(tDSiHeader *h, char* ticketPath)
 	if (!h) return;
 
 	iprintf("Signing ticket...");
-	swiWaitForVBlank();
 
 	if (!ticketPath)
 	{
@@ -306,6 +381,14 @@ static void _createTicket(tDSiHeader *h, char* ticketPath)
 		memset(buffer, 0, encryptedSize);
 
 		FILE *ticket = fopen("sd:/_nds/TADDeliveryTool/tmp/temp.tik", "rb");
+		if (!ticket)
+		{
+			iprintf("\x1B[31m");	//red
+			iprintf("Failed\n");
+			iprintf("\x1B[47m");	//white
+			free(buffer);
+			return;
+		}
     	fseek(ticket, 0, SEEK_SET);
 		fread(buffer, sizeof(u8), sizeof(ticket_v0_t), ticket);
 		fclose(ticket);
@@ -348,6 +431,135 @@ static void _createTicket(tDSiHeader *h, char* ticketPath)
 	}
 }
 
+//copies in large steps and records each synced offset in the journal,
+//a backup is decompressed a block at a time straight into the app
+static int _copyApp(char const* src, bool backup, char const* dst, unsigned long long start)
+{
+	LzReader lz;
+	FILE* fin = NULL;
+
+	if (backup ? lzOpen(&lz, src) != 0 : (fin = fopen(src, "rb")) == NULL)
+		return 3;
+
+	FILE* fout = fopen(dst, fileExists(dst) ? "r+b" : "wb");
+	if (!fout)
+	{
+		if (backup)
+			lzClose(&lz);
+		else
+			fclose(fin);
+
+		return 4;
+	}
+
+	unsigned long long size = backup ? lz.header.rawSize : getFileSize(fin);
+	u8* buffer = (u8*)malloc(INSTALL_BUFF_SIZE);
+
+	bool result = buffer && (backup || fseek(fin, start, SEEK_SET) == 0) && fseek(fout, start, SEEK_SET) == 0;
+	unsigned long long done = start, checkpoint = start;
+
+	progressStart(size, true);
+	progressSet(done);
+
+	while (result && done < size && !taskYield())
+	{
+		unsigned int toRead = INSTALL_BUFF_SIZE;
+		if (size - done < INSTALL_BUFF_SIZE)
+			toRead = size - done;
+
+		if (backup)
+		{
+			//a resumed copy can start part way into a block
+			u32 skip = done % lz.header.blockSize;
+			int rawLen = lzDecompressBlock(&lz, done / lz.header.blockSize, buffer);
+
+			toRead = rawLen - skip;
+			if (rawLen <= (int)skip || fwrite(buffer + skip, 1, toRead, fout) != toRead)
+				result = false;
+		}
+		else if (fread(buffer, 1, toRead, fin) != toRead || fwrite(buffer, 1, toRead, fout) != toRead)
+		{
+			result = false;
+		}
+
+		done += toRead;
+
+		if (result && (done - checkpoint >= INSTALL_CHECKPOINT || done == size))
+		{
+			fflush(fout);
+			fsync(fileno(fout));
+			_writeJournal(INSTALL_STAGE_APP, done);
+			checkpoint = done;
+		}
+
+		progressSet(done);
+	}
+
+	progressEnd();
+	consoleSelect(&bottomScreen);
+
+	//drops banner padding from a run that was cut short after the copy
+	if (result && !taskStopped())
+		result = ftruncate(fileno(fout), size) == 0;
+
+	free(buffer);
+	fclose(fout);
+
+	if (backup)
+		lzClose(&lz);
+	else
+		fclose(fin);
+
+	return (result && !taskStopped()) ? 0 : 5;
+}
+
+//picks up the decrypted temp files left by openTad or _openBackup
+static char* _openTemp()
+{
+	//title id comes from the tmd, as it does for a TAD
+	FILE* tmd = fopen("sd:/_nds/TADDeliveryTool/tmp/temp.tmd", "rb");
+	if (!tmd)
+		return "ERROR";
+
+	fseek(tmd, 396, SEEK_SET);
+	fread(srlTidHigh, 1, 4, tmd);
+	fread(srlTidLow, 1, 4, tmd);
+	fclose(tmd);
+
+	dataTitle = (srlTidHigh[3] == 0x0f);
+
+	return "sd:/_nds/TADDeliveryTool/tmp/temp.srl";
+}
+
+//expands the small files of a compressed backup into the temp files openTad
+//produces, the app itself is only decompressed by _copyApp
+static char* _openBackup(char const* src)
+{
+	if (!src) return "ERROR";
+
+	mkdir("sd:/_nds", 0777);
+	mkdir("sd:/_nds/TADDeliveryTool", 0777);
+	mkdir("sd:/_nds/TADDeliveryTool/tmp", 0777);
+
+	iprintf("Decompressing backup...\n");
+
+	const char* extensions[] = { ".tmd", ".pub", ".prv", ".bnr", ".tik" };
+	int extensionPos = strrchr(src, '.') - src;
+
+	for (int i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++)
+	{
+		char path[PATH_MAX], tempPath[64];
+		strcpy(path, src);
+		strcpy(path + extensionPos, extensions[i]);
+		sprintf(tempPath, "sd:/_nds/TADDeliveryTool/tmp/temp%s", extensions[i]);
+
+		if (access(path, F_OK) == 0 && lzDecompressFile(path, tempPath) != 0)
+			return "ERROR";
+	}
+
+	return _openTemp();
+}
+
 bool install(char* tadPath, bool systemTitle)
 {
 	bool result = false;
@@ -361,9 +573,39 @@ bool install(char* tadPath, bool systemTitle)
 
 	//start installation
 	clearScreen(&bottomScreen);
-	char* fpath = openTad(tadPath);		
+	stageReset();
+	char* extension = strrchr(tadPath, '.');
+	bool isBackup = extension && strcasecmp(extension, ".tlz") == 0;
+
+	int resumeStage = resuming ? journal.stage : -1;
+	unsigned long long resumeOffset = resuming ? journal.offset : 0;
+
+	if (!resuming)
+	{
+		journal.sdnand = sdnandMode;
+		strcpy(journal.tadPath, tadPath);
+		journal.appPath[0] = '\0';
+	}
 
-	tDSiHeader* h = getRomHeader(fpath);
+	//a resumed install reuses the temp files that were already decrypted,
+	//a backup has no temp app and just expands its small files again
+	bool fromTemp = resumeStage >= INSTALL_STAGE_DECRYPTED && (isBackup || fileExists("sd:/_nds/TADDeliveryTool/tmp/temp.srl"));
+
+	char* fpath;
+	if (fromTemp)
+	{
+		fpath = isBackup ? _openBackup(tadPath) : _openTemp();
+	}
+	else
+	{
+		_writeJournal(INSTALL_STAGE_EXTRACT, 0);
+		fpath = isBackup ? _openBackup(tadPath) : openTad(tadPath);
+	}
+
+	//the app of a backup is read from inside the .tlz, fpath only names its temp files
+	char const* romPath = (isBackup && strcmp(fpath, "ERROR") != 0) ? tadPath : fpath;
+
+	tDSiHeader* h = getRomHeader(romPath);
 
 	if (!h)
 	{
@@ -378,6 +620,9 @@ bool install(char* tadPath, bool systemTitle)
 	{
 		bool fixHeader = false;
 
+		if (!fromTemp)
+			_writeJournal(INSTALL_STAGE_DECRYPTED, 0);
+
 		if (_patchGameCode(h))
 			fixHeader = true;
 
@@ -485,7 +730,10 @@ bool install(char* tadPath, bool systemTitle)
 			const char systemData[] = "\x1B[41mWARNING:\x1B[47m This is a data title,\ninstalling it is extremely\nrisky. You will have a very\n\x1B[31mhigh chance of bricking!\n\x1B[33m";
 			const char areYouSure[] = "Are you sure you want to install?\n";
 			clearScreen(&topScreen); // Top screen breaks after this for some reason.
-			printTadInfo(tadPath);
+			if (isBackup || fromTemp)
+				printRomInfo(romPath);
+			else
+				printTadInfo(tadPath);
 			clearScreen(&bottomScreen);
 			char* msg = (char*)malloc(strlen(system) + strlen(areYouSure) + strlen(fpath) + 2);
 			if (sdnandMode || h->tid_high == 0x00030004) {
@@ -500,14 +748,24 @@ bool install(char* tadPath, bool systemTitle)
 			free(msg);
 
 			if (choice == NO)
+			{
+				_removeTempFiles();
 				return false;
+			}
 		}
 
 		if (!sdnandMode && !nandio_unlock_writing())
+		{
+			_removeTempFiles();
 			return false;
+		}
 
 		clearScreen(&bottomScreen);
-		iprintf("Installing %s\n\n", fpath); swiWaitForVBlank();
+		iprintf("Installing %s\n", fpath);
+		iprintf("Cancel - hold [B]\n\n");
+
+		//cancelled at a chunk boundary, the journal then resumes from there
+		taskBegin(true);
 
 		//check for legit TMD, if found we'll generate a ticket which increases the size
 		int extensionPos = strrchr(fpath, '.') - fpath;
@@ -534,10 +792,9 @@ bool install(char* tadPath, bool systemTitle)
 
 		//get install size
 		iprintf("Install Size: ");
-		swiWaitForVBlank();
 
 		u32 clusterSize = getDsiClusterSize();
-		unsigned long long fileSize = getRomSize(fpath), fileSizeOnDisk = fileSize;
+		unsigned long long fileSize = getRomSize(romPath), fileSizeOnDisk = fileSize;
 		if ((fileSizeOnDisk % clusterSize) != 0)
 			fileSizeOnDisk += clusterSize - (fileSizeOnDisk % clusterSize);
 		//file + saves + TMD (rounded up to cluster size)
@@ -547,7 +804,19 @@ bool install(char* tadPath, bool systemTitle)
 		printBytes(installSize);
 		iprintf("\n");
 
-		if (sdnandMode && !_checkSdSpace(installSize))
+		//a resumed install already holds the clusters of the app it wrote,
+		//like the menu slot it took
+		unsigned long long spaceNeeded = installSize;
+		if (resumeStage >= INSTALL_STAGE_APP && fileExists(journal.appPath))
+		{
+			unsigned long long written = getFileSizePath(journal.appPath);
+			if ((written % clusterSize) != 0)
+				written += clusterSize - (written % clusterSize);
+
+			spaceNeeded -= (written < fileSizeOnDisk) ? written : fileSizeOnDisk;
+		}
+
+		if (sdnandMode && !_checkSdSpace(spaceNeeded))
 			goto error;
 
 		//system title patch
@@ -566,7 +835,7 @@ bool install(char* tadPath, bool systemTitle)
 		*/
 
 		//check that there's space on nand
-		if (!_checkDsiSpace(installSize, (h->tid_high != 0x00030004)))
+		if (!_checkDsiSpace(spaceNeeded, (h->tid_high != 0x00030004)))
 		{
 			goto error;
 		}
@@ -627,8 +896,8 @@ bool install(char* tadPath, bool systemTitle)
 		mkdir(dirPath, 0777);
 		sprintf(dirPath, "%s:/title/%02x%02x%02x%02x/%02x%02x%02x%02x", sdnandMode ? "sd" : "nand", srlTidHigh[0], srlTidHigh[1], srlTidHigh[2], srlTidHigh[3], srlTidLow[0], srlTidLow[1], srlTidLow[2], srlTidLow[3]);
 		
-		//check if title is free
-		if (_titleIsUsed(h))
+		//check if title is free, a resumed install keeps what it already wrote
+		if (_titleIsUsed(h) && resumeStage < INSTALL_STAGE_APP)
 		{
 			char msg[64];
 			sprintf(msg, "Title %08x is already used.\nInstall anyway?", (unsigned int)h->tid_low);
@@ -641,10 +910,13 @@ bool install(char* tadPath, bool systemTitle)
 				iprintf("\nDeleting:\n");
 				deleteDir(dirPath);
 				iprintf("\n");
+
+				if (taskStopped())
+					goto error;
 			}
 		}
 
-		if (!_openMenuSlot())
+		if (resumeStage < INSTALL_STAGE_APP && !_openMenuSlot())
 			goto error;
 
 		mkdir(dirPath, 0777);
@@ -683,16 +955,37 @@ bool install(char* tadPath, bool systemTitle)
 				fclose(tmd);
 
 				iprintf("Creating %02x%02x%02x%02x.app...", appName[0], appName[1], appName[2], appName[3]);
-				swiWaitForVBlank();
 
 				char appPath[80];
 				sprintf(appPath, "%s/%02x%02x%02x%02x.app", contentPath, appName[0], appName[1], appName[2], appName[3]);
 
+				//a resumed install past this point already has the finished app
+				bool appDone = resumeStage >= INSTALL_STAGE_TMD && strcmp(journal.appPath, appPath) == 0 && fileExists(appPath);
+
 				//copy nds file to app
+				if (appDone)
+				{
+					iprintf("\x1B[42m");	//green
+					iprintf("Done\n");
+					iprintf("\x1B[47m");	//white
+				}
+				else
 				{
 					int result = 0;
 
-					result = copyFile(fpath, appPath);
+					unsigned long long start = 0;
+					if (resumeStage == INSTALL_STAGE_APP && strcmp(journal.appPath, appPath) == 0 && getFileSizePath(appPath) >= resumeOffset)
+						start = resumeOffset;
+
+					strcpy(journal.appPath, appPath);
+
+					//steer the copy into one contiguous run so launcher loads stay sequential
+					if (start == 0)
+						allocateContiguous(appPath, fileSize);
+
+					stageBegin("app copy");
+					result = _copyApp(romPath, isBackup, appPath, start);
+					stageEnd(fileSize - start);
 
 					if (result != 0)
 					{
@@ -713,10 +1006,9 @@ bool install(char* tadPath, bool systemTitle)
 
 				//pad out banner if it is the last part of the file
 				{
-					if (h->ndshdr.bannerOffset > (fileSize - 0x23C0) && dataTitle == FALSE)
+					if (!appDone && h->ndshdr.bannerOffset > (fileSize - 0x23C0) && dataTitle == FALSE)
 					{
 						iprintf("Padding banner...");
-						swiWaitForVBlank();
 
 						if (padFile(appPath, h->ndshdr.bannerOffset + 0x23C0 - fileSize) == false)
 						{
@@ -735,17 +1027,16 @@ bool install(char* tadPath, bool systemTitle)
 
 				//update header
 				{
-					if (fixHeader)
+					if (fixHeader && !appDone)
 					{
 						iprintf("Fixing header...");
-						swiWaitForVBlank();
 
 						//fix header checksum
 						h->ndshdr.headerCRC16 = swiCRC16(0xFFFF, h, 0x15E);
 
 						//fix RSA signature
 						u8 buffer[20];
-						swiSHA1Calc(&buffer, h, 0xE00);
+						sha1Calc(&buffer, h, 0xE00);
 						memcpy(&(h->rsa_signature[0x6C]), buffer, 20);
 
 						FILE* f = fopen(appPath, "r+");
@@ -770,23 +1061,34 @@ bool install(char* tadPath, bool systemTitle)
 					}
 				}
 
+				_writeJournal(INSTALL_STAGE_TMD, 0);
+
 				//make/copy TMD
 				char newTmdPath[80];
 				sprintf(newTmdPath, "%s/title.tmd", contentPath);
+				stageBegin("tmd");
 				if (tmdFound)
 				{
 					if (copyFilePart(tmdPath, 0, 520, newTmdPath) != 0)
 						goto error;
+
+					stageEnd(520);
 				}
 				else
 				{
 					if (maketmd(appPath, newTmdPath) != 0)
 						goto error;
+
+					//maketmd hashes the whole app
+					stageEnd(getFileSizePath(appPath));
 				}
 			}
 		}
 
+		_writeJournal(INSTALL_STAGE_SAVES, 0);
+
 		//data folder
+		stageBegin("saves");
 		{
 			char dataPath[64];
 			sprintf(dataPath, "%s/data", dirPath);
@@ -826,6 +1128,12 @@ bool install(char* tadPath, bool systemTitle)
 				_createBannerSav(h, dataPath);
 			}
 		}
+		stageEnd(_getSaveDataSize(h));
+
+		if (taskStopped())
+			goto error;
+
+		_writeJournal(INSTALL_STAGE_TICKET, 0);
 
 		//ticket folder /ticket/XXXXXXXX
 		if (tmdFound)
@@ -842,11 +1150,31 @@ bool install(char* tadPath, bool systemTitle)
 			siprintf(ticketPath, "%s/%02x%02x%02x%02x.tik", ticketPath, srlTidLow[0], srlTidLow[1], srlTidLow[2], srlTidLow[3]);
 
 			if (access(ticketPath, F_OK) != 0 || (choicePrint("Ticket already exists.\nKeep it? (recommended)") == NO && choicePrint("Are you sure?") == YES))
+			{
+				stageBegin("ticket");
 				_createTicket(h, ticketPath);
+				stageEnd(sizeof(ticket_v0_t));
+			}
+		}
+
+		//write out everything still held in the write-behind buffer
+		if (!sdnandMode)
+		{
+			stageBegin("nand flush");
+			nandio_lock_writing();
+			stageEnd(0);
 		}
 
 		//end
 		result = true;
+		stagePrint();
+
+		{
+			char title[5];
+			getRomCode(h, title);
+			stageLog(title);
+		}
+
 		iprintf("\x1B[42m");	//green
 		iprintf("\nInstallation complete.\n");
 		iprintf("\x1B[47m");	//white
@@ -857,7 +1185,12 @@ bool install(char* tadPath, bool systemTitle)
 	}
 
 error:
-	messagePrint("\x1B[31m\nInstallation failed.\n\x1B[47m");
+	if (taskStopped() && !programEnd)
+		messagePrint("\x1B[33m\nInstallation cancelled.\n\x1B[47mIt can be resumed on the next start.\n");
+	else if (resuming)
+		messagePrint("\x1B[31m\nInstallation failed.\n\x1B[47mIt can be resumed on the next start.\n");
+	else
+		messagePrint("\x1B[31m\nInstallation failed.\n\x1B[47m");
 
 complete:
 	free(h);
@@ -865,12 +1198,36 @@ complete:
 	if (!sdnandMode)
 		nandio_lock_writing();
 
-    remove("sd:/_nds/TADDeliveryTool/tmp/temp.tmd");
-    remove("sd:/_nds/TADDeliveryTool/tmp/temp.tik");
-    remove("sd:/_nds/TADDeliveryTool/tmp/temp.srl.enc");
-    remove("sd:/_nds/TADDeliveryTool/tmp/temp.srl");
-    rmdir("sd:/_nds/TADDeliveryTool/tmp");
-    rmdir("sd:/_nds/TADDeliveryTool");
+	//a cancelled install keeps its journal and temp files, and so does a
+	//resume that failed, as it may have half a title on NAND already
+	if (!taskEnd() && (result || !resuming))
+		_removeTempFiles();
+	resuming = false;
 
 	return result;
+}
+
+bool installPending()
+{
+	return fileExists(INSTALL_JOURNAL);
+}
+
+bool installResume()
+{
+	if (!_readJournal())
+	{
+		installDiscard();
+		return false;
+	}
+
+	//the title has to go back where it was being installed
+	sdnandMode = journal.sdnand;
+	resuming = true;
+
+	return install(journal.tadPath, false);
+}
+
+void installDiscard()
+{
+	_removeTempFiles();
 }
\ No newline at end of file
@@ -5,4 +5,8 @@
 
 bool install(char* fpath, bool systemTitle);
 
+bool installPending();
+bool installResume();
+void installDiscard();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include "iotrace.h"
+
+#ifdef IO_TRACE
+
+#include "main.h"
+#include "stagetime.h"
+#include <sys/stat.h>
+
+static IoTraceEntry entries[IOTRACE_ENTRIES];
+static u32 total = 0;
+static bool tracing = false;
+
+static const DISC_INTERFACE* sd = NULL;
+
+void iotraceStart()
+{
+	//ticks come from the stagetime clock, running since boot
+	total = 0;
+	tracing = true;
+}
+
+uint32_t iotraceTicks()
+{
+	return stageTicks();
+}
+
+void iotraceRecord(int device, int op, uint32_t sector, uint32_t count, uint32_t ticks, bool ok)
+{
+	if (!tracing)
+		return;
+
+	IoTraceEntry* e = &entries[total % IOTRACE_ENTRIES];
+	e->ticks = ticks;
+	e->duration = stageTicks() - ticks;
+	e->sector = sector;
+	e->count = count;
+	e->device = device;
+	e->op = op;
+	e->ok = ok;
+	e->reserved = 0;
+
+	total++;
+}
+
+bool iotraceDump()
+{
+	//the dump itself goes through the SD interface
+	tracing = false;
+
+	mkdir("sd:/_nds", 0777);
+	mkdir("sd:/_nds/TADDeliveryTool", 0777);
+
+	FILE* f = fopen(IOTRACE_PATH, "wb");
+	if (!f) return false;
+
+	u32 count = total < IOTRACE_ENTRIES ? total : IOTRACE_ENTRIES;
+	u32 first = total - count;
+
+	IoTraceHeader header = { IOTRACE_MAGIC, IOTRACE_VERSION, BUS_CLOCK >> 6, count, first };
+	bool result = fwrite(&header, sizeof(header), 1, f) == 1;
+
+	//oldest first, in the order they completed
+	for (u32 i = 0; result && i < count; i++)
+		result = fwrite(&entries[(first + i) % IOTRACE_ENTRIES], sizeof(IoTraceEntry), 1, f) == 1;
+
+	fclose(f);
+	return result;
+}
+
+static bool _sdStartup()
+{
+	return sd->startup();
+}
+
+static bool _sdIsInserted()
+{
+	return sd->isInserted();
+}
+
+static bool _sdReadSectors(sec_t sector, sec_t count, void* buffer)
+{
+	return IOTRACE(IOTRACE_SD, IOTRACE_READ, sector, count, sd->readSectors(sector, count, buffer));
+}
+
+static bool _sdWriteSectors(sec_t sector, sec_t count, const void* buffer)
+{
+	return IOTRACE(IOTRACE_SD, IOTRACE_WRITE, sector, count, sd->writeSectors(sector, count, buffer));
+}
+
+static bool _sdClearStatus()
+{
+	return sd->clearStatus();
+}
+
+static bool _sdShutdown()
+{
+	return sd->shutdown();
+}
+
+static DISC_INTERFACE io_trace_sd;
+
+const DISC_INTERFACE* iotraceSD()
+{
+	if (!sd)
+	{
+		sd = get_io_dsisd();
+
+		io_trace_sd.ioType = sd->ioType;
+		io_trace_sd.features = sd->features;
+		io_trace_sd.startup = _sdStartup;
+		io_trace_sd.isInserted = _sdIsInserted;
+		io_trace_sd.readSectors = _sdReadSectors;
+		io_trace_sd.writeSectors = _sdWriteSectors;
+		io_trace_sd.clearStatus = _sdClearStatus;
+		io_trace_sd.shutdown = _sdShutdown;
+	}
+
+	return &io_trace_sd;
+}
+
+#endif
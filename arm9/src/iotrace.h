@@ -0,0 +1,76 @@
+#ifndef IOTRACE_H
+#define IOTRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//optional sector request tracer, build with "make IO_TRACE=1". the last
+//IOTRACE_ENTRIES requests to NAND and SD are kept in a ring buffer and
+//dumped to IOTRACE_PATH on exit for tools/iotrace to replay
+#define IOTRACE_PATH    "sd:/_nds/TADDeliveryTool/iotrace.bin"
+#define IOTRACE_MAGIC   0x544F4954 // 'TIOT'
+#define IOTRACE_VERSION 1
+#define IOTRACE_ENTRIES 8192
+
+enum {
+	IOTRACE_NAND,
+	IOTRACE_SD
+};
+
+enum {
+	IOTRACE_READ,      //request from libfat
+	IOTRACE_WRITE,
+	IOTRACE_DEV_READ,  //what reached the NAND after read-ahead and write-behind
+	IOTRACE_DEV_WRITE
+};
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t tickRate;
+	uint32_t count;
+	uint32_t dropped;
+} IoTraceHeader;
+
+typedef struct {
+	uint32_t ticks;
+	uint32_t duration;
+	uint32_t sector;
+	uint32_t count;
+	uint8_t device;
+	uint8_t op;
+	uint8_t ok;
+	uint8_t reserved;
+} IoTraceEntry;
+
+#ifdef ARM9
+#ifdef IO_TRACE
+
+#include <nds/disc_io.h>
+
+void iotraceStart();
+bool iotraceDump();
+
+uint32_t iotraceTicks();
+void iotraceRecord(int device, int op, uint32_t sector, uint32_t count, uint32_t ticks, bool ok);
+
+//the SD card interface with every request recorded
+const DISC_INTERFACE* iotraceSD();
+
+#define IOTRACE(device, op, sector, count, call) ({ \
+	uint32_t _ticks = iotraceTicks(); \
+	bool _ok = (call); \
+	iotraceRecord(device, op, sector, count, _ticks, _ok); \
+	_ok; \
+})
+
+#else
+
+#define iotraceStart()
+#define iotraceDump() true
+#define IOTRACE(device, op, sector, count, call) (call)
+
+#endif
+#endif
+
+#endif
@@ -0,0 +1,537 @@
+#include "lz.h"
+#include "main.h"
+#include "progress.h"
+#include "task.h"
+#include "sha1.h"
+#include "storage.h"
+
+//LZ4 block format: a token with 4 bit literal and match lengths, optional
+//length bytes, the literals, then a 16 bit offset. Matches are at least 4
+//bytes and the last 5 bytes of a block are always literals.
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+#define LZ_MFLIMIT 12
+#define LZ_SKIP_TRIGGER 6
+
+static u16 hashTable[1 << LZ_HASH_BITS];
+
+//the ARM9 has no unaligned loads, so words are assembled from bytes
+static inline u32 _read32(u8 const* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+
+static inline u32 _hash(u32 sequence)
+{
+	return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline u8* _writeLength(u8* op, int len)
+{
+	while (len >= 255)
+	{
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+static inline u8* _writeSequence(u8* op, u8 const* literals, int litLen, int matchLen, u32 offset)
+{
+	u8* token = op++;
+
+	*token = (litLen >= 15 ? 15 : litLen) << 4;
+	if (litLen >= 15)
+		op = _writeLength(op, litLen - 15);
+
+	memcpy(op, literals, litLen);
+	op += litLen;
+
+	//last literals carry no match
+	if (offset == 0)
+		return op;
+
+	*op++ = offset & 0xFF;
+	*op++ = offset >> 8;
+
+	matchLen -= LZ_MIN_MATCH;
+	*token |= (matchLen >= 15 ? 15 : matchLen);
+	if (matchLen >= 15)
+		op = _writeLength(op, matchLen - 15);
+
+	return op;
+}
+
+//returns the compressed size, or 0 if dst is too small
+int lzCompress(u8 const* src, int srcLen, u8* dst, int dstCap)
+{
+	if (!src || !dst || srcLen < 0 || srcLen > 0x10000 || dstCap < lzBound(srcLen))
+		return 0;
+
+	u8 const* ip = src;
+	u8 const* anchor = src;
+	u8 const* const end = src + srcLen;
+	u8 const* const mflimit = end - LZ_MFLIMIT;
+	u8 const* const matchlimit = end - LZ_LAST_LITERALS;
+	u8* op = dst;
+
+	memset(hashTable, 0, sizeof(hashTable));
+
+	if (srcLen >= LZ_MFLIMIT)
+	{
+		u32 misses = 0;
+
+		while (ip < mflimit)
+		{
+			u32 sequence = _read32(ip);
+			u32 h = _hash(sequence);
+			u8 const* ref = src + hashTable[h];
+			hashTable[h] = ip - src;
+
+			if (ref >= ip || _read32(ref) != sequence)
+			{
+				//step faster through data that does not compress
+				ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+				continue;
+			}
+			misses = 0;
+
+			while (ip > anchor && ref > src && ip[-1] == ref[-1])
+			{
+				ip--;
+				ref--;
+			}
+
+			u8 const* mp = ip + LZ_MIN_MATCH;
+			u8 const* rp = ref + LZ_MIN_MATCH;
+			while (mp < matchlimit && *mp == *rp)
+			{
+				mp++;
+				rp++;
+			}
+
+			op = _writeSequence(op, anchor, ip - anchor, mp - ip, ip - ref);
+
+			ip = mp;
+			anchor = ip;
+
+			if (ip - 2 >= src && ip - 2 < mflimit)
+				hashTable[_hash(_read32(ip - 2))] = ip - 2 - src;
+		}
+	}
+
+	op = _writeSequence(op, anchor, end - anchor, 0, 0);
+
+	return op - dst;
+}
+
+//returns the decompressed size, or -1 if the block is malformed
+int lzDecompress(u8 const* src, int srcLen, u8* dst, int dstLen)
+{
+	if (!src || !dst) return -1;
+
+	u8 const* ip = src;
+	u8 const* const iend = src + srcLen;
+	u8* op = dst;
+	u8* const oend = dst + dstLen;
+
+	while (ip < iend)
+	{
+		u32 token = *ip++;
+
+		int litLen = token >> 4;
+		if (litLen == 15)
+		{
+			u8 b;
+			do {
+				if (ip >= iend) return -1;
+				b = *ip++;
+				litLen += b;
+			} while (b == 255);
+		}
+
+		if (litLen > iend - ip || litLen > oend - op)
+			return -1;
+
+		memcpy(op, ip, litLen);
+		op += litLen;
+		ip += litLen;
+
+		if (ip >= iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+
+		u32 offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if (offset == 0 || offset > op - dst)
+			return -1;
+
+		int matchLen = token & 15;
+		if (matchLen == 15)
+		{
+			u8 b;
+			do {
+				if (ip >= iend) return -1;
+				b = *ip++;
+				matchLen += b;
+			} while (b == 255);
+		}
+		matchLen += LZ_MIN_MATCH;
+
+		if (matchLen > oend - op)
+			return -1;
+
+		u8 const* ref = op - offset;
+		if (offset >= matchLen)
+		{
+			memcpy(op, ref, matchLen);
+			op += matchLen;
+		}
+		else
+		{
+			//overlapping copy, this is how runs are encoded
+			while (matchLen--)
+				*op++ = *ref++;
+		}
+	}
+
+	return op - dst;
+}
+
+int lzCompressFile(char const* src, char const* dst)
+{
+	return lzUpdateFile(src, dst, NULL, 0, NULL, NULL);
+}
+
+//only blocks whose hash differs from oldHashes are compressed and appended,
+//the index is written last so an interrupted update leaves the old one valid.
+//Returns 6 when the task is stopped, a container started over is removed then
+int lzUpdateFile(char const* src, char const* dst, u8 const* oldHashes, u32 oldCount, u8* hashes, u8* fileHash)
+{
+	if (!src) return 1;
+	if (!dst) return 2;
+
+	FILE* fin = fopen(src, "rb");
+	if (!fin)
+		return 3;
+
+	unsigned long long size = getFileSize(fin);
+
+	LzHeader header;
+	header.magic = LZ_MAGIC;
+	header.rawSize = size;
+	header.blockSize = LZ_BLOCK_SIZE;
+	header.blockCount = (size + LZ_BLOCK_SIZE - 1) / LZ_BLOCK_SIZE;
+
+	LzBlock* index = (LzBlock*)calloc(header.blockCount + 1, sizeof(LzBlock));
+	u8* raw = (u8*)malloc(LZ_BLOCK_SIZE);
+	u8* packed = (u8*)malloc(lzBound(LZ_BLOCK_SIZE));
+
+	u32 offset = sizeof(header) + header.blockCount * sizeof(LzBlock);
+	bool incremental = false;
+	FILE* fout = NULL;
+
+	//an existing container is reused when it has the same shape
+	if (index && oldHashes && oldCount == header.blockCount)
+	{
+		fout = fopen(dst, "r+b");
+		if (fout)
+		{
+			LzHeader old;
+			incremental = fread(&old, sizeof(old), 1, fout) == 1 && memcmp(&old, &header, sizeof(header)) == 0 &&
+						  fread(index, sizeof(LzBlock), header.blockCount, fout) == header.blockCount;
+
+			if (incremental)
+			{
+				u32 live = offset;
+				for (u32 i = 0; i < header.blockCount; i++)
+					live += index[i].size & ~LZ_STORED;
+
+				fseek(fout, 0, SEEK_END);
+				u32 end = ftell(fout);
+
+				//compact once stale blocks outweigh the live ones
+				if (end - live > live)
+					incremental = false;
+				else
+					offset = end;
+			}
+
+			if (!incremental)
+			{
+				fclose(fout);
+				fout = NULL;
+				memset(index, 0, header.blockCount * sizeof(LzBlock));
+			}
+		}
+	}
+
+	if (!fout)
+		fout = fopen(dst, "wb");
+
+	if (!fout)
+	{
+		free(packed);
+		free(raw);
+		free(index);
+		fclose(fin);
+		return 4;
+	}
+
+	bool result = index && raw && packed;
+
+	if (result && !incremental)
+		result = fwrite(&header, sizeof(header), 1, fout) == 1 &&
+				 fwrite(index, sizeof(LzBlock), header.blockCount, fout) == header.blockCount;
+
+	Sha1Context ctx;
+	if (fileHash)
+		sha1Init(&ctx);
+
+	progressStart(header.blockCount, false);
+
+	for (u32 i = 0; result && i < header.blockCount && !taskYield(); i++)
+	{
+		u32 rawLen = (i == header.blockCount - 1) ? size - i * LZ_BLOCK_SIZE : LZ_BLOCK_SIZE;
+
+		if (fread(raw, 1, rawLen, fin) != rawLen)
+		{
+			result = false;
+			break;
+		}
+
+		if (fileHash)
+			sha1Update(&ctx, raw, rawLen);
+
+		if (hashes || incremental)
+		{
+			u8 hash[LZ_HASH_SIZE];
+			sha1Calc(hash, raw, rawLen);
+
+			if (hashes)
+				memcpy(hashes + i * LZ_HASH_SIZE, hash, LZ_HASH_SIZE);
+
+			if (incremental && memcmp(hash, oldHashes + i * LZ_HASH_SIZE, LZ_HASH_SIZE) == 0)
+			{
+				progressSet(i + 1);
+				continue;
+			}
+		}
+
+		int packedLen = lzCompress(raw, rawLen, packed, lzBound(LZ_BLOCK_SIZE));
+
+		if (incremental)
+			fseek(fout, offset, SEEK_SET);
+
+		index[i].offset = offset;
+		if (packedLen <= 0 || packedLen >= rawLen)
+		{
+			index[i].size = rawLen | LZ_STORED;
+			result = fwrite(raw, 1, rawLen, fout) == rawLen;
+			offset += rawLen;
+		}
+		else
+		{
+			index[i].size = packedLen;
+			result = fwrite(packed, 1, packedLen, fout) == packedLen;
+			offset += packedLen;
+		}
+
+		progressSet(i + 1);
+	}
+
+	if (result && !taskStopped())
+	{
+		fseek(fout, sizeof(header), SEEK_SET);
+		result = fwrite(index, sizeof(LzBlock), header.blockCount, fout) == header.blockCount;
+	}
+
+	if (fileHash)
+		sha1Final(fileHash, &ctx);
+
+	progressEnd();
+	consoleSelect(&bottomScreen);
+
+	free(packed);
+	free(raw);
+	free(index);
+	fclose(fout);
+	fclose(fin);
+
+	if (result && taskStopped())
+	{
+		if (!incremental)
+			remove(dst);
+
+		return 6;
+	}
+
+	return result ? 0 : 5;
+}
+
+int lzOpen(LzReader* lz, char const* path)
+{
+	if (!lz) return 1;
+	if (!path) return 2;
+
+	memset(lz, 0, sizeof(LzReader));
+
+	lz->file = fopen(path, "rb");
+	if (!lz->file)
+		return 3;
+
+	LzHeader* header = &lz->header;
+	if (fread(header, sizeof(LzHeader), 1, lz->file) != 1 || header->magic != LZ_MAGIC ||
+		header->blockSize == 0 || header->blockSize > LZ_BLOCK_SIZE ||
+		header->blockCount != (header->rawSize + header->blockSize - 1) / header->blockSize)
+	{
+		lzClose(lz);
+		return 6;
+	}
+
+	lz->index = (LzBlock*)calloc(header->blockCount + 1, sizeof(LzBlock));
+	lz->packed = (u8*)malloc(LZ_BLOCK_SIZE);
+
+	if (!lz->index || !lz->packed ||
+		fread(lz->index, sizeof(LzBlock), header->blockCount, lz->file) != header->blockCount)
+	{
+		lzClose(lz);
+		return 6;
+	}
+
+	return 0;
+}
+
+void lzClose(LzReader* lz)
+{
+	if (!lz) return;
+
+	free(lz->packed);
+	free(lz->index);
+
+	if (lz->file)
+		fclose(lz->file);
+
+	memset(lz, 0, sizeof(LzReader));
+}
+
+//out must hold a whole block, returns the raw length or -1
+int lzDecompressBlock(LzReader* lz, u32 block, u8* out)
+{
+	if (!lz || !lz->file || !out || block >= lz->header.blockCount)
+		return -1;
+
+	u32 rawLen = (block == lz->header.blockCount - 1) ? lz->header.rawSize - block * lz->header.blockSize : lz->header.blockSize;
+	u32 packedLen = lz->index[block].size & ~LZ_STORED;
+
+	if (packedLen > LZ_BLOCK_SIZE || fseek(lz->file, lz->index[block].offset, SEEK_SET) != 0)
+		return -1;
+
+	if (lz->index[block].size & LZ_STORED)
+	{
+		if (packedLen != rawLen || fread(out, 1, rawLen, lz->file) != rawLen)
+			return -1;
+	}
+	else
+	{
+		if (fread(lz->packed, 1, packedLen, lz->file) != packedLen ||
+			lzDecompress(lz->packed, packedLen, out, rawLen) != rawLen)
+			return -1;
+	}
+
+	return rawLen;
+}
+
+//reads any range of the raw data, for headers that sit inside a block
+bool lzRead(LzReader* lz, u32 offset, void* out, u32 len)
+{
+	if (!lz || !out) return false;
+	if (offset > lz->header.rawSize || len > lz->header.rawSize - offset) return false;
+
+	u8* raw = (u8*)malloc(LZ_BLOCK_SIZE);
+	bool result = raw != NULL;
+
+	while (result && len > 0)
+	{
+		u32 block = offset / lz->header.blockSize;
+		u32 skip = offset % lz->header.blockSize;
+		int rawLen = lzDecompressBlock(lz, block, raw);
+
+		if (rawLen <= (int)skip)
+		{
+			result = false;
+			break;
+		}
+
+		u32 part = rawLen - skip;
+		if (part > len)
+			part = len;
+
+		memcpy(out, raw + skip, part);
+		out = (u8*)out + part;
+		offset += part;
+		len -= part;
+	}
+
+	free(raw);
+	return result;
+}
+
+int lzDecompressFile(char const* src, char const* dst)
+{
+	if (!src) return 1;
+	if (!dst) return 2;
+
+	LzReader lz;
+	int opened = lzOpen(&lz, src);
+	if (opened != 0)
+		return opened;
+
+	FILE* fout = fopen(dst, "wb");
+	if (!fout)
+	{
+		lzClose(&lz);
+		return 4;
+	}
+
+	u8* raw = (u8*)malloc(LZ_BLOCK_SIZE);
+	bool result = raw != NULL;
+
+	progressStart(lz.header.blockCount, false);
+
+	for (u32 i = 0; result && i < lz.header.blockCount && !taskYield(); i++)
+	{
+		int rawLen = lzDecompressBlock(&lz, i, raw);
+		result = rawLen >= 0 && fwrite(raw, 1, rawLen, fout) == rawLen;
+
+		progressSet(i + 1);
+	}
+
+	progressEnd();
+	consoleSelect(&bottomScreen);
+
+	free(raw);
+	fclose(fout);
+	lzClose(&lz);
+
+	return (result && !taskStopped()) ? 0 : 5;
+}
+
+unsigned long long lzGetRawSize(char const* path)
+{
+	if (!path) return 0;
+
+	FILE* f = fopen(path, "rb");
+	if (!f) return 0;
+
+	LzHeader header;
+	bool valid = fread(&header, sizeof(header), 1, f) == 1 && header.magic == LZ_MAGIC;
+	fclose(f);
+
+	return valid ? header.rawSize : 0;
+}
@@ -0,0 +1,48 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <nds/ndstypes.h>
+#include <stdio.h>
+
+//LZ4 style block codec and a seekable file container built on it
+#define LZ_MAGIC 0x305A4C54 // 'TLZ0'
+#define LZ_BLOCK_SIZE (64 * 1024)
+#define LZ_STORED 0x80000000 //block kept uncompressed
+#define LZ_HASH_SIZE 20 //SHA-1 per block
+
+#define lzBound(size) ((size) + (size) / 255 + 16)
+
+typedef struct {
+	u32 magic;
+	u32 rawSize;
+	u32 blockSize;
+	u32 blockCount;
+} LzHeader;
+
+typedef struct {
+	u32 offset;
+	u32 size;
+} LzBlock;
+
+//an open container, blocks are decompressed one at a time on request
+typedef struct {
+	FILE* file;
+	LzHeader header;
+	LzBlock* index;
+	u8* packed;
+} LzReader;
+
+int lzCompress(u8 const* src, int srcLen, u8* dst, int dstCap);
+int lzDecompress(u8 const* src, int srcLen, u8* dst, int dstLen);
+
+int lzCompressFile(char const* src, char const* dst);
+int lzUpdateFile(char const* src, char const* dst, u8 const* oldHashes, u32 oldCount, u8* hashes, u8* fileHash);
+int lzDecompressFile(char const* src, char const* dst);
+unsigned long long lzGetRawSize(char const* path);
+
+int lzOpen(LzReader* lz, char const* path);
+void lzClose(LzReader* lz);
+int lzDecompressBlock(LzReader* lz, u32 block, u8* out);
+bool lzRead(LzReader* lz, u32 offset, void* out, u32 len);
+
+#endif
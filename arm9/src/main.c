@@ -1,11 +1,17 @@
 #include "main.h"
+#include "install.h"
+#include "iotrace.h"
 #include "menu.h"
 #include "message.h"
 #include "nand/nandio.h"
+#include "profiler.h"
+#include "progress.h"
+#include "stagetime.h"
 #include "storage.h"
 #include "version.h"
 #include <dirent.h>
 #include <time.h>
+#include <unistd.h>
 
 bool programEnd = false;
 bool sdnandMode = true;
@@ -23,7 +29,8 @@ enum {
 	MAIN_MENU_MODE,
 	MAIN_MENU_INSTALL,
 	MAIN_MENU_TITLES,
-	//MAIN_MENU_BACKUP,
+	MAIN_MENU_BACKUP,
+	MAIN_MENU_NAND_IMAGE,
 	MAIN_MENU_TEST,
 	MAIN_MENU_FIX,
 	//MAIN_MENU_DATA_MANAGEMENT,
@@ -76,7 +83,8 @@ static int _mainMenu(int cursor)
 	addMenuItem(m, modeStr, NULL, 0);
 	addMenuItem(m, "Install", NULL, 0);
 	addMenuItem(m, "Titles", NULL, 0);
-	//addMenuItem(m, "Restore", NULL, 0);
+	addMenuItem(m, "Restore", NULL, 0);
+	addMenuItem(m, "NAND image", NULL, 0);
 	addMenuItem(m, "Test", NULL, 0);
 	addMenuItem(m, "Fix FAT copy mismatch", NULL, 0);
 	addMenuItem(m, "\x1B[47mExit", NULL, 0);
@@ -124,6 +132,7 @@ int main(int argc, char **argv)
 	srand(time(0));
 	keysSetRepeat(25, 5);
 	_setupScreens();
+	progressInit();
 
 	fifoSetValue32Handler(FIFO_USER_01, fifoHandlerPower, NULL);
 	fifoSetValue32Handler(FIFO_USER_03, fifoHandlerBattery, NULL);
@@ -135,8 +144,16 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	//start the clock used for all timing
+	stageStart();
+
 	//setup sd card access
+#ifdef IO_TRACE
+	iotraceStart();
+	if (!fatMountSimple("sd", iotraceSD()) || chdir("sd:/") != 0)
+#else
 	if (!fatInitDefault())
+#endif
 	{
 		messageBox("fatInitDefault()...\x1B[31mFailed\n\x1B[47m");
 		return 0;
@@ -210,6 +227,15 @@ int main(int argc, char **argv)
 	messageBox("\x1B[41mWARNING:\x1B[47m This tool can write to\nyour internal NAND!\n\nThis always has a risk, albeit\nlow, of \x1B[41mbricking\x1B[47m your system\nand should be done with caution!\n\nIf you have not yet done so,\nyou should make a NAND backup.");
 
 	messageBox("If you are following a video\nguide, please stop.\n\nVideo guides for console moddingare often outdated or straight\nup incorrect to begin with.\n\nThe recommended guide for\nmodding your DSi is:\n\n\x1B[46mhttps://dsi.cfw.guide/\x1B[47m\n\nFor more information on using\nTDT, see the official repo:\n\n\x1B[46mhttps://github.com/rvtr/TDT\x1B[47m");
+	//an install cut short by a power loss can pick up where it stopped
+	if (installPending())
+	{
+		if (choiceBox("An install was interrupted.\nResume it now?") == YES)
+			installResume();
+		else
+			installDiscard();
+	}
+
 	//main menu
 	int cursor = 0;
 
@@ -230,11 +256,14 @@ int main(int argc, char **argv)
 			case MAIN_MENU_TITLES:
 				titleMenu();
 				break;
-			/*
 			case MAIN_MENU_BACKUP:
 				backupMenu();
 				break;
-			*/
+
+			case MAIN_MENU_NAND_IMAGE:
+				nandMenu();
+				break;
+
 			case MAIN_MENU_TEST:
 				testMenu();
 				break;
@@ -255,10 +284,23 @@ int main(int argc, char **argv)
 	}
 
 	clearScreen(&bottomScreen);
+	stageReset();
 	printf("Unmounting NAND...\n");
+	stageBegin("unmount");
 	fatUnmount("nand:");
 	printf("Merging stages...\n");
+	stageBegin("fat sync");
 	nandio_shutdown();
+	stageEnd(0);
+
+	//only worth logging after an install was timed
+	if (stageLogged())
+		stageLog("exit");
+
+	iotraceDump();
+
+	if (profilerRunning())
+		profilerDump();
 
 	fifoSendValue32(FIFO_USER_02, 0x54495845); // 'EXIT'
 
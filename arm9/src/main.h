@@ -16,6 +16,7 @@ extern u8 region;
 void installMenu();
 void titleMenu();
 void backupMenu();
+void nandMenu();
 void testMenu();
 
 extern PrintConsole topScreen;
@@ -34,10 +34,12 @@ distribution.
 */
 
 #include "maketmd.h"
+#include "progress.h"
+#include "sha1.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <nds/sha1.h>
+#include <malloc.h>
 #include <nds/ndstypes.h>
 #include <machine/endian.h>
 
@@ -45,6 +47,7 @@ distribution.
 
 #define TMD_SIZE          0x208
 #define SHA_BUFFER_SIZE   0x200
+#define SHA_CHUNK_SIZE    0x8000
 #define SHA_DIGEST_LENGTH 0x14
 
 void tmd_create(uint8_t* tmd, FILE* app)
@@ -113,23 +116,40 @@ void tmd_create(uint8_t* tmd, FILE* app)
 		uint8_t buffer[SHA_BUFFER_SIZE] = { 0 };
 		uint32_t buffer_read = 0;
 
-		swiSHA1context_t ctx;
-		swiSHA1Init(&ctx);
+		Sha1Context ctx;
+		sha1Init(&ctx);
 
+		// The ARM7 hashes one chunk while the next is read, on the stack
+		// buffer if there is no memory for the pair
+		uint32_t chunk_size = SHA_CHUNK_SIZE;
+		uint8_t* chunks = (uint8_t*)memalign(32, SHA_CHUNK_SIZE * 2);
+		uint8_t* chunk[2] = { chunks, chunks + SHA_CHUNK_SIZE };
+
+		if (!chunks)
+		{
+			chunk_size = SHA_BUFFER_SIZE;
+			chunk[0] = chunk[1] = buffer;
+		}
+
+		progressStart(filesize, true);
+
+		int k = 0;
 		do {
-			buffer_read = fread((char*)&buffer[0], 1, SHA_BUFFER_SIZE, app);
+			buffer_read = fread((char*)chunk[k], 1, chunk_size, app);
 			fileread += buffer_read;
 
-			swiSHA1Update(&ctx, buffer, buffer_read);
+			sha1UpdateAsync(&ctx, chunk[k], buffer_read);
+			k ^= 1;
 
-			printProgressBar((float)fileread / (float)filesize);
+			progressSet(fileread);
 		}
-		while (buffer_read == SHA_BUFFER_SIZE);
+		while (buffer_read == chunk_size);
 
-		clearProgressBar();
+		progressEnd();
 		consoleSelect(&bottomScreen);
 
-		swiSHA1Final(buffer, &ctx);
+		sha1Final(buffer, &ctx);
+		free(chunks);
 
 		//Store SHA1 sum
 		memcpy((tmd + 0x1F4), buffer, SHA_DIGEST_LENGTH);
@@ -0,0 +1,197 @@
+#include "manifest.h"
+#include "main.h"
+#include "lz.h"
+#include "storage.h"
+
+typedef struct {
+	u32 magic;
+	u32 tidHigh;
+	u32 tidLow;
+	u32 entryCount;
+} ManifestHeader;
+
+typedef struct {
+	char ext[4];
+	u32 size;
+	u8 sha1[MANIFEST_HASH_SIZE];
+	u32 blockCount;
+} ManifestRecord;
+
+void manifestInit(Manifest* m, u32 tidHigh, u32 tidLow)
+{
+	if (!m) return;
+
+	memset(m, 0, sizeof(Manifest));
+	m->tidHigh = tidHigh;
+	m->tidLow = tidLow;
+}
+
+void manifestFree(Manifest* m)
+{
+	if (!m) return;
+
+	for (int i = 0; i < m->entryCount; i++)
+	{
+		free(m->entries[i].blocks);
+		m->entries[i].blocks = NULL;
+	}
+
+	m->entryCount = 0;
+}
+
+bool manifestLoad(Manifest* m, char const* path)
+{
+	if (!m || !path) return false;
+
+	manifestInit(m, 0, 0);
+
+	FILE* f = fopen(path, "rb");
+	if (!f) return false;
+
+	ManifestHeader header;
+	bool result = fread(&header, sizeof(header), 1, f) == 1 &&
+				  header.magic == MANIFEST_MAGIC &&
+				  header.entryCount <= MANIFEST_MAX_FILES;
+
+	if (result)
+	{
+		m->tidHigh = header.tidHigh;
+		m->tidLow = header.tidLow;
+
+		for (int i = 0; result && i < header.entryCount; i++)
+		{
+			ManifestRecord record;
+			if (fread(&record, sizeof(record), 1, f) != 1)
+			{
+				result = false;
+				break;
+			}
+
+			ManifestEntry* e = &m->entries[m->entryCount++];
+			memcpy(e->ext, record.ext, sizeof(e->ext));
+			e->ext[3] = '\0';
+			e->size = record.size;
+			memcpy(e->sha1, record.sha1, MANIFEST_HASH_SIZE);
+			e->blockCount = record.blockCount;
+			e->blocks = (u8*)malloc(e->blockCount * MANIFEST_HASH_SIZE + 1);
+
+			result = e->blocks && fread(e->blocks, MANIFEST_HASH_SIZE, e->blockCount, f) == e->blockCount;
+		}
+	}
+
+	fclose(f);
+
+	if (!result)
+		manifestFree(m);
+
+	return result;
+}
+
+bool manifestSave(Manifest const* m, char const* path)
+{
+	if (!m || !path) return false;
+
+	FILE* f = fopen(path, "wb");
+	if (!f) return false;
+
+	ManifestHeader header = { MANIFEST_MAGIC, m->tidHigh, m->tidLow, m->entryCount };
+	bool result = fwrite(&header, sizeof(header), 1, f) == 1;
+
+	for (int i = 0; result && i < m->entryCount; i++)
+	{
+		ManifestEntry const* e = &m->entries[i];
+
+		ManifestRecord record;
+		memcpy(record.ext, e->ext, sizeof(record.ext));
+		record.size = e->size;
+		memcpy(record.sha1, e->sha1, MANIFEST_HASH_SIZE);
+		record.blockCount = e->blockCount;
+
+		result = fwrite(&record, sizeof(record), 1, f) == 1 &&
+				 fwrite(e->blocks, MANIFEST_HASH_SIZE, e->blockCount, f) == e->blockCount;
+	}
+
+	fclose(f);
+	return result;
+}
+
+ManifestEntry* manifestFind(Manifest* m, char const* ext)
+{
+	if (!m || !ext) return NULL;
+
+	for (int i = 0; i < m->entryCount; i++)
+	{
+		if (strncmp(m->entries[i].ext, ext, 3) == 0)
+			return &m->entries[i];
+	}
+
+	return NULL;
+}
+
+ManifestEntry* manifestAdd(Manifest* m, char const* ext)
+{
+	if (!m || !ext) return NULL;
+
+	ManifestEntry* e = manifestFind(m, ext);
+
+	if (!e)
+	{
+		if (m->entryCount >= MANIFEST_MAX_FILES)
+			return NULL;
+
+		e = &m->entries[m->entryCount++];
+		memset(e, 0, sizeof(ManifestEntry));
+		strncpy(e->ext, ext, 3);
+	}
+
+	return e;
+}
+
+int manifestBackupFile(Manifest* m, char const* ext, char const* src, char const* dst)
+{
+	ManifestEntry* e = manifestAdd(m, ext);
+	if (!e) return MANIFEST_BACKUP_FAILED;
+
+	u32 size = getFileSizePath(src);
+	u32 blockCount = (size + LZ_BLOCK_SIZE - 1) / LZ_BLOCK_SIZE;
+	u8* hashes = (u8*)malloc(blockCount * LZ_HASH_SIZE + 1);
+	u8 sha1[LZ_HASH_SIZE];
+
+	int result = hashes ? lzUpdateFile(src, dst, e->blocks, e->blockCount, hashes, sha1) : 5;
+
+	//a cancel leaves the container on its old index, unless it was started over
+	if (result == 6)
+	{
+		free(hashes);
+
+		if (access(dst, F_OK) != 0)
+		{
+			free(e->blocks);
+			e->blocks = NULL;
+			e->blockCount = 0;
+		}
+
+		return MANIFEST_BACKUP_CANCELLED;
+	}
+
+	if (result != 0)
+	{
+		//the old hashes no longer describe the container
+		free(hashes);
+		free(e->blocks);
+		e->blocks = NULL;
+		e->blockCount = 0;
+		remove(dst);
+		return MANIFEST_BACKUP_FAILED;
+	}
+
+	bool unchanged = e->blocks && e->size == size && memcmp(e->sha1, sha1, LZ_HASH_SIZE) == 0;
+
+	free(e->blocks);
+	e->blocks = hashes;
+	e->blockCount = blockCount;
+	e->size = size;
+	memcpy(e->sha1, sha1, LZ_HASH_SIZE);
+
+	return unchanged ? MANIFEST_BACKUP_UNCHANGED : MANIFEST_BACKUP_DONE;
+}
@@ -0,0 +1,46 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <nds/ndstypes.h>
+
+//sizes and SHA-1 hashes of the files in a backup, with one hash per
+//LZ block so a later backup of the same title only rewrites what changed
+#define MANIFEST_MAGIC 0x4D544454 // 'TDTM'
+#define MANIFEST_MAX_FILES 8
+#define MANIFEST_HASH_SIZE 20
+
+typedef struct {
+	char ext[4];
+	u32 size;
+	u8 sha1[MANIFEST_HASH_SIZE];
+	u32 blockCount;
+	u8* blocks;
+} ManifestEntry;
+
+typedef struct {
+	u32 tidHigh;
+	u32 tidLow;
+	u32 entryCount;
+	ManifestEntry entries[MANIFEST_MAX_FILES];
+} Manifest;
+
+void manifestInit(Manifest* m, u32 tidHigh, u32 tidLow);
+void manifestFree(Manifest* m);
+
+bool manifestLoad(Manifest* m, char const* path);
+bool manifestSave(Manifest const* m, char const* path);
+
+ManifestEntry* manifestFind(Manifest* m, char const* ext);
+ManifestEntry* manifestAdd(Manifest* m, char const* ext);
+
+//stores src as the LZ container dst and updates the entry for ext
+enum {
+	MANIFEST_BACKUP_FAILED = -1,
+	MANIFEST_BACKUP_DONE,
+	MANIFEST_BACKUP_UNCHANGED,
+	MANIFEST_BACKUP_CANCELLED
+};
+
+int manifestBackupFile(Manifest* m, char const* ext, char const* src, char const* dst);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef AES_ARM_H
+#define AES_ARM_H
+
+#include <stdint.h>
+
+//ARM mode AES core in aes_arm.s for "make AES_ASM=1". It uses the PolarSSL
+//key schedule and tables, aes.c and dsi.c call it for word aligned buffers
+//and keep the C code for anything else.
+#define AES_ARM_ALIGNED(a, b, c) ((((uintptr_t)(a) | (uintptr_t)(b) | (uintptr_t)(c)) & 3) == 0)
+
+void aes_arm_encrypt(const unsigned long* rk, int nr, const unsigned char in[16], unsigned char out[16]);
+void aes_arm_decrypt(const unsigned long* rk, int nr, const unsigned char in[16], unsigned char out[16]);
+
+//updates iv to the last ciphertext block like aes_crypt_cbc()
+void aes_arm_cbc_decrypt(const unsigned long* rk, int nr, unsigned char iv[16],
+						 const unsigned char* in, unsigned char* out, unsigned blocks);
+
+//dsi_crypt_ctr() byte order, ctr is advanced by blocks
+void aes_arm_ctr(const unsigned long* rk, int nr, unsigned char ctr[16],
+				 const unsigned char* in, unsigned char* out, unsigned blocks);
+
+//T-tables then S-box, from aes.c
+extern const void* const aes_arm_ftab[5];
+extern const void* const aes_arm_rtab[5];
+
+#endif
@@ -0,0 +1,290 @@
+@ ARM mode AES core, see aes_arm.h. Built with "make AES_ASM=1".
+@
+@ Works on the PolarSSL key schedules and tables, so the results are the same
+@ as aes_crypt_ecb(). The state lives in r4-r7 and r8-r11, r0-r3 hold the
+@ four T-table bases, r12 is the only scratch register and lr walks the
+@ round keys. All buffers must be word aligned. The Makefile passes
+@ POLARSSL_AES_FEWER_TABLES here too, so the table layout matches aes.c.
+
+#ifdef AES_ASM
+
+	.syntax	unified
+	.arm
+
+#ifndef CRYPTO_TCM_OFF
+	.section .itcm,"ax",%progbits
+#else
+	.text
+#endif
+
+	.align	2
+
+@ one output word of a full round, \d already holds its round key
+#ifndef POLARSSL_AES_FEWER_TABLES
+.macro	TWORD d, a, b, c, e
+	and	r12, \a, #0xFF
+	ldr	r12, [r0, r12, lsl #2]
+	eor	\d, \d, r12
+	and	r12, \b, #0xFF00
+	ldr	r12, [r1, r12, lsr #6]
+	eor	\d, \d, r12
+	and	r12, \c, #0xFF0000
+	ldr	r12, [r2, r12, lsr #14]
+	eor	\d, \d, r12
+	and	r12, \e, #0xFF000000
+	ldr	r12, [r3, r12, lsr #22]
+	eor	\d, \d, r12
+.endm
+#else
+@ only T0 in r0, the others are it rotated left by 8, 16 and 24 which
+@ the barrel shifter does for free
+.macro	TWORD d, a, b, c, e
+	and	r12, \a, #0xFF
+	ldr	r12, [r0, r12, lsl #2]
+	eor	\d, \d, r12
+	and	r12, \b, #0xFF00
+	ldr	r12, [r0, r12, lsr #6]
+	eor	\d, \d, r12, ror #24
+	and	r12, \c, #0xFF0000
+	ldr	r12, [r0, r12, lsr #14]
+	eor	\d, \d, r12, ror #16
+	and	r12, \e, #0xFF000000
+	ldr	r12, [r0, r12, lsr #22]
+	eor	\d, \d, r12, ror #8
+.endm
+#endif
+
+@ one output word of the last round, S-box in r0
+.macro	SWORD d, a, b, c, e
+	and	r12, \a, #0xFF
+	ldrb	r12, [r0, r12]
+	eor	\d, \d, r12
+	and	r12, \b, #0xFF00
+	ldrb	r12, [r0, r12, lsr #8]
+	eor	\d, \d, r12, lsl #8
+	and	r12, \c, #0xFF0000
+	ldrb	r12, [r0, r12, lsr #16]
+	eor	\d, \d, r12, lsl #16
+	ldrb	r12, [r0, \e, lsr #24]
+	eor	\d, \d, r12, lsl #24
+.endm
+
+.macro	FROUND d0, d1, d2, d3, s0, s1, s2, s3
+	ldmia	lr!, {\d0, \d1, \d2, \d3}
+	TWORD	\d0, \s0, \s1, \s2, \s3
+	TWORD	\d1, \s1, \s2, \s3, \s0
+	TWORD	\d2, \s2, \s3, \s0, \s1
+	TWORD	\d3, \s3, \s0, \s1, \s2
+.endm
+
+.macro	RROUND d0, d1, d2, d3, s0, s1, s2, s3
+	ldmia	lr!, {\d0, \d1, \d2, \d3}
+	TWORD	\d0, \s0, \s3, \s2, \s1
+	TWORD	\d1, \s1, \s0, \s3, \s2
+	TWORD	\d2, \s2, \s1, \s0, \s3
+	TWORD	\d3, \s3, \s2, \s1, \s0
+.endm
+
+@ byte swap \x on ARMv5, which has no REV
+.macro	BSWAP x
+	eor	r12, \x, \x, ror #16
+	bic	r12, r12, #0x00FF0000
+	mov	\x, \x, ror #8
+	eor	\x, \x, r12, lsr #8
+.endm
+
+@ in: r0 round keys, r1 rounds, r4-r7 block as little endian words
+@ out: r4-r7, r0-r3 and r8-r12 are clobbered
+.macro	CORE tables, round, last
+	push	{r1, lr}
+	mov	lr, r0
+	ldmia	lr!, {r8-r11}
+	eor	r4, r4, r8
+	eor	r5, r5, r9
+	eor	r6, r6, r10
+	eor	r7, r7, r11
+
+	mov	r1, r1, lsr #1
+	sub	r1, r1, #1
+	str	r1, [sp]
+
+	ldr	r12, =\tables
+	ldmia	r12, {r0-r3}
+1:
+	\round	r8, r9, r10, r11, r4, r5, r6, r7
+	\round	r4, r5, r6, r7, r8, r9, r10, r11
+	ldr	r12, [sp]
+	subs	r12, r12, #1
+	str	r12, [sp]
+	bne	1b
+
+	\round	r8, r9, r10, r11, r4, r5, r6, r7
+
+	ldr	r12, =\tables
+	ldr	r0, [r12, #16]
+	ldmia	lr!, {r4-r7}
+	\last
+	pop	{r1, pc}
+.endm
+
+.macro	FLAST
+	SWORD	r4, r8, r9, r10, r11
+	SWORD	r5, r9, r10, r11, r8
+	SWORD	r6, r10, r11, r8, r9
+	SWORD	r7, r11, r8, r9, r10
+.endm
+
+.macro	RLAST
+	SWORD	r4, r8, r11, r10, r9
+	SWORD	r5, r9, r8, r11, r10
+	SWORD	r6, r10, r9, r8, r11
+	SWORD	r7, r11, r10, r9, r8
+.endm
+
+encrypt_core:
+	CORE	aes_arm_ftab, FROUND, FLAST
+	.ltorg
+
+decrypt_core:
+	CORE	aes_arm_rtab, RROUND, RLAST
+	.ltorg
+
+@ void aes_arm_encrypt(const unsigned long* rk, int nr, const unsigned char in[16], unsigned char out[16])
+	.global	aes_arm_encrypt
+	.type	aes_arm_encrypt, %function
+aes_arm_encrypt:
+	push	{r3-r11, lr}
+	ldmia	r2, {r4-r7}
+	bl	encrypt_core
+	ldr	r3, [sp]
+	stmia	r3, {r4-r7}
+	pop	{r3-r11, pc}
+	.size	aes_arm_encrypt, . - aes_arm_encrypt
+
+@ void aes_arm_decrypt(const unsigned long* rk, int nr, const unsigned char in[16], unsigned char out[16])
+	.global	aes_arm_decrypt
+	.type	aes_arm_decrypt, %function
+aes_arm_decrypt:
+	push	{r3-r11, lr}
+	ldmia	r2, {r4-r7}
+	bl	decrypt_core
+	ldr	r3, [sp]
+	stmia	r3, {r4-r7}
+	pop	{r3-r11, pc}
+	.size	aes_arm_decrypt, . - aes_arm_decrypt
+
+@ locals of the multi block entry points
+	.equ	L_RK, 0
+	.equ	L_IV, 8
+	.equ	L_IN, 12
+	.equ	L_OUT, 16
+	.equ	L_BLOCKS, 20
+	.equ	L_SAVE, 24
+	.equ	L_SIZE, 40
+	.equ	L_ARGS, L_SIZE + 36
+
+@ void aes_arm_cbc_decrypt(const unsigned long* rk, int nr, unsigned char iv[16],
+@                          const unsigned char* in, unsigned char* out, unsigned blocks)
+	.global	aes_arm_cbc_decrypt
+	.type	aes_arm_cbc_decrypt, %function
+aes_arm_cbc_decrypt:
+	push	{r4-r11, lr}
+	sub	sp, sp, #L_SIZE
+	ldr	r4, [sp, #L_ARGS]
+	ldr	r5, [sp, #L_ARGS + 4]
+	stmia	sp, {r0-r5}
+	cmp	r5, #0
+	beq	2f
+1:
+	@ the ciphertext is the next IV, keep it in case in == out
+	ldr	r3, [sp, #L_IN]
+	ldmia	r3!, {r4-r7}
+	str	r3, [sp, #L_IN]
+	add	r12, sp, #L_SAVE
+	stmia	r12, {r4-r7}
+
+	ldmia	sp, {r0, r1}
+	bl	decrypt_core
+
+	ldr	r2, [sp, #L_IV]
+	ldmia	r2, {r8-r11}
+	eor	r4, r4, r8
+	eor	r5, r5, r9
+	eor	r6, r6, r10
+	eor	r7, r7, r11
+	ldr	r3, [sp, #L_OUT]
+	stmia	r3!, {r4-r7}
+	str	r3, [sp, #L_OUT]
+
+	add	r12, sp, #L_SAVE
+	ldmia	r12, {r4-r7}
+	stmia	r2, {r4-r7}
+
+	ldr	r5, [sp, #L_BLOCKS]
+	subs	r5, r5, #1
+	str	r5, [sp, #L_BLOCKS]
+	bne	1b
+2:
+	add	sp, sp, #L_SIZE
+	pop	{r4-r11, pc}
+	.size	aes_arm_cbc_decrypt, . - aes_arm_cbc_decrypt
+
+@ void aes_arm_ctr(const unsigned long* rk, int nr, unsigned char ctr[16],
+@                  const unsigned char* in, unsigned char* out, unsigned blocks)
+@
+@ dsi_crypt_ctr() byte order: the key stream is used back to front and the
+@ counter is incremented as a 128 bit big endian number
+	.global	aes_arm_ctr
+	.type	aes_arm_ctr, %function
+aes_arm_ctr:
+	push	{r4-r11, lr}
+	sub	sp, sp, #L_SIZE
+	ldr	r4, [sp, #L_ARGS]
+	ldr	r5, [sp, #L_ARGS + 4]
+	stmia	sp, {r0-r5}
+	cmp	r5, #0
+	beq	4f
+1:
+	ldr	r2, [sp, #L_IV]
+	ldmia	r2, {r4-r7}
+	ldmia	sp, {r0, r1}
+	bl	encrypt_core
+
+	BSWAP	r4
+	BSWAP	r5
+	BSWAP	r6
+	BSWAP	r7
+	ldr	r3, [sp, #L_IN]
+	ldmia	r3!, {r8-r11}
+	str	r3, [sp, #L_IN]
+	eor	r8, r8, r7
+	eor	r9, r9, r6
+	eor	r10, r10, r5
+	eor	r11, r11, r4
+	ldr	r3, [sp, #L_OUT]
+	stmia	r3!, {r8-r11}
+	str	r3, [sp, #L_OUT]
+
+	@ counter + 1, from the last byte up while it carries
+	ldr	r2, [sp, #L_IV]
+	add	r2, r2, #15
+	mov	r1, #16
+2:
+	ldrb	r12, [r2]
+	add	r12, r12, #1
+	strb	r12, [r2], #-1
+	tst	r12, #0x100
+	beq	3f
+	subs	r1, r1, #1
+	bne	2b
+3:
+	ldr	r5, [sp, #L_BLOCKS]
+	subs	r5, r5, #1
+	str	r5, [sp, #L_BLOCKS]
+	bne	1b
+4:
+	add	sp, sp, #L_SIZE
+	pop	{r4-r11, pc}
+	.size	aes_arm_ctr, . - aes_arm_ctr
+
+#endif
@@ -3,13 +3,16 @@
 #include "u128_math.h"
 #include "f_xy.h"
 #include "twltool/dsi.h"
+#include "tcm.h"
+#include "../sha1.h"
 
 // more info:
 //		https://github.com/Jimmy-Z/TWLbf/blob/master/dsi.c
 //		https://github.com/Jimmy-Z/bfCL/blob/master/dsi.h
 // ported back to 32 bit for ARM9
 
-static dsi_context nand_ctx;
+//key schedule for every NAND sector, see tcm.h
+static dsi_context nand_ctx CRYPTO_DTCM;
 static dsi_context boot2_ctx;
 static dsi_es_context es_ctx;
 
@@ -51,7 +54,7 @@ static void generate_key(uint8_t *generated_key, const uint32_t *console_id, con
 int dsi_sha1_verify(const void *digest_verify, const void *data, unsigned len)
 {
 	uint8_t digest[SHA1_LEN];
-	swiSHA1Calc(digest, data, len);
+	sha1Calc(digest, data, len);
 	return memcmp(digest, digest_verify, SHA1_LEN);
 }
 
@@ -74,7 +77,7 @@ void dsi_crypt_init(const uint8_t *console_id_be, const uint8_t *emmc_cid, int i
 
 	dsi_set_key(&boot2_ctx, DSi_BOOT2_KEY);
 
-	swiSHA1Calc(nand_ctr_iv, emmc_cid, 16);
+	sha1Calc(nand_ctr_iv, emmc_cid, 16);
 
 }
 
@@ -89,19 +92,14 @@ void dsi_nand_crypt_1(uint8_t* out, const uint8_t* in, uint32_t offset)
 	dsi_crypt_ctr(&nand_ctx, in, out, 16);
 }
 
-void dsi_nand_crypt(uint8_t* out, const uint8_t* in, uint32_t offset, unsigned count)
+CRYPTO_ITCM void dsi_nand_crypt(uint8_t* out, const uint8_t* in, uint32_t offset, unsigned count)
 {
 	uint8_t ctr[16];
 	memcpy(ctr, nand_ctr_iv, sizeof(nand_ctr_iv));
 	u128_add32(ctr, offset);
-	for (unsigned i = 0; i < count; ++i)
-	{
-		dsi_set_ctr(&nand_ctx, ctr);
-		dsi_crypt_ctr(&nand_ctx, in, out, 16);
-		out += AES_BLOCK_SIZE;
-		in += AES_BLOCK_SIZE;
-		u128_add32(ctr, 1);
-	}
+	// dsi_crypt_ctr() steps the counter itself
+	dsi_set_ctr(&nand_ctx, ctr);
+	dsi_crypt_ctr(&nand_ctx, in, out, count * AES_BLOCK_SIZE);
 }
 
 int dsi_es_block_crypt(uint8_t *buf, unsigned buf_len, crypt_mode_t mode)
@@ -127,12 +125,7 @@ void dsi_boot2_crypt_set_ctr(uint32_t size_r)
 
 void dsi_boot2_crypt(uint8_t* out, const uint8_t* in, unsigned count)
 {
-	for (unsigned i = 0; i < count; ++i)
-	{
-		dsi_set_ctr(&boot2_ctx, boot2_ctr);
-		dsi_crypt_ctr(&boot2_ctx, in, out, 16);
-		out += AES_BLOCK_SIZE;
-		in += AES_BLOCK_SIZE;
-		u128_add32(boot2_ctr, 1);
-	}
+	dsi_set_ctr(&boot2_ctx, boot2_ctr);
+	dsi_crypt_ctr(&boot2_ctx, in, out, count * AES_BLOCK_SIZE);
+	u128_add32(boot2_ctr, count);
 }
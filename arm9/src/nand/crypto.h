@@ -48,9 +48,6 @@ typedef enum {
 } key_mode_t;
 
 
-// don't want to include nds.h just for this
-void swiSHA1Calc(void *digest, const void *buf, size_t len);
-
 int dsi_sha1_verify(const void *digest_verify, const void *data, unsigned len);
 
 void dsi_crypt_init(const uint8_t *console_id_be, const uint8_t *emmc_cid, int is3DS);
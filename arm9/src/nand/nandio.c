@@ -3,9 +3,13 @@
 #include <nds/disc_io.h>
 #include <malloc.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "crypto.h"
 #include "sector0.h"
 #include "f_xy.h"
+#include "../iotrace.h"
+#include "../main.h"
 #include "../message.h"
 #include "nandio.h"
 #include "u128_math.h"
@@ -36,13 +40,46 @@ bool is3DS;
 
 static bool writingLocked = true;
 static bool nandWritten = false;
+static bool rawWritten = false;
 
 extern bool nand_Startup();
 
-static u8* crypt_buf = 0;
+static u8* crypt_buf[2] = { 0, 0 };
 
 static u32 fat_sig_fix_offset = 0;
 
+#define READAHEAD_LEN     (CRYPT_BUF_LEN * 2)
+#define READAHEAD_TRIGGER 2
+
+static u8* readahead_buf = 0;
+static sec_t readahead_start = 0;
+static sec_t readahead_len = 0;
+static sec_t readahead_next = 0;
+static int readahead_streak = 0;
+
+static u8* writeback_buf = 0;
+static sec_t writeback_start = 0;
+static sec_t writeback_len = 0;
+
+#define JOURNAL_PATH  "sd:/_nds/TADDeliveryTool/journal.bin"
+#define JOURNAL_MAGIC 0x4C4E4A54 // 'TJNL'
+
+typedef struct {
+	u32 magic;
+	u32 total_sectors;
+	u8 console_id[8];
+	u32 open;
+} journal_header_t;
+
+typedef struct {
+	u32 sector;
+	u32 len;
+} journal_record_t;
+
+static FILE* journal_file = 0;
+static u8* journal_map = 0;
+static journal_header_t journal_header;
+
 static u32 sector_buf32[SECTOR_SIZE/sizeof(u32)];
 static u8 *sector_buf = (u8*)sector_buf32;
 
@@ -97,12 +134,22 @@ bool nandio_startup()
 
 	nandio_set_fat_sig_fix(is3DS ? 0 : mbr->partitions[0].offset);
 
-	if (crypt_buf == 0)
+	for (int i = 0; i < 2; i++)
 	{
-		crypt_buf = (u8*)memalign(32, SECTOR_SIZE * CRYPT_BUF_LEN);
+		if (crypt_buf[i] == 0)
+			crypt_buf[i] = (u8*)memalign(32, SECTOR_SIZE * CRYPT_BUF_LEN);
 	}
 
-	return crypt_buf != 0;
+	// read-ahead and write-behind are optional, plain I/O works without them
+	if (writeback_buf == 0)
+		writeback_buf = (u8*)memalign(32, SECTOR_SIZE * CRYPT_BUF_LEN);
+	writeback_len = 0;
+
+	if (readahead_buf == 0)
+		readahead_buf = (u8*)memalign(32, SECTOR_SIZE * READAHEAD_LEN);
+	readahead_len = 0;
+
+	return crypt_buf[0] != 0 && crypt_buf[1] != 0;
 }
 
 bool nandio_is_inserted()
@@ -110,93 +157,361 @@ bool nandio_is_inserted()
 	return true;
 }
 
-// len is guaranteed <= CRYPT_BUF_LEN
-static bool read_sectors(sec_t start, sec_t len, void *buffer)
+// Sector requests are posted to the ARM7 without waiting for the reply, so the
+// transfer of the next chunk runs while the ARM9 crypts the current one.
+// The ARM7 answers requests in the order they were sent.
+static void nand_post_sectors(int type, sec_t start, sec_t len, void *buffer)
 {
-	if (nand_ReadSectors(start, len, crypt_buf))
+	FifoMessage msg;
+
+	DC_FlushRange(buffer, len * SECTOR_SIZE);
+
+	msg.type = type;
+	msg.sdParams.startsector = start;
+	msg.sdParams.numsectors = len;
+	msg.sdParams.buffer = buffer;
+
+	fifoSendDatamsg(FIFO_SDMMC, sizeof(msg), (u8*)&msg);
+}
+
+static bool nand_wait_sectors(sec_t len, void *buffer)
+{
+	fifoWaitValue32(FIFO_SDMMC);
+
+	DC_InvalidateRange(buffer, len * SECTOR_SIZE);
+
+	return fifoGetValue32(FIFO_SDMMC) == 0;
+}
+
+static void read_fix(sec_t start, sec_t len, void *buffer)
+{
+	if (!fat_sig_fix_offset || fat_sig_fix_offset < start || fat_sig_fix_offset >= start + len)
+		return;
+
+	u8 *sector = (u8*)buffer + (fat_sig_fix_offset - start) * SECTOR_SIZE;
+	if (sector[0x36] == 0
+		&& sector[0x37] == 0
+		&& sector[0x38] == 0)
+	{
+		sector[0x36] = 'F';
+		sector[0x37] = 'A';
+		sector[0x38] = 'T';
+	}
+}
+
+// Copy-on-write journal. The first time a sector is written in a session its
+// original encrypted contents are appended to a file on SD, and the file is
+// synced before the new data goes to the NAND, so a session can always be
+// undone by writing the saved sectors back.
+static bool journal_save(sec_t offset, sec_t len)
+{
+	bool saved = false;
+
+	while (len > 0)
 	{
-		dsi_nand_crypt(buffer, crypt_buf, start * SECTOR_SIZE / AES_BLOCK_SIZE, len * SECTOR_SIZE / AES_BLOCK_SIZE);
-		if (fat_sig_fix_offset &&
-			start == fat_sig_fix_offset
-			&& ((u8*)buffer)[0x36] == 0
-			&& ((u8*)buffer)[0x37] == 0
-			&& ((u8*)buffer)[0x38] == 0)
+		// skip sectors already saved in this session
+		while (len > 0 && (journal_map[offset / 8] & BIT(offset % 8)))
 		{
-			((u8*)buffer)[0x36] = 'F';
-			((u8*)buffer)[0x37] = 'A';
-			((u8*)buffer)[0x38] = 'T';
+			offset++;
+			len--;
 		}
-		return true;
+
+		sec_t run = 0;
+		while (run < len && run < CRYPT_BUF_LEN && !(journal_map[(offset + run) / 8] & BIT((offset + run) % 8)))
+			run++;
+
+		if (run == 0)
+			break;
+
+		nand_post_sectors(SDMMC_NAND_READ_SECTORS, offset, run, crypt_buf[0]);
+		if (!nand_wait_sectors(run, crypt_buf[0]))
+			return false;
+
+		journal_record_t record = { offset, run };
+		if (fwrite(&record, sizeof(record), 1, journal_file) != 1
+			|| fwrite(crypt_buf[0], SECTOR_SIZE, run, journal_file) != run)
+			return false;
+
+		for (sec_t i = 0; i < run; i++)
+			journal_map[(offset + i) / 8] |= BIT((offset + i) % 8);
+
+		offset += run;
+		len -= run;
+		saved = true;
 	}
-	else
+
+	if (saved && (fflush(journal_file) != 0 || fsync(fileno(journal_file)) != 0))
+		return false;
+
+	return true;
+}
+
+static void journal_close(bool clean)
+{
+	if (!journal_file)
+		return;
+
+	if (clean)
+	{
+		journal_header.open = 0;
+		fseek(journal_file, 0, SEEK_SET);
+		fwrite(&journal_header, sizeof(journal_header), 1, journal_file);
+	}
+
+	fclose(journal_file);
+	journal_file = 0;
+
+	free(journal_map);
+	journal_map = 0;
+}
+
+static bool journal_begin()
+{
+	journal_close(true);
+
+	journal_header.magic = JOURNAL_MAGIC;
+	journal_header.total_sectors = nand_GetSize();
+	getConsoleID(journal_header.console_id);
+	journal_header.open = 1;
+
+	journal_map = (u8*)calloc((journal_header.total_sectors + 7) / 8, 1);
+	if (!journal_map)
+		return false;
+
+	mkdir("sd:/_nds", 0777);
+	mkdir("sd:/_nds/TADDeliveryTool", 0777);
+
+	journal_file = fopen(JOURNAL_PATH, "wb");
+	if (!journal_file || fwrite(&journal_header, sizeof(journal_header), 1, journal_file) != 1)
 	{
+		journal_close(false);
 		return false;
 	}
+
+	return true;
+}
+
+// a journal from this console that was never closed means the tool stopped
+// in the middle of a session
+static bool journal_read_header(FILE* f, journal_header_t* header)
+{
+	u8 console_id[8];
+	getConsoleID(console_id);
+
+	return fread(header, sizeof(journal_header_t), 1, f) == 1
+		&& header->magic == JOURNAL_MAGIC
+		&& header->total_sectors == nand_GetSize()
+		&& memcmp(header->console_id, console_id, sizeof(console_id)) == 0;
 }
 
-// len is guaranteed <= CRYPT_BUF_LEN
-static bool write_sectors(sec_t start, sec_t len, const void *buffer)
+static bool write_sectors(sec_t offset, sec_t len, const void *buffer)
 {
-	static u8 writeCopy[SECTOR_SIZE*16];
-	memcpy(writeCopy, buffer, len * SECTOR_SIZE);
+	bool result = true;
+
+	// nothing reaches the NAND unless its old contents are safe on SD
+	if (journal_file && !journal_save(offset, len))
+		return false;
 
-	dsi_nand_crypt(crypt_buf, writeCopy, start * SECTOR_SIZE / AES_BLOCK_SIZE, len * SECTOR_SIZE / AES_BLOCK_SIZE);
-	if (nand_WriteSectors(start, len, crypt_buf))
+	int current = 0;
+	sec_t pending[2] = { 0, 0 };
+
+	while (len > 0)
 	{
-		return true;
+		sec_t chunk = len < CRYPT_BUF_LEN ? len : CRYPT_BUF_LEN;
+
+		// the buffer is free again once its previous write is answered
+		if (pending[current] && !nand_wait_sectors(pending[current], crypt_buf[current]))
+			result = false;
+		pending[current] = 0;
+
+		if (!result)
+			break;
+
+		dsi_nand_crypt(crypt_buf[current], buffer, offset * SECTOR_SIZE / AES_BLOCK_SIZE, chunk * SECTOR_SIZE / AES_BLOCK_SIZE);
+		nand_post_sectors(SDMMC_NAND_WRITE_SECTORS, offset, chunk, crypt_buf[current]);
+		pending[current] = chunk;
+
+		offset += chunk;
+		len -= chunk;
+		buffer = ((u8*)buffer) + SECTOR_SIZE * chunk;
+		current ^= 1;
 	}
-	else
+
+	// replies come back in order, the other buffer was posted first
+	for (int i = 0; i < 2; i++)
 	{
-		return false;
+		if (pending[current] && !nand_wait_sectors(pending[current], crypt_buf[current]))
+			result = false;
+		current ^= 1;
 	}
+
+	return result;
 }
 
+static bool writeback_flush()
+{
+	if (writeback_len == 0)
+		return true;
 
-bool nandio_read_sectors(sec_t offset, sec_t len, void *buffer)
+	sec_t len = writeback_len;
+	writeback_len = 0;
+
+	return IOTRACE(IOTRACE_NAND, IOTRACE_DEV_WRITE, writeback_start, len, write_sectors(writeback_start, len, writeback_buf));
+}
+
+static bool read_sectors(sec_t offset, sec_t len, void *buffer)
 {
-	while (len >= CRYPT_BUF_LEN)
+	if (len == 0)
+		return true;
+
+	// dirty sectors have to reach the NAND before they can be read back
+	if (writeback_len > 0 && offset < writeback_start + writeback_len && offset + len > writeback_start)
+	{
+		if (!writeback_flush())
+			return false;
+	}
+
+	int current = 0;
+
+	sec_t chunk = len < CRYPT_BUF_LEN ? len : CRYPT_BUF_LEN;
+	nand_post_sectors(SDMMC_NAND_READ_SECTORS, offset, chunk, crypt_buf[current]);
+
+	while (len > 0)
 	{
-		if (!read_sectors(offset, CRYPT_BUF_LEN, buffer))
+		sec_t next = len - chunk;
+		if (next > CRYPT_BUF_LEN)
+			next = CRYPT_BUF_LEN;
+
+		// queue up the following chunk before working on this one
+		if (next > 0)
+			nand_post_sectors(SDMMC_NAND_READ_SECTORS, offset + chunk, next, crypt_buf[current ^ 1]);
+
+		if (!nand_wait_sectors(chunk, crypt_buf[current]))
 		{
+			// drain the chunk already in flight before giving up
+			if (next > 0)
+				nand_wait_sectors(next, crypt_buf[current ^ 1]);
 			return false;
 		}
-		offset += CRYPT_BUF_LEN;
-		len -= CRYPT_BUF_LEN;
-		buffer = ((u8*)buffer) + SECTOR_SIZE * CRYPT_BUF_LEN;
+
+		dsi_nand_crypt(buffer, crypt_buf[current], offset * SECTOR_SIZE / AES_BLOCK_SIZE, chunk * SECTOR_SIZE / AES_BLOCK_SIZE);
+		read_fix(offset, chunk, buffer);
+
+		offset += chunk;
+		len -= chunk;
+		buffer = ((u8*)buffer) + SECTOR_SIZE * chunk;
+		chunk = next;
+		current ^= 1;
 	}
-	if (len > 0)
-	{
-		return read_sectors(offset, len, buffer);
-	} else
+
+	return true;
+}
+
+// libfat streams files as many small reads. Once a few of them arrive back to
+// back, a larger run is decrypted into the read-ahead buffer and the
+// following requests are served from it.
+static bool cached_read_sectors(sec_t offset, sec_t len, void *buffer)
+{
+	while (len > 0 && readahead_len > 0
+		&& offset >= readahead_start && offset < readahead_start + readahead_len)
 	{
+		sec_t count = readahead_start + readahead_len - offset;
+		if (count > len)
+			count = len;
+
+		memcpy(buffer, readahead_buf + (offset - readahead_start) * SECTOR_SIZE, count * SECTOR_SIZE);
+
+		offset += count;
+		len -= count;
+		buffer = ((u8*)buffer) + SECTOR_SIZE * count;
+		readahead_next = offset;
+	}
+
+	if (len == 0)
 		return true;
+
+	if (offset == readahead_next)
+	{
+		if (readahead_streak < READAHEAD_TRIGGER)
+			readahead_streak++;
+	}
+	else
+	{
+		readahead_streak = 0;
 	}
+
+	readahead_next = offset + len;
+
+	if (!readahead_buf || readahead_streak < READAHEAD_TRIGGER || len >= READAHEAD_LEN)
+		return IOTRACE(IOTRACE_NAND, IOTRACE_DEV_READ, offset, len, read_sectors(offset, len, buffer));
+
+	if (!IOTRACE(IOTRACE_NAND, IOTRACE_DEV_READ, offset, READAHEAD_LEN, read_sectors(offset, READAHEAD_LEN, readahead_buf)))
+	{
+		// probably ran past the end of the NAND
+		readahead_len = 0;
+		return IOTRACE(IOTRACE_NAND, IOTRACE_DEV_READ, offset, len, read_sectors(offset, len, buffer));
+	}
+
+	readahead_start = offset;
+	readahead_len = READAHEAD_LEN;
+	memcpy(buffer, readahead_buf, len * SECTOR_SIZE);
+
+	return true;
 }
 
-bool nandio_write_sectors(sec_t offset, sec_t len, const void *buffer)
+// libfat writes data, FAT and directory sectors one small request at a time.
+// Adjacent or overlapping writes are gathered in the write-behind buffer and
+// go out as one run once something that does not fit arrives, a dirty sector
+// is read, or writing is locked again.
+static bool cached_write_sectors(sec_t offset, sec_t len, const void *buffer)
 {
-	if (writingLocked)
+	if (writingLocked || rawWritten)
 		return false;
 
+	if (readahead_len > 0 && offset < readahead_start + readahead_len && offset + len > readahead_start)
+		readahead_len = 0;
+
 	nandWritten = true;
 
-	while (len >= CRYPT_BUF_LEN)
+	if (writeback_len > 0)
 	{
-		if (!write_sectors(offset, CRYPT_BUF_LEN, buffer))
+		sec_t start = offset < writeback_start ? offset : writeback_start;
+		sec_t end = offset + len > writeback_start + writeback_len ? offset + len : writeback_start + writeback_len;
+
+		if (offset <= writeback_start + writeback_len && offset + len >= writeback_start
+			&& end - start <= CRYPT_BUF_LEN)
 		{
-			return false;
+			if (start < writeback_start)
+				memmove(writeback_buf + (writeback_start - start) * SECTOR_SIZE, writeback_buf, writeback_len * SECTOR_SIZE);
+
+			memcpy(writeback_buf + (offset - start) * SECTOR_SIZE, buffer, len * SECTOR_SIZE);
+			writeback_start = start;
+			writeback_len = end - start;
+			return true;
 		}
-		offset += CRYPT_BUF_LEN;
-		len -= CRYPT_BUF_LEN;
-		buffer = ((u8*)buffer) + SECTOR_SIZE * CRYPT_BUF_LEN;
-	}
-	if (len > 0)
-	{
-		return write_sectors(offset, len, buffer);
-	} else
-	{
-		return true;
+
+		if (!writeback_flush())
+			return false;
 	}
+
+	if (!writeback_buf || len >= CRYPT_BUF_LEN)
+		return IOTRACE(IOTRACE_NAND, IOTRACE_DEV_WRITE, offset, len, write_sectors(offset, len, buffer));
+
+	memcpy(writeback_buf, buffer, len * SECTOR_SIZE);
+	writeback_start = offset;
+	writeback_len = len;
+
+	return true;
+}
+
+bool nandio_read_sectors(sec_t offset, sec_t len, void *buffer)
+{
+	return IOTRACE(IOTRACE_NAND, IOTRACE_READ, offset, len, cached_read_sectors(offset, len, buffer));
+}
+
+bool nandio_write_sectors(sec_t offset, sec_t len, const void *buffer)
+{
+	return IOTRACE(IOTRACE_NAND, IOTRACE_WRITE, offset, len, cached_write_sectors(offset, len, buffer));
 }
 
 bool nandio_clear_status()
@@ -204,10 +519,12 @@ bool nandio_clear_status()
 	return true;
 }
 
-bool nandio_shutdown()
+bool nandio_sync_fat_copies()
 {
-	if (nandWritten)
+	if (nandWritten && !rawWritten)
 	{
+		bool wasLocked = writingLocked;
+
 		// at cleanup we synchronize the FAT statgings
 		// A FatFS might have multiple copies of the FAT.
 		// we will get them back synchonized as we just worked on the first copy
@@ -235,18 +552,37 @@ bool nandio_shutdown()
 				{
 					nandio_write_sectors(fat_sig_fix_offset + reservedSectors + sector + (stage *sectorsPerFatCopy), 1, sector_buf);
 				}
-				writingLocked = true;
+				writingLocked = wasLocked;
 			}
 		}
 		nandWritten = false;
 	}
-	free(crypt_buf);
-	crypt_buf = 0;
+
+	return writeback_flush();
+}
+
+bool nandio_shutdown()
+{
+	nandio_sync_fat_copies();
+	journal_close(true);
+
+	for (int i = 0; i < 2; i++)
+	{
+		free(crypt_buf[i]);
+		crypt_buf[i] = 0;
+	}
+	free(writeback_buf);
+	writeback_buf = 0;
+
+	free(readahead_buf);
+	readahead_buf = 0;
+	readahead_len = 0;
 	return true;
 }
 
 bool nandio_lock_writing()
 {
+	writeback_flush();
 	writingLocked = true;
 
 	return writingLocked;
@@ -254,12 +590,129 @@ bool nandio_lock_writing()
 
 bool nandio_unlock_writing()
 {
+	if (writingLocked && nandio_journal_pending())
+	{
+		if (choiceBox("The last NAND write session\nwas interrupted.\n\nRoll it back now?") == YES)
+		{
+			if (nandio_rollback_journal())
+				messageBox("Session rolled back.\n\nThe console will now shut down.");
+			else
+				messageBox("\x1B[31mRollback failed.\n\x1B[47m");
+
+			return false;
+		}
+
+		// a new session would overwrite the only copy of its old sectors
+		if (choiceBox("Discard the interrupted session?\nIt can no longer be rolled\nback after this.") == NO)
+			return false;
+	}
+
 	if (writingLocked && randomConfirmBox("Writing to NAND is locked!\nIf you're sure you understand\nthe risk, input the sequence\nbelow."))
+	{
 		writingLocked = false;
 
+		// every unlock starts a new session that can be rolled back
+		if (!journal_begin())
+		{
+			if (choiceBox("Could not create the NAND\njournal on SD. Changes cannot\nbe rolled back.\n\nContinue anyway?") == NO)
+				writingLocked = true;
+		}
+	}
+
 	return !writingLocked;
 }
 
+bool nandio_journal_pending()
+{
+	if (journal_file)
+		return false;
+
+	FILE* f = fopen(JOURNAL_PATH, "rb");
+	if (!f)
+		return false;
+
+	journal_header_t header;
+	bool pending = journal_read_header(f, &header) && header.open;
+	fclose(f);
+
+	return pending;
+}
+
+bool nandio_journal_exists()
+{
+	return access(JOURNAL_PATH, F_OK) == 0;
+}
+
+// Writes the saved sectors back. Like an image restore this bypasses libfat,
+// so filesystem writes are refused afterwards and the tool has to exit.
+bool nandio_rollback_journal()
+{
+	writeback_flush();
+	journal_close(true);
+
+	FILE* f = fopen(JOURNAL_PATH, "rb");
+	if (!f)
+		return false;
+
+	journal_header_t header;
+	bool result = journal_read_header(f, &header);
+
+	if (result)
+	{
+		rawWritten = true;
+		readahead_len = 0;
+	}
+
+	journal_record_t record;
+	while (result && fread(&record, sizeof(record), 1, f) == 1)
+	{
+		if (record.len == 0 || record.len > CRYPT_BUF_LEN || record.sector + record.len > header.total_sectors)
+		{
+			result = false;
+			break;
+		}
+
+		// a torn record at the end was never followed by its NAND write
+		if (fread(crypt_buf[0], SECTOR_SIZE, record.len, f) != record.len)
+			break;
+
+		nand_post_sectors(SDMMC_NAND_WRITE_SECTORS, record.sector, record.len, crypt_buf[0]);
+		if (!nand_wait_sectors(record.len, crypt_buf[0]))
+			result = false;
+	}
+
+	fclose(f);
+
+	if (result)
+	{
+		remove(JOURNAL_PATH);
+		programEnd = true;
+	}
+
+	return result;
+}
+
+bool nandio_flush()
+{
+	return writeback_flush();
+}
+
+// Raw image restores bypass the filesystem, so whatever libfat has cached
+// is stale afterwards and no more filesystem writes are allowed through.
+bool nandio_write_raw_sectors(sec_t offset, sec_t len, const void *buffer)
+{
+	if (writingLocked)
+		return false;
+
+	if (!rawWritten && !writeback_flush())
+		return false;
+
+	rawWritten = true;
+	readahead_len = 0;
+
+	return nand_WriteSectors(offset, len, buffer);
+}
+
 bool nandio_force_fat_fix()
 {
 	if (!writingLocked)
@@ -267,3 +720,11 @@ bool nandio_force_fat_fix()
 
 	return true;
 }
+
+uint32_t nandio_set_data_path(uint32_t path)
+{
+	fifoSendValue32(FIFO_USER_04, path);
+	fifoWaitValue32(FIFO_USER_04);
+
+	return fifoGetValue32(FIFO_USER_04);
+}
@@ -12,6 +12,14 @@ extern "C" {
 #define CRYPT_BUF_LEN         64
 #define NAND_DEVICENAME       (('N' << 24) | ('A' << 16) | ('N' << 8) | 'D')
 
+// ARM7 SD/MMC data paths, must match SDMMC_PATH_* in the arm7 my_sdmmc.h
+enum {
+	NANDIO_PATH_16,
+	NANDIO_PATH_32,
+	NANDIO_PATH_NDMA,
+	NANDIO_PATH_COUNT
+};
+
 extern const DISC_INTERFACE   io_dsi_nand;
 
 /************************ Function Protoypes **********************************/
@@ -21,11 +29,21 @@ void nandio_set_fat_sig_fix(uint32_t offset);
 void getConsoleID(uint8_t *consoleID);
 
 extern bool nandio_shutdown();
+extern bool nandio_sync_fat_copies();
 
 extern bool nandio_lock_writing();
 extern bool nandio_unlock_writing();
 extern bool nandio_force_fat_fix();
 
+extern bool nandio_flush();
+extern bool nandio_write_raw_sectors(sec_t offset, sec_t len, const void *buffer);
+
+extern bool nandio_journal_pending();
+extern bool nandio_journal_exists();
+extern bool nandio_rollback_journal();
+
+uint32_t nandio_set_data_path(uint32_t path);
+
 #ifdef __cplusplus
 }
 #endif
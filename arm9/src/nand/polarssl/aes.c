@@ -35,6 +35,11 @@
 
 #include "aes.h"
 #include "padlock.h"
+#include "../tcm.h"
+
+#if defined(AES_ASM)
+#include "../aes_arm.h"
+#endif
 
 #include <string.h>
 
@@ -65,7 +70,7 @@
 /*
  * Forward S-box
  */
-static const unsigned char FSb[256] =
+static const unsigned char FSb[256] AES_DTCM_FORWARD =
 {
     0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5,
     0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
@@ -172,27 +177,29 @@ static const unsigned char FSb[256] =
     V(CB,B0,B0,7B), V(FC,54,54,A8), V(D6,BB,BB,6D), V(3A,16,16,2C)
 
 #define V(a,b,c,d) 0x##a##b##c##d
-static const unsigned long FT0[256] = { FT };
+static const unsigned long FT0[256] AES_DTCM_FORWARD = { FT };
 #undef V
 
+#if !defined(POLARSSL_AES_FEWER_TABLES)
 #define V(a,b,c,d) 0x##b##c##d##a
-static const unsigned long FT1[256] = { FT };
+static const unsigned long FT1[256] AES_DTCM_FORWARD = { FT };
 #undef V
 
 #define V(a,b,c,d) 0x##c##d##a##b
-static const unsigned long FT2[256] = { FT };
+static const unsigned long FT2[256] AES_DTCM_FORWARD = { FT };
 #undef V
 
 #define V(a,b,c,d) 0x##d##a##b##c
-static const unsigned long FT3[256] = { FT };
+static const unsigned long FT3[256] AES_DTCM_FORWARD = { FT };
 #undef V
+#endif
 
 #undef FT
 
 /*
  * Reverse S-box
  */
-static const unsigned char RSb[256] =
+static const unsigned char RSb[256] AES_DTCM_REVERSE =
 {
     0x52, 0x09, 0x6A, 0xD5, 0x30, 0x36, 0xA5, 0x38,
     0xBF, 0x40, 0xA3, 0x9E, 0x81, 0xF3, 0xD7, 0xFB,
@@ -299,27 +306,29 @@ static const unsigned char RSb[256] =
     V(61,84,CB,7B), V(70,B6,32,D5), V(74,5C,6C,48), V(42,57,B8,D0)
 
 #define V(a,b,c,d) 0x##a##b##c##d
-static const unsigned long RT0[256] = { RT };
+static const unsigned long RT0[256] AES_DTCM_REVERSE = { RT };
 #undef V
 
+#if !defined(POLARSSL_AES_FEWER_TABLES)
 #define V(a,b,c,d) 0x##b##c##d##a
-static const unsigned long RT1[256] = { RT };
+static const unsigned long RT1[256] AES_DTCM_REVERSE = { RT };
 #undef V
 
 #define V(a,b,c,d) 0x##c##d##a##b
-static const unsigned long RT2[256] = { RT };
+static const unsigned long RT2[256] AES_DTCM_REVERSE = { RT };
 #undef V
 
 #define V(a,b,c,d) 0x##d##a##b##c
-static const unsigned long RT3[256] = { RT };
+static const unsigned long RT3[256] AES_DTCM_REVERSE = { RT };
 #undef V
+#endif
 
 #undef RT
 
 /*
  * Round constants
  */
-static const unsigned long RCON[10] =
+static const unsigned long RCON[10] AES_DTCM_FORWARD =
 {
     0x00000001, 0x00000002, 0x00000004, 0x00000008,
     0x00000010, 0x00000020, 0x00000040, 0x00000080,
@@ -331,25 +340,29 @@ static const unsigned long RCON[10] =
 /*
  * Forward S-box & tables
  */
-static unsigned char FSb[256];
-static unsigned long FT0[256];
-static unsigned long FT1[256];
-static unsigned long FT2[256];
-static unsigned long FT3[256];
+static unsigned char FSb[256] AES_DTCM_FORWARD;
+static unsigned long FT0[256] AES_DTCM_FORWARD;
+#if !defined(POLARSSL_AES_FEWER_TABLES)
+static unsigned long FT1[256] AES_DTCM_FORWARD;
+static unsigned long FT2[256] AES_DTCM_FORWARD;
+static unsigned long FT3[256] AES_DTCM_FORWARD;
+#endif
 
 /*
  * Reverse S-box & tables
  */
-static unsigned char RSb[256];
-static unsigned long RT0[256];
-static unsigned long RT1[256];
-static unsigned long RT2[256];
-static unsigned long RT3[256];
+static unsigned char RSb[256] AES_DTCM_REVERSE;
+static unsigned long RT0[256] AES_DTCM_REVERSE;
+#if !defined(POLARSSL_AES_FEWER_TABLES)
+static unsigned long RT1[256] AES_DTCM_REVERSE;
+static unsigned long RT2[256] AES_DTCM_REVERSE;
+static unsigned long RT3[256] AES_DTCM_REVERSE;
+#endif
 
 /*
  * Round constants
  */
-static unsigned long RCON[10];
+static unsigned long RCON[10] AES_DTCM_FORWARD;
 
 /*
  * Tables generation code
@@ -419,9 +432,11 @@ static void aes_gen_tables( void )
                  ( (unsigned long) x << 16 ) ^
                  ( (unsigned long) z << 24 );
 
+#if !defined(POLARSSL_AES_FEWER_TABLES)
         FT1[i] = ROTL8( FT0[i] );
         FT2[i] = ROTL8( FT1[i] );
         FT3[i] = ROTL8( FT2[i] );
+#endif
 
         x = RSb[i];
 
@@ -430,14 +445,51 @@ static void aes_gen_tables( void )
                  ( (unsigned long) MUL( 0x0D, x ) << 16 ) ^
                  ( (unsigned long) MUL( 0x0B, x ) << 24 );
 
+#if !defined(POLARSSL_AES_FEWER_TABLES)
         RT1[i] = ROTL8( RT0[i] );
         RT2[i] = ROTL8( RT1[i] );
         RT3[i] = ROTL8( RT2[i] );
+#endif
     }
 }
 
 #endif
 
+/*
+ * With POLARSSL_AES_FEWER_TABLES only T0 is stored each way, the other
+ * three are T0 rotated by 8, 16 and 24 bits
+ */
+#if defined(POLARSSL_AES_FEWER_TABLES)
+#define AES_ROTL(x,n) ( (unsigned long) ( ( (unsigned int) (x) << (n) ) | ( (unsigned int) (x) >> ( 32 - (n) ) ) ) )
+#define AES_FT0(i) FT0[i]
+#define AES_FT1(i) AES_ROTL( FT0[i],  8 )
+#define AES_FT2(i) AES_ROTL( FT0[i], 16 )
+#define AES_FT3(i) AES_ROTL( FT0[i], 24 )
+#define AES_RT0(i) RT0[i]
+#define AES_RT1(i) AES_ROTL( RT0[i],  8 )
+#define AES_RT2(i) AES_ROTL( RT0[i], 16 )
+#define AES_RT3(i) AES_ROTL( RT0[i], 24 )
+#else
+#define AES_FT0(i) FT0[i]
+#define AES_FT1(i) FT1[i]
+#define AES_FT2(i) FT2[i]
+#define AES_FT3(i) FT3[i]
+#define AES_RT0(i) RT0[i]
+#define AES_RT1(i) RT1[i]
+#define AES_RT2(i) RT2[i]
+#define AES_RT3(i) RT3[i]
+#endif
+
+#if defined(AES_ASM)
+#if defined(POLARSSL_AES_FEWER_TABLES)
+const void* const aes_arm_ftab[5] = { FT0, FT0, FT0, FT0, FSb };
+const void* const aes_arm_rtab[5] = { RT0, RT0, RT0, RT0, RSb };
+#else
+const void* const aes_arm_ftab[5] = { FT0, FT1, FT2, FT3, FSb };
+const void* const aes_arm_rtab[5] = { RT0, RT1, RT2, RT3, RSb };
+#endif
+#endif
+
 /*
  * AES key schedule (encryption)
  */
@@ -583,10 +635,10 @@ int aes_setkey_dec( aes_context *ctx, const unsigned char *key, int keysize )
     {
         for( j = 0; j < 4; j++, SK++ )
         {
-            *RK++ = RT0[ FSb[ ( *SK       ) & 0xFF ] ] ^
-                    RT1[ FSb[ ( *SK >>  8 ) & 0xFF ] ] ^
-                    RT2[ FSb[ ( *SK >> 16 ) & 0xFF ] ] ^
-                    RT3[ FSb[ ( *SK >> 24 ) & 0xFF ] ];
+            *RK++ = AES_RT0( FSb[ ( *SK       ) & 0xFF ] ) ^
+                    AES_RT1( FSb[ ( *SK >>  8 ) & 0xFF ] ) ^
+                    AES_RT2( FSb[ ( *SK >> 16 ) & 0xFF ] ) ^
+                    AES_RT3( FSb[ ( *SK >> 24 ) & 0xFF ] );
         }
     }
 
@@ -602,54 +654,54 @@ int aes_setkey_dec( aes_context *ctx, const unsigned char *key, int keysize )
 
 #define AES_FROUND(X0,X1,X2,X3,Y0,Y1,Y2,Y3)     \
 {                                               \
-    X0 = *RK++ ^ FT0[ ( Y0       ) & 0xFF ] ^   \
-                 FT1[ ( Y1 >>  8 ) & 0xFF ] ^   \
-                 FT2[ ( Y2 >> 16 ) & 0xFF ] ^   \
-                 FT3[ ( Y3 >> 24 ) & 0xFF ];    \
+    X0 = *RK++ ^ AES_FT0( ( Y0       ) & 0xFF ) ^   \
+                 AES_FT1( ( Y1 >>  8 ) & 0xFF ) ^   \
+                 AES_FT2( ( Y2 >> 16 ) & 0xFF ) ^   \
+                 AES_FT3( ( Y3 >> 24 ) & 0xFF );    \
                                                 \
-    X1 = *RK++ ^ FT0[ ( Y1       ) & 0xFF ] ^   \
-                 FT1[ ( Y2 >>  8 ) & 0xFF ] ^   \
-                 FT2[ ( Y3 >> 16 ) & 0xFF ] ^   \
-                 FT3[ ( Y0 >> 24 ) & 0xFF ];    \
+    X1 = *RK++ ^ AES_FT0( ( Y1       ) & 0xFF ) ^   \
+                 AES_FT1( ( Y2 >>  8 ) & 0xFF ) ^   \
+                 AES_FT2( ( Y3 >> 16 ) & 0xFF ) ^   \
+                 AES_FT3( ( Y0 >> 24 ) & 0xFF );    \
                                                 \
-    X2 = *RK++ ^ FT0[ ( Y2       ) & 0xFF ] ^   \
-                 FT1[ ( Y3 >>  8 ) & 0xFF ] ^   \
-                 FT2[ ( Y0 >> 16 ) & 0xFF ] ^   \
-                 FT3[ ( Y1 >> 24 ) & 0xFF ];    \
+    X2 = *RK++ ^ AES_FT0( ( Y2       ) & 0xFF ) ^   \
+                 AES_FT1( ( Y3 >>  8 ) & 0xFF ) ^   \
+                 AES_FT2( ( Y0 >> 16 ) & 0xFF ) ^   \
+                 AES_FT3( ( Y1 >> 24 ) & 0xFF );    \
                                                 \
-    X3 = *RK++ ^ FT0[ ( Y3       ) & 0xFF ] ^   \
-                 FT1[ ( Y0 >>  8 ) & 0xFF ] ^   \
-                 FT2[ ( Y1 >> 16 ) & 0xFF ] ^   \
-                 FT3[ ( Y2 >> 24 ) & 0xFF ];    \
+    X3 = *RK++ ^ AES_FT0( ( Y3       ) & 0xFF ) ^   \
+                 AES_FT1( ( Y0 >>  8 ) & 0xFF ) ^   \
+                 AES_FT2( ( Y1 >> 16 ) & 0xFF ) ^   \
+                 AES_FT3( ( Y2 >> 24 ) & 0xFF );    \
 }
 
 #define AES_RROUND(X0,X1,X2,X3,Y0,Y1,Y2,Y3)     \
 {                                               \
-    X0 = *RK++ ^ RT0[ ( Y0       ) & 0xFF ] ^   \
-                 RT1[ ( Y3 >>  8 ) & 0xFF ] ^   \
-                 RT2[ ( Y2 >> 16 ) & 0xFF ] ^   \
-                 RT3[ ( Y1 >> 24 ) & 0xFF ];    \
+    X0 = *RK++ ^ AES_RT0( ( Y0       ) & 0xFF ) ^   \
+                 AES_RT1( ( Y3 >>  8 ) & 0xFF ) ^   \
+                 AES_RT2( ( Y2 >> 16 ) & 0xFF ) ^   \
+                 AES_RT3( ( Y1 >> 24 ) & 0xFF );    \
                                                 \
-    X1 = *RK++ ^ RT0[ ( Y1       ) & 0xFF ] ^   \
-                 RT1[ ( Y0 >>  8 ) & 0xFF ] ^   \
-                 RT2[ ( Y3 >> 16 ) & 0xFF ] ^   \
-                 RT3[ ( Y2 >> 24 ) & 0xFF ];    \
+    X1 = *RK++ ^ AES_RT0( ( Y1       ) & 0xFF ) ^   \
+                 AES_RT1( ( Y0 >>  8 ) & 0xFF ) ^   \
+                 AES_RT2( ( Y3 >> 16 ) & 0xFF ) ^   \
+                 AES_RT3( ( Y2 >> 24 ) & 0xFF );    \
                                                 \
-    X2 = *RK++ ^ RT0[ ( Y2       ) & 0xFF ] ^   \
-                 RT1[ ( Y1 >>  8 ) & 0xFF ] ^   \
-                 RT2[ ( Y0 >> 16 ) & 0xFF ] ^   \
-                 RT3[ ( Y3 >> 24 ) & 0xFF ];    \
+    X2 = *RK++ ^ AES_RT0( ( Y2       ) & 0xFF ) ^   \
+                 AES_RT1( ( Y1 >>  8 ) & 0xFF ) ^   \
+                 AES_RT2( ( Y0 >> 16 ) & 0xFF ) ^   \
+                 AES_RT3( ( Y3 >> 24 ) & 0xFF );    \
                                                 \
-    X3 = *RK++ ^ RT0[ ( Y3       ) & 0xFF ] ^   \
-                 RT1[ ( Y2 >>  8 ) & 0xFF ] ^   \
-                 RT2[ ( Y1 >> 16 ) & 0xFF ] ^   \
-                 RT3[ ( Y0 >> 24 ) & 0xFF ];    \
+    X3 = *RK++ ^ AES_RT0( ( Y3       ) & 0xFF ) ^   \
+                 AES_RT1( ( Y2 >>  8 ) & 0xFF ) ^   \
+                 AES_RT2( ( Y1 >> 16 ) & 0xFF ) ^   \
+                 AES_RT3( ( Y0 >> 24 ) & 0xFF );    \
 }
 
 /*
  * AES-ECB block encryption/decryption
  */
-int aes_crypt_ecb( aes_context *ctx,
+CRYPTO_ITCM int aes_crypt_ecb( aes_context *ctx,
                     int mode,
                     const unsigned char input[16],
                     unsigned char output[16] )
@@ -669,6 +721,18 @@ int aes_crypt_ecb( aes_context *ctx,
     }
 #endif
 
+#if defined(AES_ASM)
+    if( AES_ARM_ALIGNED( input, output, 0 ) )
+    {
+        if( mode == AES_DECRYPT )
+            aes_arm_decrypt( ctx->rk, ctx->nr, input, output );
+        else
+            aes_arm_encrypt( ctx->rk, ctx->nr, input, output );
+
+        return( 0 );
+    }
+#endif
+
     RK = ctx->rk;
 
     GET_ULONG_LE( X0, input,  0 ); X0 ^= *RK++;
@@ -781,6 +845,14 @@ int aes_crypt_cbc( aes_context *ctx,
     }
 #endif
 
+#if defined(AES_ASM)
+    if( mode == AES_DECRYPT && AES_ARM_ALIGNED( iv, input, output ) )
+    {
+        aes_arm_cbc_decrypt( ctx->rk, ctx->nr, iv, input, output, length / 16 );
+        return( 0 );
+    }
+#endif
+
     if( mode == AES_DECRYPT )
     {
         while( length > 0 )
@@ -1,5 +1,6 @@
 
 #define MBEDTLS_BIGNUM_C
 #define POLARSSL_AES_C
+#define POLARSSL_AES_ROM_TABLES
 
 #define MBEDTLS_HAVE_ASM
@@ -0,0 +1,53 @@
+#ifndef TCM_H
+#define TCM_H
+
+//the ARM946E-S runs ITCM and DTCM at full speed without the cache, so the
+//AES round function, the CTR loop, the key schedule and the round tables
+//are placed there. "make CRYPTO_TCM=0" leaves everything in main RAM for
+//comparing in the benchmark suite, host builds always do.
+#if defined(ARM9) && !defined(CRYPTO_TCM_OFF)
+#include <nds/ndstypes.h>
+#define CRYPTO_ITCM ARM_CODE ITCM_CODE
+#define CRYPTO_DTCM DTCM_BSS
+#define CRYPTO_DTCM_DATA DTCM_DATA
+#else
+#define CRYPTO_ITCM
+#define CRYPTO_DTCM
+#define CRYPTO_DTCM_DATA
+#endif
+
+//how many AES tables share the 16 KiB DTCM with the stack
+//  0  none
+//  1  forward S-box and tables, every encrypt and all CTR/CCM
+//  2  reverse ones as well, adds CBC decryption
+//each way is 4.25 KiB with all four T-tables and 1.25 KiB with
+//POLARSSL_AES_FEWER_TABLES, so that layout can afford both
+#ifndef AES_DTCM_TABLES
+#if defined(POLARSSL_AES_FEWER_TABLES)
+#define AES_DTCM_TABLES 2
+#else
+#define AES_DTCM_TABLES 1
+#endif
+#endif
+
+//the ROM tables are initialised data, the generated ones are filled in by
+//aes_gen_tables(), aes.c includes config.h before this
+#if defined(POLARSSL_AES_ROM_TABLES)
+#define AES_DTCM_PLACE CRYPTO_DTCM_DATA
+#else
+#define AES_DTCM_PLACE CRYPTO_DTCM
+#endif
+
+#if AES_DTCM_TABLES >= 1
+#define AES_DTCM_FORWARD AES_DTCM_PLACE
+#else
+#define AES_DTCM_FORWARD
+#endif
+
+#if AES_DTCM_TABLES >= 2
+#define AES_DTCM_REVERSE AES_DTCM_PLACE
+#else
+#define AES_DTCM_REVERSE
+#endif
+
+#endif
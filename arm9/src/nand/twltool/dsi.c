@@ -1,96 +1,162 @@
 #include "dsi.h"
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include "u128_math.h"
+#include "../tcm.h"
 
-void dsi_set_key(dsi_context* ctx, const unsigned char key[16])
+#if defined(AES_ASM)
+#include "../aes_arm.h"
+#endif
+
+// Blocks are handled as four little endian words. Reversing the 16 bytes of
+// a block between the DSi byte order and the aes_crypt_ecb() one is then
+// taking the words back to front and byte swapping each.
+typedef uint32_t __attribute__((may_alias)) dsi_word;
+
+static inline uint32_t dsi_swap(uint32_t x)
 {
-	unsigned char keyswap[16];
-	u128_swap(keyswap, key);
+	return __builtin_bswap32(x);
+}
 
-	aes_setkey_enc(&ctx->aes, keyswap, 128);
+static inline void dsi_load(dsi_word w[4], const void* p)
+{
+	if (((uintptr_t)p & 3) == 0)
+	{
+		const dsi_word* src = (const dsi_word*)p;
+		w[0] = src[0];
+		w[1] = src[1];
+		w[2] = src[2];
+		w[3] = src[3];
+	}
+	else
+		memcpy(w, p, 16);
 }
 
-void dsi_add_ctr(dsi_context* ctx, unsigned int carry)
+static inline void dsi_store(void* p, const dsi_word w[4])
 {
-	unsigned int counter[4];
-	unsigned char *outctr = (unsigned char*)ctx->ctr;
-	int sum;
-	signed int i;
+	if (((uintptr_t)p & 3) == 0)
+	{
+		dsi_word* dst = (dsi_word*)p;
+		dst[0] = w[0];
+		dst[1] = w[1];
+		dst[2] = w[2];
+		dst[3] = w[3];
+	}
+	else
+		memcpy(p, w, 16);
+}
 
-	for (i = 0; i < 4; i++)
-		counter[i] = (outctr[i * 4 + 0] << 24) | (outctr[i * 4 + 1] << 16) |
-			(outctr[i * 4 + 2] <<  8) | (outctr[i * 4 + 3] << 0);
+static inline void dsi_reverse(dsi_word out[4], const dsi_word in[4])
+{
+	uint32_t w0 = in[0], w1 = in[1];
 
-	for (i = 3; i >= 0; i--)
-	{
-		sum = counter[i] + carry;
+	out[0] = dsi_swap(in[3]);
+	out[1] = dsi_swap(in[2]);
+	out[2] = dsi_swap(w1);
+	out[3] = dsi_swap(w0);
+}
+
+void dsi_set_key(dsi_context* ctx, const unsigned char key[16])
+{
+	unsigned char keyswap[16];
+	u128_swap(keyswap, key);
 
-		if (sum < counter[i])
-			carry = 1;
-		else
-			carry = 0;
+	aes_setkey_enc(&ctx->aes, keyswap, 128);
+}
 
-		counter[i] = sum;
-	}
+CRYPTO_ITCM void dsi_add_ctr(dsi_context* ctx, unsigned int carry)
+{
+	dsi_word* ctr = (dsi_word*)ctx->ctr;
+	uint32_t sum;
+	int i;
 
-	for (i = 0; i < 4; i++)
+	// big endian, so the last word is the low one
+	for (i = 3; i >= 0 && carry; i--)
 	{
-		outctr[i * 4 + 0] = counter[i] >> 24;
-		outctr[i * 4 + 1] = counter[i] >> 16;
-		outctr[i * 4 + 2] = counter[i] >> 8;
-		outctr[i * 4 + 3] = counter[i] >> 0;
+		sum = dsi_swap(ctr[i]) + carry;
+		carry = sum < carry;
+		ctr[i] = dsi_swap(sum);
 	}
 }
 
-void dsi_set_ctr(dsi_context* ctx, const unsigned char ctr[16])
+CRYPTO_ITCM void dsi_set_ctr(dsi_context* ctx, const unsigned char ctr[16])
 {
-	int i;
+	uint32_t w[4];
 
-	for (i=0; i<16; i++)
-		ctx->ctr[i] = ctr[15-i];
+	dsi_load(w, ctr);
+	dsi_reverse((dsi_word*)ctx->ctr, w);
 }
 
-void dsi_init_ctr(dsi_context* ctx, const unsigned char key[16], const unsigned char ctr[12])
+void dsi_init_ctr(dsi_context* ctx, const unsigned char key[16], const unsigned char ctr[16])
 {
 	dsi_set_key(ctx, key);
 	dsi_set_ctr(ctx, ctr);
 }
 
-void dsi_crypt_ctr(dsi_context* ctx, const void* in, void* out, unsigned int len)
+// next key stream block in the DSi byte order
+static inline void dsi_ctr_stream(dsi_context* ctx, dsi_word stream[4])
 {
-	unsigned int i;
-	for (i = 0; i < len; i += 0x10)
-		{
-		dsi_crypt_ctr_block(ctx, in+i, out+i);
-		}
+	uint32_t block[4];
+
+	aes_crypt_ecb(&ctx->aes, AES_ENCRYPT, ctx->ctr, (unsigned char*)block);
+	dsi_reverse(stream, block);
+	dsi_add_ctr(ctx, 1);
 }
 
-void dsi_crypt_ctr_block(dsi_context* ctx, const unsigned char input[16], unsigned char output[16])
+static inline void dsi_xor(dsi_word a[4], const dsi_word b[4])
 {
-	int i;
-	unsigned char stream[16];
+	a[0] ^= b[0];
+	a[1] ^= b[1];
+	a[2] ^= b[2];
+	a[3] ^= b[3];
+}
 
+CRYPTO_ITCM void dsi_crypt_ctr(dsi_context* ctx, const void* in, void* out, unsigned int len)
+{
+	const unsigned char* src = in;
+	unsigned char* dst = out;
+	unsigned int blocks = (len + 0x0F) / 0x10;
+	uint32_t stream[4], data[4];
 
-	aes_crypt_ecb(&ctx->aes, AES_ENCRYPT, ctx->ctr, stream);
+#if defined(AES_ASM)
+	if (AES_ARM_ALIGNED(ctx->ctr, in, out))
+	{
+		aes_arm_ctr(ctx->aes.rk, ctx->aes.nr, ctx->ctr, in, out, blocks);
+		return;
+	}
+#endif
 
+	while (blocks--)
+	{
+		dsi_ctr_stream(ctx, stream);
+		dsi_load(data, src);
+		dsi_xor(data, stream);
+		dsi_store(dst, data);
+
+		src += 0x10;
+		dst += 0x10;
+	}
+}
+
+CRYPTO_ITCM void dsi_crypt_ctr_block(dsi_context* ctx, const unsigned char input[16], unsigned char output[16])
+{
+	uint32_t stream[4], data[4];
+
+	dsi_ctr_stream(ctx, stream);
 
 	if (input)
 	{
-		for (i=0; i<16; i++)
-		{
-			output[i] = stream[15-i] ^ input[i];
-		}
+		dsi_load(data, input);
+		dsi_xor(data, stream);
+		dsi_store(output, data);
 	}
 	else
 	{
-		for (i=0; i<16; i++)
-			output[i] = stream[15-i];
+		dsi_store(output, stream);
 	}
-
-	dsi_add_ctr(ctx, 1);
 }
 
 
@@ -134,53 +200,61 @@ void dsi_init_ccm(dsi_context* ctx, unsigned char key[16], unsigned int maclengt
 	dsi_crypt_ctr_block(ctx, 0, ctx->S0);
 }
 
-void dsi_encrypt_ccm_block(dsi_context* ctx, unsigned char input[16], unsigned char output[16], unsigned char* mac)
+// CBC-MAC over one plaintext block in the DSi byte order
+static inline void dsi_ccm_mac(dsi_context* ctx, const dsi_word data[4])
 {
-	int i;
-
-	for (i=0; i<16; i++)
-		ctx->mac[i] ^= input[15-i];
+	uint32_t block[4];
 
+	dsi_reverse(block, data);
+	dsi_xor((dsi_word*)ctx->mac, block);
 	aes_crypt_ecb(&ctx->aes, AES_ENCRYPT, ctx->mac, ctx->mac);
+}
+
+static void dsi_ccm_tag(dsi_context* ctx, unsigned char* mac)
+{
+	uint32_t tag[4];
+
+	dsi_reverse(tag, (const dsi_word*)ctx->mac);
+	dsi_xor(tag, (const dsi_word*)ctx->S0);
+	dsi_store(mac, tag);
+}
+
+void dsi_encrypt_ccm_block(dsi_context* ctx, unsigned char input[16], unsigned char output[16], unsigned char* mac)
+{
+	uint32_t stream[4], data[4];
+
+	dsi_load(data, input);
+	dsi_ccm_mac(ctx, data);
 
 	if (mac)
-	{
-		for (i=0; i<16; i++)
-			mac[i] = ctx->mac[15-i] ^ ctx->S0[i];
-	}
+		dsi_ccm_tag(ctx, mac);
 
 	if (output)
-		dsi_crypt_ctr_block(ctx, input, output);
+	{
+		dsi_ctr_stream(ctx, stream);
+		dsi_xor(data, stream);
+		dsi_store(output, data);
+	}
 }
 
 
 void dsi_decrypt_ccm_block(dsi_context* ctx, unsigned char input[16], unsigned char output[16], unsigned char* mac)
 {
-	int i;
+	uint32_t stream[4], data[4];
 
+	dsi_load(data, input);
 
 	if (output)
 	{
-		dsi_crypt_ctr_block(ctx, input, output);
-
-
-		for (i=0; i<16; i++)
-			ctx->mac[i] ^= output[15-i];
-	}
-	else
-	{
-		for (i=0; i<16; i++)
-			ctx->mac[i] ^= input[15-i];
+		dsi_ctr_stream(ctx, stream);
+		dsi_xor(data, stream);
+		dsi_store(output, data);
 	}
 
-	aes_crypt_ecb(&ctx->aes, AES_ENCRYPT, ctx->mac, ctx->mac);
-
+	dsi_ccm_mac(ctx, data);
 
 	if (mac)
-	{
-		for (i=0; i<16; i++)
-			mac[i] = ctx->mac[15-i] ^ ctx->S0[i];
-	}
+		dsi_ccm_tag(ctx, mac);
 }
 
 
@@ -188,16 +262,19 @@ void dsi_decrypt_ccm(dsi_context* ctx, unsigned char* input, unsigned char* outp
 {
 	unsigned char block[16];
 	unsigned char ctr[16];
+	uint32_t stream[4], data[4];
 
+	// whole blocks, the tag is only needed after the last one
 	while (size > 16)
 	{
-		dsi_decrypt_ccm_block(ctx, input, output, mac);
-
-		if (input)
-			input += 16;
-		if (output)
-			output += 16;
-
+		dsi_load(data, input);
+		dsi_ctr_stream(ctx, stream);
+		dsi_xor(data, stream);
+		dsi_store(output, data);
+		dsi_ccm_mac(ctx, data);
+
+		input += 16;
+		output += 16;
 		size -= 16;
 	}
 
@@ -216,16 +293,18 @@ void dsi_decrypt_ccm(dsi_context* ctx, unsigned char* input, unsigned char* outp
 void dsi_encrypt_ccm(dsi_context* ctx, unsigned char* input, unsigned char* output, unsigned int size, unsigned char* mac)
 {
 	unsigned char block[16];
+	uint32_t stream[4], data[4];
 
 	while (size > 16)
 	{
-		dsi_encrypt_ccm_block(ctx, input, output, mac);
-
-		if (input)
-			input += 16;
-		if (output)
-			output += 16;
-
+		dsi_load(data, input);
+		dsi_ccm_mac(ctx, data);
+		dsi_ctr_stream(ctx, stream);
+		dsi_xor(data, stream);
+		dsi_store(output, data);
+
+		input += 16;
+		output += 16;
 		size -= 16;
 	}
 
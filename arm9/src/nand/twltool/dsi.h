@@ -5,9 +5,11 @@
 
 typedef struct
 {
-	unsigned char ctr[16];
-	unsigned char mac[16];
-	unsigned char S0[16];
+	// counter and CBC-MAC state in the byte order aes_crypt_ecb() takes, which
+	// is the reverse of the DSi one, aligned so dsi.c can work on words
+	unsigned char ctr[16] __attribute__((aligned(4)));
+	unsigned char mac[16] __attribute__((aligned(4)));
+	unsigned char S0[16] __attribute__((aligned(4)));
 	unsigned int maclen;
 
 	aes_context aes;
@@ -33,7 +35,7 @@ void dsi_add_ctr(dsi_context* ctx, unsigned int carry);
 
 void dsi_set_ctr(dsi_context* ctx, const unsigned char ctr[16]);
 
-void dsi_init_ctr(dsi_context* ctx, const unsigned char key[16], const unsigned char ctr[12]);
+void dsi_init_ctr(dsi_context* ctx, const unsigned char key[16], const unsigned char ctr[16]);
 
 void dsi_crypt_ctr(dsi_context* ctx, const void* in, void* out, unsigned int len);
 
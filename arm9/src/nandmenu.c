@@ -0,0 +1,497 @@
+#include "main.h"
+#include "menu.h"
+#include "message.h"
+#include "progress.h"
+#include "task.h"
+#include "storage.h"
+#include "nand/nandio.h"
+#include <sys/stat.h>
+
+//raw encrypted NAND image with a CRC32 per extent, so later backups and
+//restores only move the extents that changed
+#define NAND_IMAGE_PATH BACKUP_PATH "/nand.bin"
+#define NAND_INDEX_PATH BACKUP_PATH "/nand.idx"
+#define NAND_INDEX_MAGIC 0x58494E54 // 'TNIX'
+#define NAND_EXTENT_SECTORS 64
+
+enum {
+	NAND_MENU_BACKUP,
+	NAND_MENU_RESTORE,
+	NAND_MENU_ROLLBACK,
+	NAND_MENU_BACK
+};
+
+typedef struct {
+	u32 magic;
+	u32 totalSectors;
+	u32 extentSectors;
+	u32 extentCount;
+	u8 consoleID[8];
+	u32 complete;
+} NandIndex;
+
+static u32 crcTable[256];
+
+static void backupNand();
+static void restoreNand();
+static void rollbackNand();
+
+void nandMenu()
+{
+	while (!programEnd)
+	{
+		clearScreen(&topScreen);
+		iprintf("\x1B[32mNAND image\n\x1B[47m");
+		iprintf("\nImage: %s\n", NAND_IMAGE_PATH);
+		if (access(NAND_IMAGE_PATH, F_OK) == 0)
+		{
+			iprintf("Size: ");
+			printBytes(getFileSizePath(NAND_IMAGE_PATH));
+			iprintf("\n");
+		}
+		else
+		{
+			iprintf("\x1B[33mNo image yet.\n\x1B[47m");
+		}
+
+		iprintf("\nSession journal: %s\n", nandio_journal_exists() ? "yes" : "none");
+
+		Menu* m = newMenu();
+		setMenuHeader(m, "NAND IMAGE");
+		addMenuItem(m, "Backup NAND", NULL, 0);
+		addMenuItem(m, "Restore NAND", NULL, 0);
+		addMenuItem(m, "Roll back last session", NULL, 0);
+		addMenuItem(m, "Back - [B]", NULL, 0);
+		printMenu(m);
+
+		int result = -1;
+		while (!programEnd)
+		{
+			swiWaitForVBlank();
+			scanKeys();
+
+			if (moveCursor(m))
+				printMenu(m);
+
+			if (keysDown() & KEY_B)
+				break;
+
+			else if (keysDown() & KEY_A)
+			{
+				result = m->cursor;
+				break;
+			}
+		}
+
+		freeMenu(m);
+
+		switch (result)
+		{
+			case NAND_MENU_BACKUP:
+				backupNand();
+				break;
+
+			case NAND_MENU_RESTORE:
+				restoreNand();
+				break;
+
+			case NAND_MENU_ROLLBACK:
+				rollbackNand();
+				break;
+
+			default:
+				return;
+		}
+	}
+}
+
+static u32 _crc32(u8 const* data, u32 len)
+{
+	if (crcTable[1] == 0)
+	{
+		for (u32 i = 0; i < 256; i++)
+		{
+			u32 c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+			crcTable[i] = c;
+		}
+	}
+
+	u32 crc = 0xFFFFFFFF;
+	while (len--)
+		crc = crcTable[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+static u32* _loadIndex(NandIndex* idx)
+{
+	FILE* f = fopen(NAND_INDEX_PATH, "rb");
+	if (!f) return NULL;
+
+	u32* crcs = NULL;
+
+	if (fread(idx, sizeof(NandIndex), 1, f) == 1 && idx->magic == NAND_INDEX_MAGIC &&
+		idx->extentSectors == NAND_EXTENT_SECTORS &&
+		idx->extentCount == (idx->totalSectors + NAND_EXTENT_SECTORS - 1) / NAND_EXTENT_SECTORS)
+	{
+		crcs = (u32*)malloc(idx->extentCount * sizeof(u32));
+		if (crcs && fread(crcs, sizeof(u32), idx->extentCount, f) != idx->extentCount)
+		{
+			free(crcs);
+			crcs = NULL;
+		}
+	}
+
+	fclose(f);
+	return crcs;
+}
+
+static bool _saveIndex(NandIndex const* idx, u32 const* crcs)
+{
+	FILE* f = fopen(NAND_INDEX_PATH, "wb");
+	if (!f) return false;
+
+	bool result = fwrite(idx, sizeof(NandIndex), 1, f) == 1 &&
+				  fwrite(crcs, sizeof(u32), idx->extentCount, f) == idx->extentCount;
+
+	fclose(f);
+	return result;
+}
+
+//the image has to belong to this console and be complete
+static bool _indexMatches(NandIndex const* idx, u32 totalSectors)
+{
+	u8 consoleID[8];
+	getConsoleID(consoleID);
+
+	return idx->totalSectors == totalSectors && idx->complete &&
+		   memcmp(idx->consoleID, consoleID, sizeof(consoleID)) == 0 &&
+		   getFileSizePath(NAND_IMAGE_PATH) == (unsigned long long)totalSectors * 512;
+}
+
+static inline u32 _extentLength(NandIndex const* idx, u32 extent)
+{
+	u32 start = extent * NAND_EXTENT_SECTORS;
+	return (idx->totalSectors - start < NAND_EXTENT_SECTORS) ? idx->totalSectors - start : NAND_EXTENT_SECTORS;
+}
+
+static void backupNand()
+{
+	if (choiceBox("Backup the NAND to SD?\n\nOnly changed parts of an\nearlier image are copied.") == NO)
+		return;
+
+	u32 totalSectors = nand_GetSize();
+
+	NandIndex idx;
+	u32* crcs = _loadIndex(&idx);
+	bool incremental = crcs && _indexMatches(&idx, totalSectors);
+
+	if (!incremental)
+	{
+		free(crcs);
+
+		memset(&idx, 0, sizeof(idx));
+		idx.magic = NAND_INDEX_MAGIC;
+		idx.totalSectors = totalSectors;
+		idx.extentSectors = NAND_EXTENT_SECTORS;
+		idx.extentCount = (totalSectors + NAND_EXTENT_SECTORS - 1) / NAND_EXTENT_SECTORS;
+		getConsoleID(idx.consoleID);
+
+		crcs = (u32*)calloc(idx.extentCount, sizeof(u32));
+
+		if (getSDCardFree() < (unsigned long long)totalSectors * 512)
+		{
+			free(crcs);
+			messageBox("Not enough space on SD.");
+			return;
+		}
+	}
+
+	//create subdirectories
+	{
+		char backupPath[sizeof(BACKUP_PATH)];
+		strcpy(backupPath, BACKUP_PATH);
+		for (char *slash = strchr(backupPath, '/'); slash; slash = strchr(slash + 1, '/'))
+		{
+			char temp = *slash;
+			*slash = '\0';
+			mkdir(backupPath, 0777);
+			*slash = temp;
+		}
+		mkdir(backupPath, 0777);
+	}
+
+	u8* buffer = (u8*)memalign(32, NAND_EXTENT_SECTORS * 512);
+	FILE* image = fopen(NAND_IMAGE_PATH, incremental ? "r+b" : "wb");
+
+	//the index is only trusted again once the image matches it
+	idx.complete = 0;
+
+	if (!crcs || !buffer || !image || !_saveIndex(&idx, crcs))
+	{
+		if (image) fclose(image);
+		free(buffer);
+		free(crcs);
+		messageBox("\x1B[31mFailed to create NAND image.\n\x1B[47m");
+		return;
+	}
+
+	clearScreen(&bottomScreen);
+	iprintf("Backing up NAND...\n");
+	iprintf("%s\n", incremental ? "Copying changed extents." : "Copying full image.");
+	iprintf("Cancel - hold [B]\n");
+
+	//the raw reads below must see everything libfat wrote
+	nandio_flush();
+
+	bool result = true;
+	u32 copied = 0;
+
+	taskBegin(true);
+	progressStart(idx.extentCount, false);
+
+	for (u32 i = 0; i < idx.extentCount && !taskYield(); i++)
+	{
+		u32 start = i * NAND_EXTENT_SECTORS;
+		u32 len = _extentLength(&idx, i);
+
+		if (!nand_ReadSectors(start, len, buffer))
+		{
+			result = false;
+			break;
+		}
+
+		u32 crc = _crc32(buffer, len * 512);
+
+		if (!incremental || crc != crcs[i])
+		{
+			if (fseek(image, start * 512, SEEK_SET) != 0 || fwrite(buffer, 512, len, image) != len)
+			{
+				result = false;
+				break;
+			}
+
+			crcs[i] = crc;
+			copied++;
+		}
+
+		progressSet(i + 1);
+	}
+
+	progressEnd();
+	consoleSelect(&bottomScreen);
+
+	bool cancelled = taskEnd();
+
+	fclose(image);
+	free(buffer);
+
+	if (result && !programEnd && !cancelled)
+	{
+		idx.complete = 1;
+		result = _saveIndex(&idx, crcs);
+	}
+
+	free(crcs);
+
+	if (cancelled)
+	{
+		messagePrint("\x1B[33m\nNAND backup cancelled.\n\x1B[47m");
+	}
+	else if (!result || programEnd)
+	{
+		messagePrint("\x1B[31m\nNAND backup failed.\n\x1B[47m");
+	}
+	else
+	{
+		iprintf("\n%lu of %lu extents copied.\n", copied, idx.extentCount);
+		messagePrint("\x1B[42m\nNAND backup finished.\n\x1B[47m");
+	}
+}
+
+static void restoreNand()
+{
+	NandIndex idx;
+	u32* crcs = _loadIndex(&idx);
+
+	if (!crcs || !_indexMatches(&idx, nand_GetSize()))
+	{
+		free(crcs);
+		messageBox("\x1B[31mNo complete NAND image of this\nconsole was found.\n\x1B[47m");
+		return;
+	}
+
+	if (choiceBox("\x1B[41mWARNING:\x1B[47m Restoring replaces the\nwhole NAND with the image.\n\nThe console shuts down after.\n\nContinue?") == NO)
+	{
+		free(crcs);
+		return;
+	}
+
+	//check battery level
+	while (batteryLevel < 7 && !charging)
+	{
+		if (choiceBox("\x1B[47mBattery is too low!\nPlease plug in the console.\n\nContinue?") == NO)
+		{
+			free(crcs);
+			return;
+		}
+	}
+
+	if (!nandio_unlock_writing())
+	{
+		free(crcs);
+		return;
+	}
+
+	u8* buffer = (u8*)memalign(32, NAND_EXTENT_SECTORS * 512);
+	u8* dirty = (u8*)calloc((idx.extentCount + 7) / 8, 1);
+	FILE* image = fopen(NAND_IMAGE_PATH, "rb");
+
+	bool result = buffer && dirty && image;
+	u32 changed = 0;
+
+	clearScreen(&bottomScreen);
+	iprintf("Comparing NAND with image...\n");
+	iprintf("Cancel - hold [B]\n");
+
+	nandio_flush();
+
+	//nothing is written until every extent to restore has been checked,
+	//so only this part can be cancelled
+	taskBegin(true);
+	progressStart(idx.extentCount, false);
+
+	for (u32 i = 0; result && i < idx.extentCount && !taskYield(); i++)
+	{
+		u32 start = i * NAND_EXTENT_SECTORS;
+		u32 len = _extentLength(&idx, i);
+
+		if (!nand_ReadSectors(start, len, buffer))
+		{
+			result = false;
+			break;
+		}
+
+		if (_crc32(buffer, len * 512) != crcs[i])
+		{
+			if (fseek(image, start * 512, SEEK_SET) != 0 || fread(buffer, 512, len, image) != len ||
+				_crc32(buffer, len * 512) != crcs[i])
+			{
+				iprintf("\x1B[31mImage is damaged at sector %lu.\n\x1B[47m", start);
+				result = false;
+				break;
+			}
+
+			dirty[i / 8] |= BIT(i % 8);
+			changed++;
+		}
+
+		progressSet(i + 1);
+	}
+
+	progressEnd();
+	consoleSelect(&bottomScreen);
+
+	bool cancelled = taskEnd();
+
+	if (result && !programEnd && !cancelled && changed == 0)
+	{
+		fclose(image);
+		free(dirty);
+		free(buffer);
+		free(crcs);
+		nandio_lock_writing();
+		messagePrint("\x1B[42m\nNAND already matches the image.\n\x1B[47m");
+		return;
+	}
+
+	u32 failed = 0;
+	bool written = false;
+
+	if (result && !programEnd && !cancelled)
+	{
+		written = true;
+		iprintf("Restoring %lu of %lu extents...\n", changed, idx.extentCount);
+
+		progressStart(changed, false);
+
+		for (u32 i = 0; i < idx.extentCount; i++)
+		{
+			if (!(dirty[i / 8] & BIT(i % 8)))
+				continue;
+
+			u32 start = i * NAND_EXTENT_SECTORS;
+			u32 len = _extentLength(&idx, i);
+
+			bool ok = false;
+			for (int attempt = 0; attempt < 2 && !ok; attempt++)
+			{
+				ok = fseek(image, start * 512, SEEK_SET) == 0 && fread(buffer, 512, len, image) == len &&
+					 _crc32(buffer, len * 512) == crcs[i] &&
+					 nandio_write_raw_sectors(start, len, buffer) &&
+					 nand_ReadSectors(start, len, buffer) &&
+					 _crc32(buffer, len * 512) == crcs[i];
+			}
+
+			if (!ok)
+			{
+				iprintf("\x1B[31mFailed at sector %lu.\n\x1B[47m", start);
+				failed++;
+			}
+
+			progressAdd(1);
+		}
+
+		progressEnd();
+		consoleSelect(&bottomScreen);
+	}
+
+	if (image) fclose(image);
+	free(dirty);
+	free(buffer);
+	free(crcs);
+
+	nandio_lock_writing();
+
+	if (cancelled)
+	{
+		messagePrint("\x1B[33m\nNAND restore cancelled.\nNothing was written.\n\x1B[47m");
+	}
+	else if (!written)
+	{
+		messagePrint("\x1B[31m\nNAND restore failed.\nNothing was written.\n\x1B[47m");
+	}
+	else if (failed > 0)
+	{
+		messagePrint("\x1B[31m\nNAND restore failed.\nRun it again before rebooting.\n\x1B[47m");
+	}
+	else
+	{
+		//the mounted filesystem no longer matches the NAND
+		messagePrint("\x1B[42m\nNAND restore finished.\n\x1B[47mThe console will now shut down.\n");
+		programEnd = true;
+	}
+}
+
+//undoes the writes of the last unlocked session from the SD journal
+static void rollbackNand()
+{
+	if (!nandio_journal_exists())
+	{
+		messageBox("\x1B[33mNo NAND session to roll back.\n\x1B[47m");
+		return;
+	}
+
+	if (choiceBox("\x1B[41mWARNING:\x1B[47m This undoes every NAND\nwrite since writing was last\nunlocked.\n\nThe console shuts down after.\n\nContinue?") == NO)
+		return;
+
+	clearScreen(&bottomScreen);
+	iprintf("Rolling back...\n");
+
+	if (nandio_rollback_journal())
+		messagePrint("\x1B[42m\nSession rolled back.\n\x1B[47mThe console will now shut down.\n");
+	else
+		messagePrint("\x1B[31m\nRollback failed.\n\x1B[47m");
+}
@@ -0,0 +1,289 @@
+#include "profiler.h"
+#include "main.h"
+#include "version.h"
+#include <ctype.h>
+#include <malloc.h>
+#include <sys/stat.h>
+
+#define PROFILE_TIMER 0
+#define PROFILE_SHIFT 2
+
+#define MAIN_BASE 0x02000000
+#define MAIN_SIZE 0x00100000
+#define ITCM_BASE 0x01FF8000
+#define ITCM_SIZE 0x00008000
+
+#define MAIN_BUCKETS (MAIN_SIZE >> PROFILE_SHIFT)
+#define ITCM_BUCKETS (ITCM_SIZE >> PROFILE_SHIFT)
+
+typedef struct {
+	u32 addr;
+	u32 samples;
+	char name[40];
+} Symbol;
+
+//from the libnds linker script, the BIOS IRQ handler pushes r0-r3, r12 and
+//lr here before anything else
+extern u32 __sp_irq[];
+
+static u32* mainBuckets = NULL;
+static u32* itcmBuckets = NULL;
+static vu32 samples = 0;
+static vu32 other = 0;
+static bool running = false;
+
+static void _sample()
+{
+	//lr is the interrupted instruction + 4. an IRQ arriving inside another
+	//handler is counted against the code that handler interrupted
+	u32 pc = __sp_irq[-1] - 4;
+
+	if (pc - MAIN_BASE < MAIN_SIZE)
+		mainBuckets[(pc - MAIN_BASE) >> PROFILE_SHIFT]++;
+	else if (pc - ITCM_BASE < ITCM_SIZE)
+		itcmBuckets[(pc - ITCM_BASE) >> PROFILE_SHIFT]++;
+	else
+		other++;
+
+	samples++;
+}
+
+bool profilerStart()
+{
+	if (running)
+		return true;
+
+	if (!mainBuckets)
+		mainBuckets = (u32*)malloc(MAIN_BUCKETS * sizeof(u32));
+
+	if (!itcmBuckets)
+		itcmBuckets = (u32*)malloc(ITCM_BUCKETS * sizeof(u32));
+
+	if (!mainBuckets || !itcmBuckets)
+	{
+		free(mainBuckets);
+		free(itcmBuckets);
+		mainBuckets = itcmBuckets = NULL;
+		return false;
+	}
+
+	memset(mainBuckets, 0, MAIN_BUCKETS * sizeof(u32));
+	memset(itcmBuckets, 0, ITCM_BUCKETS * sizeof(u32));
+	samples = 0;
+	other = 0;
+
+	timerStart(PROFILE_TIMER, ClockDivider_64, TIMER_FREQ_64(PROFILE_HZ), _sample);
+	running = true;
+
+	return true;
+}
+
+void profilerStop()
+{
+	if (!running)
+		return;
+
+	timerStop(PROFILE_TIMER);
+	irqDisable(IRQ_TIMER(PROFILE_TIMER));
+	running = false;
+}
+
+bool profilerRunning()
+{
+	return running;
+}
+
+u32 profilerSamples()
+{
+	return samples;
+}
+
+//"  0x02001234    name" lines, section and assignment lines are skipped
+static bool _parseSymbol(char* line, Symbol* sym)
+{
+	char* p = line;
+	while (*p == ' ')
+		p++;
+
+	if (p == line || strncmp(p, "0x", 2) != 0)
+		return false;
+
+	char* end;
+	sym->addr = strtoul(p, &end, 16);
+	if (end == p + 2 || *end != ' ')
+		return false;
+
+	while (*end == ' ')
+		end++;
+
+	if (!isalpha((unsigned char)*end) && *end != '_')
+		return false;
+
+	char* name = end;
+	while (*end && !isspace((unsigned char)*end))
+		end++;
+
+	int len = end - name;
+
+	while (*end && isspace((unsigned char)*end))
+		end++;
+
+	if (*end)
+		return false;
+
+	if (len >= sizeof(sym->name))
+		len = sizeof(sym->name) - 1;
+
+	memcpy(sym->name, name, len);
+	sym->name[len] = '\0';
+	sym->samples = 0;
+
+	return true;
+}
+
+static int _byAddr(void const* a, void const* b)
+{
+	u32 x = ((Symbol const*)a)->addr;
+	u32 y = ((Symbol const*)b)->addr;
+	return (x > y) - (x < y);
+}
+
+static int _bySamples(void const* a, void const* b)
+{
+	u32 x = ((Symbol const*)a)->samples;
+	u32 y = ((Symbol const*)b)->samples;
+	return (x < y) - (x > y);
+}
+
+static void _attribute(Symbol* syms, int count, u32 pc, u32 n)
+{
+	int lo = 0;
+	int hi = count - 1;
+	int found = -1;
+
+	while (lo <= hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (syms[mid].addr <= pc)
+		{
+			found = mid;
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid - 1;
+		}
+	}
+
+	if (found >= 0)
+		syms[found].samples += n;
+}
+
+//per function totals using the linker map, if one was copied to SD
+static bool _dumpFunctions(u32 total)
+{
+	FILE* map = fopen(PROFILE_MAP_PATH, "r");
+	if (!map) return false;
+
+	int capacity = 1024;
+	int count = 0;
+	Symbol* syms = (Symbol*)malloc(capacity * sizeof(Symbol));
+
+	char line[256];
+	while (syms && fgets(line, sizeof(line), map))
+	{
+		if (count == capacity)
+		{
+			capacity *= 2;
+			Symbol* grown = (Symbol*)realloc(syms, capacity * sizeof(Symbol));
+			if (!grown)
+				break;
+			syms = grown;
+		}
+
+		if (_parseSymbol(line, &syms[count]))
+			count++;
+	}
+
+	fclose(map);
+
+	if (!syms || count == 0)
+	{
+		free(syms);
+		return false;
+	}
+
+	qsort(syms, count, sizeof(Symbol), _byAddr);
+
+	for (u32 i = 0; i < MAIN_BUCKETS; i++)
+	{
+		if (mainBuckets[i])
+			_attribute(syms, count, MAIN_BASE + (i << PROFILE_SHIFT), mainBuckets[i]);
+	}
+
+	for (u32 i = 0; i < ITCM_BUCKETS; i++)
+	{
+		if (itcmBuckets[i])
+			_attribute(syms, count, ITCM_BASE + (i << PROFILE_SHIFT), itcmBuckets[i]);
+	}
+
+	qsort(syms, count, sizeof(Symbol), _bySamples);
+
+	FILE* f = fopen(PROFILE_SYM_PATH, "w");
+	if (f)
+	{
+		fprintf(f, "# TDT %s, %lu samples at %d Hz\n", VERSION, total, PROFILE_HZ);
+		fprintf(f, "# static functions are counted in the symbol before them\n");
+
+		for (int i = 0; i < count && syms[i].samples > 0; i++)
+			fprintf(f, "%8lu %6.2f%%  %s\n", syms[i].samples, syms[i].samples * 100.f / total, syms[i].name);
+
+		fclose(f);
+	}
+
+	free(syms);
+	return f != NULL;
+}
+
+bool profilerDump()
+{
+	profilerStop();
+
+	if (!mainBuckets || !itcmBuckets)
+		return false;
+
+	mkdir("sd:/_nds", 0777);
+	mkdir("sd:/_nds/TADDeliveryTool", 0777);
+
+	FILE* f = fopen(PROFILE_PATH, "w");
+	if (!f) return false;
+
+	u32 total = samples;
+
+	//one "address count" line per bucket, tools/profiler turns it into a report
+	fprintf(f, "# TDT %s\n", VERSION);
+	fprintf(f, "# hz %d samples %lu other %lu bucket %d\n", PROFILE_HZ, total, (u32)other, 1 << PROFILE_SHIFT);
+
+	for (u32 i = 0; i < ITCM_BUCKETS; i++)
+	{
+		if (itcmBuckets[i])
+			fprintf(f, "%08lx %lu\n", ITCM_BASE + (i << PROFILE_SHIFT), itcmBuckets[i]);
+	}
+
+	for (u32 i = 0; i < MAIN_BUCKETS; i++)
+	{
+		if (mainBuckets[i])
+			fprintf(f, "%08lx %lu\n", MAIN_BASE + (i << PROFILE_SHIFT), mainBuckets[i]);
+	}
+
+	fclose(f);
+
+	if (total > 0)
+		_dumpFunctions(total);
+
+	free(mainBuckets);
+	free(itcmBuckets);
+	mainBuckets = itcmBuckets = NULL;
+
+	return true;
+}
@@ -0,0 +1,21 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <nds/ndstypes.h>
+
+//timer 0 sampling profiler, the interrupted PC is counted in a histogram
+//of 4 byte buckets over the code in main RAM and ITCM. copy arm9/build/TDT.map
+//to PROFILE_MAP_PATH to also get a per function summary on SD
+#define PROFILE_PATH     "sd:/_nds/TADDeliveryTool/profile.txt"
+#define PROFILE_SYM_PATH "sd:/_nds/TADDeliveryTool/profile_functions.txt"
+#define PROFILE_MAP_PATH "sd:/_nds/TADDeliveryTool/TDT.map"
+#define PROFILE_HZ       4000
+
+bool profilerStart();
+void profilerStop();
+bool profilerRunning();
+u32 profilerSamples();
+
+bool profilerDump();
+
+#endif
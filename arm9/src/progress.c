@@ -0,0 +1,210 @@
+#include "progress.h"
+#include "main.h"
+#include <string.h>
+
+#define PROGRESS_TEXT_ROW 22
+#define PROGRESS_BAR_ROW  23
+#define PROGRESS_COLS     32
+#define PROGRESS_BARS     30
+
+//the rate is taken over the last few samples, one every half second
+#define PROGRESS_FPS      60
+#define PROGRESS_SAMPLE   30
+#define PROGRESS_WINDOW   4
+
+//only the worker writes the count and an aligned word store is atomic,
+//so the interrupt can read it at any time
+static vu32 progressDone = 0;
+static u32 progressTotal = 0;
+static bool progressBytes = false;
+static volatile bool active = false;
+
+static u16 greenPal = 0;
+static u16 whitePal = 0;
+
+//what is on screen, so only the cells that change are written
+static int shownBars = 0;
+static char shownText[PROGRESS_COLS];
+
+static u32 frames = 0;
+static u32 sampleDone[PROGRESS_WINDOW];
+static u32 sampleFrame[PROGRESS_WINDOW];
+static int sampleCount = 0;
+static u32 rate = 0;
+
+//straight to the tilemap, the console cursor and colour are left alone
+static void _putCell(int col, int row, char c, u16 pal)
+{
+	PrintConsole* con = &topScreen;
+	int index = (con->windowX + col) + (con->windowY + row) * con->consoleWidth;
+
+	con->fontBgMap[index] = pal | (u16)(c + con->fontCharOffset - con->font.asciiOffset);
+}
+
+static void _clearRow(int row)
+{
+	for (int i = 0; i < PROGRESS_COLS; i++)
+		_putCell(i, row, ' ', whitePal);
+}
+
+//right aligned, no printf in an interrupt
+static void _number(char* out, int width, u32 value, char pad)
+{
+	for (int i = width - 1; i >= 0; i--)
+	{
+		out[i] = (i == width - 1 || value) ? '0' + value % 10 : pad;
+		value /= 10;
+	}
+}
+
+static void _sample(u32 done)
+{
+	if (sampleCount == PROGRESS_WINDOW)
+	{
+		for (int i = 1; i < PROGRESS_WINDOW; i++)
+		{
+			sampleDone[i - 1] = sampleDone[i];
+			sampleFrame[i - 1] = sampleFrame[i];
+		}
+
+		sampleCount--;
+	}
+
+	sampleDone[sampleCount] = done;
+	sampleFrame[sampleCount] = frames;
+	sampleCount++;
+
+	u32 span = frames - sampleFrame[0];
+	if (span > 0)
+		rate = (u64)(done - sampleDone[0]) * PROGRESS_FPS / span;
+}
+
+static void _drawBar(u32 done)
+{
+	int bars = (progressTotal == 0) ? PROGRESS_BARS : (int)((u64)done * PROGRESS_BARS / progressTotal);
+
+	for (; shownBars < bars; shownBars++)
+		_putCell(1 + shownBars, PROGRESS_BAR_ROW, '|', greenPal);
+}
+
+//" 57%   2345 KiB/s  ETA 01:23"
+static void _drawText(u32 done)
+{
+	char text[PROGRESS_COLS];
+	memset(text, ' ', sizeof(text));
+
+	u32 percent = (progressTotal == 0) ? 100 : (u32)((u64)done * 100 / progressTotal);
+	_number(text + 1, 3, percent, ' ');
+	text[4] = '%';
+
+	if (progressBytes)
+	{
+		if (sampleCount > 1)
+		{
+			u32 kbps = rate / 1024;
+			_number(text + 7, 5, (kbps > 99999) ? 99999 : kbps, ' ');
+		}
+		else
+			text[11] = '-';
+
+		memcpy(text + 13, "KiB/s", 5);
+	}
+
+	memcpy(text + 20, "ETA ", 4);
+
+	u32 seconds = (rate == 0) ? 0 : (progressTotal - done) / rate;
+	if (rate == 0 || seconds > 99 * 60 + 59)
+		memcpy(text + 24, "--:--", 5);
+	else
+	{
+		_number(text + 24, 2, seconds / 60, '0');
+		text[26] = ':';
+		_number(text + 27, 2, seconds % 60, '0');
+	}
+
+	for (int i = 0; i < PROGRESS_COLS; i++)
+	{
+		if (text[i] != shownText[i])
+		{
+			_putCell(i, PROGRESS_TEXT_ROW, text[i], whitePal);
+			shownText[i] = text[i];
+		}
+	}
+}
+
+static void _vblank()
+{
+	if (!active)
+		return;
+
+	u32 done = progressDone;
+	if (done > progressTotal)
+		done = progressTotal;
+
+	frames++;
+	if (frames % PROGRESS_SAMPLE == 0)
+		_sample(done);
+
+	_drawBar(done);
+	_drawText(done);
+}
+
+void progressInit()
+{
+	//the palette bits the console uses for green and white
+	PrintConsole* old = consoleSelect(&topScreen);
+	u16 pal = topScreen.fontCurPal;
+
+	iprintf("\x1B[42m");
+	greenPal = topScreen.fontCurPal;
+	iprintf("\x1B[47m");
+	whitePal = topScreen.fontCurPal;
+
+	topScreen.fontCurPal = pal;
+	consoleSelect(old);
+
+	irqSet(IRQ_VBLANK, _vblank);
+	irqEnable(IRQ_VBLANK);
+}
+
+void progressStart(u32 total, bool bytes)
+{
+	active = false;
+
+	progressDone = 0;
+	progressTotal = total;
+	progressBytes = bytes;
+
+	frames = 0;
+	sampleCount = 0;
+	rate = 0;
+	_sample(0);
+
+	shownBars = 0;
+	memset(shownText, ' ', sizeof(shownText));
+
+	_clearRow(PROGRESS_TEXT_ROW);
+	_clearRow(PROGRESS_BAR_ROW);
+	_putCell(0, PROGRESS_BAR_ROW, '[', greenPal);
+	_putCell(PROGRESS_COLS - 1, PROGRESS_BAR_ROW, ']', greenPal);
+
+	active = true;
+}
+
+void progressSet(u32 done)
+{
+	progressDone = done;
+}
+
+void progressAdd(u32 count)
+{
+	progressDone += count;
+}
+
+void progressEnd()
+{
+	active = false;
+
+	_clearRow(PROGRESS_TEXT_ROW);
+	_clearRow(PROGRESS_BAR_ROW);
+}
@@ -0,0 +1,17 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <nds/ndstypes.h>
+
+//progress bar on the bottom two rows of the top screen, drawn from the
+//vblank interrupt so the copy and decrypt loops only bump a counter
+void progressInit();
+
+//total is in bytes when bytes is set, which also shows the throughput,
+//otherwise it counts items
+void progressStart(u32 total, bool bytes);
+void progressSet(u32 done);
+void progressAdd(u32 count);
+void progressEnd();
+
+#endif
@@ -1,4 +1,5 @@
 #include "rom.h"
+#include "lz.h"
 #include "main.h"
 #include "storage.h"
 #include "tad.h"
@@ -7,10 +8,43 @@
 #include <malloc.h>
 #include <stdio.h>
 
+//a .tlz backup is read as the rom it holds, one block at a time
+static bool _isBackup(char const* fpath)
+{
+	char const* extension = strrchr(fpath, '.');
+	return extension && strcasecmp(extension, ".tlz") == 0;
+}
+
+static void* _readBackup(char const* fpath, u32 offset, u32 size)
+{
+	LzReader lz;
+	if (lzOpen(&lz, fpath) != 0)
+		return NULL;
+
+	void* out = malloc(size);
+
+	if (out && !lzRead(&lz, offset, out, size))
+	{
+		free(out);
+		out = NULL;
+	}
+
+	lzClose(&lz);
+	return out;
+}
+
+static unsigned long long _getFileSize(char const* fpath, bool backup)
+{
+	return backup ? lzGetRawSize(fpath) : getFileSizePath(fpath);
+}
+
 tDSiHeader* getRomHeader(char const* fpath)
 {
 	if (!fpath) return NULL;
 
+	if (_isBackup(fpath))
+		return (tDSiHeader*)_readBackup(fpath, 0, sizeof(tDSiHeader));
+
 	tDSiHeader* h = NULL;
 	FILE* f = fopen(fpath, "rb");
 
@@ -37,7 +71,12 @@ tNDSBanner* getRomBanner(char const* fpath)
 	tDSiHeader* h = getRomHeader(fpath);
 	tNDSBanner* b = NULL;
 
-	if (h)
+	if (h && _isBackup(fpath))
+	{
+		b = (tNDSBanner*)_readBackup(fpath, h->ndshdr.bannerOffset, sizeof(tNDSBanner));
+		free(h);
+	}
+	else if (h)
 	{
 		FILE* f = fopen(fpath, "rb");
 
@@ -211,27 +250,28 @@ void printRomInfo(char const* fpath)
 		//print full file path
 		iprintf("\n%s\n", fpath);
 
-		//print extra files
+		//print extra files, a backup keeps them compressed beside it
+		bool backup = _isBackup(fpath);
 		int extensionPos = strrchr(fpath, '.') - fpath;
 		char temp[PATH_MAX];
 		strcpy(temp, fpath);
 		strcpy(temp + extensionPos, ".tmd");
 		//DSi TMDs are 520, TMDs from NUS are 2,312. If 2,312 we can simply trim it to 520
-		int tmdSize = getFileSizePath(temp);
+		int tmdSize = _getFileSize(temp, backup);
 		if (access(temp, F_OK) == 0)
 			printf("\t\x1B[%om%s\n\x1B[47m", (tmdSize == 520 || tmdSize == 2312) ? 047 : 041, strrchr(temp, '/') + 1);
 
 		strcpy(temp + extensionPos, ".pub");
 		if (access(temp, F_OK) == 0)
-			printf("\t\x1B[%om%s\n\x1B[47m", (getFileSizePath(temp) == h->public_sav_size) ? 047 : 041, strrchr(temp, '/') + 1);
+			printf("\t\x1B[%om%s\n\x1B[47m", (_getFileSize(temp, backup) == h->public_sav_size) ? 047 : 041, strrchr(temp, '/') + 1);
 
 		strcpy(temp + extensionPos, ".prv");
 		if (access(temp, F_OK) == 0)
-			printf("\t\x1B[%om%s\n\x1B[47m", (getFileSizePath(temp) == h->private_sav_size) ? 047 : 041, strrchr(temp, '/') + 1);
+			printf("\t\x1B[%om%s\n\x1B[47m", (_getFileSize(temp, backup) == h->private_sav_size) ? 047 : 041, strrchr(temp, '/') + 1);
 
 		strcpy(temp + extensionPos, ".bnr");
 		if (access(temp, F_OK) == 0)
-			printf("\t\x1B[%om%s\n\x1B[47m", (getFileSizePath(temp) == 0x4000) ? 047 : 041, strrchr(temp, '/') + 1);
+			printf("\t\x1B[%om%s\n\x1B[47m", (_getFileSize(temp, backup) == 0x4000) ? 047 : 041, strrchr(temp, '/') + 1);
 	}
 
 	free(b);
@@ -242,6 +282,9 @@ unsigned long long getRomSize(char const* fpath)
 {
 	if (!fpath) return 0;
 
+	if (_isBackup(fpath))
+		return lzGetRawSize(fpath);
+
 	unsigned long long size = 0;
 	FILE* f = fopen(fpath, "rb");
 
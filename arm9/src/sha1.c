@@ -0,0 +1,384 @@
+#include "sha1.h"
+#include "stagetime.h"
+#include <nds.h>
+#include <string.h>
+
+//the ARM7 cannot see the DTCM stack, anything else is copied here first
+#define SHA1_STAGE_SIZE (16 * 1024)
+//longest single request for data that is already in main RAM
+#define SHA1_REQUEST_MAX (64 * 1024)
+//no reply in this long means the ARM7 has no SHA-1 service
+#define SHA1_TIMEOUT_US 1000000
+
+//must match Sha1Request in the arm7 my_sha1.h
+typedef struct {
+	u32 flags;
+	const void* data;
+	u32 blocks;
+	u32 state[5];
+	u32 reserved[8];	//two whole cache lines, so invalidating it is safe
+} Sha1Request;
+
+enum {
+	SHA1_UNTESTED,
+	SHA1_ENGINE,
+	SHA1_BIOS
+};
+
+static int engine = SHA1_UNTESTED;
+static bool engineLost = false;
+static bool swapState = false;
+static bool dmaWorks = false;
+static u32 defaultFlags = 0;
+
+static Sha1Request request ALIGN(32);
+static Sha1Context* inFlight = NULL;
+static void const* inFlightData = NULL;
+static u32 inFlightBlocks = 0;
+static u8 stage[SHA1_STAGE_SIZE] ALIGN(32);
+
+static const u32 sha1Iv[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+static bool _reachable(void const* p)
+{
+	u32 addr = (u32)p;
+	return (addr & 3) == 0 && addr >= 0x02000000 && addr < 0x03000000;
+}
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+//plain C rounds, for the rest of a hash the engine failed partway through
+static void _softBlocks(u32 state[5], u8 const* data, u32 blocks)
+{
+	for (; blocks > 0; blocks--, data += 64)
+	{
+		u32 w[80];
+
+		for (int i = 0; i < 16; i++)
+			w[i] = (data[i * 4] << 24) | (data[i * 4 + 1] << 16) | (data[i * 4 + 2] << 8) | data[i * 4 + 3];
+
+		for (int i = 16; i < 80; i++)
+			w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+		u32 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+		for (int i = 0; i < 80; i++)
+		{
+			u32 f, k;
+
+			if (i < 20)
+			{
+				f = (b & c) | (~b & d);
+				k = 0x5A827999;
+			}
+			else if (i < 40)
+			{
+				f = b ^ c ^ d;
+				k = 0x6ED9EBA1;
+			}
+			else if (i < 60)
+			{
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8F1BBCDC;
+			}
+			else
+			{
+				f = b ^ c ^ d;
+				k = 0xCA62C1D6;
+			}
+
+			u32 t = ROL(a, 5) + f + e + k + w[i];
+			e = d;
+			d = c;
+			c = ROL(b, 30);
+			b = a;
+			a = t;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+}
+
+//waits for the request in flight and hands its state back to its context.
+//The data of a request stays untouched until the next sha1 call, so when
+//the engine fails its blocks can still be hashed here instead.
+static void _complete()
+{
+	Sha1Context* ctx = inFlight;
+	if (!ctx)
+		return;
+
+	inFlight = NULL;
+
+	bool ok = false;
+	u32 start = stageTicks();
+
+	while (stageTicksToUsec(stageTicks() - start) <= SHA1_TIMEOUT_US)
+	{
+		if (fifoCheckValue32(FIFO_USER_05))
+		{
+			ok = fifoGetValue32(FIFO_USER_05) == 1;
+			DC_InvalidateRange(&request, sizeof(request));
+			break;
+		}
+	}
+
+	if (!ok)
+	{
+		//a late reply would be taken for the next request and an engine that
+		//failed once is not trusted again, this and later hashes go on in C
+		engineLost = true;
+		ctx->failed = true;
+		_softBlocks(ctx->state, inFlightData, inFlightBlocks);
+		return;
+	}
+
+	for (int i = 0; i < 5; i++)
+		ctx->state[i] = swapState ? __builtin_bswap32(request.state[i]) : request.state[i];
+}
+
+static void _submit(Sha1Context* ctx, void const* data, u32 blocks)
+{
+	_complete();
+
+	if (engineLost)
+		ctx->failed = true;
+
+	if (ctx->failed)
+	{
+		_softBlocks(ctx->state, data, blocks);
+		return;
+	}
+
+	request.flags = ctx->flags;
+	request.data = data;
+	request.blocks = blocks;
+	for (int i = 0; i < 5; i++)
+		request.state[i] = swapState ? __builtin_bswap32(ctx->state[i]) : ctx->state[i];
+
+	DC_FlushRange(data, blocks * 64);
+	DC_FlushRange(&request, sizeof(request));
+	fifoSendAddress(FIFO_USER_05, &request);
+
+	inFlight = ctx;
+	inFlightData = data;
+	inFlightBlocks = blocks;
+}
+
+static void _engineInit(Sha1Context* ctx, u32 flags)
+{
+	ctx->hardware = true;
+	ctx->failed = false;
+	ctx->flags = flags;
+	memcpy(ctx->state, sha1Iv, sizeof(sha1Iv));
+	ctx->total = 0;
+	ctx->used = 0;
+}
+
+//with async the last request may still be running on return
+static void _engineUpdate(Sha1Context* ctx, u8 const* src, size_t len, bool async)
+{
+	u32 staged = 0;
+
+	//whatever was left running by the last call is finished first
+	_complete();
+
+	ctx->total += len;
+
+	//top up the partial block left by the last call
+	if (ctx->used > 0)
+	{
+		u32 n = (len < 64 - ctx->used) ? len : 64 - ctx->used;
+		memcpy(ctx->buffer + ctx->used, src, n);
+		ctx->used += n;
+		src += n;
+		len -= n;
+
+		if (ctx->used < 64)
+			return;
+
+		_complete();
+		memcpy(stage, ctx->buffer, 64);
+		staged = 64;
+		ctx->used = 0;
+	}
+
+	while (len >= 64)
+	{
+		if (staged == 0 && _reachable(src))
+		{
+			u32 n = (len > SHA1_REQUEST_MAX) ? SHA1_REQUEST_MAX : len & ~63;
+			_submit(ctx, src, n / 64);
+			src += n;
+			len -= n;
+		}
+		else
+		{
+			//the staging buffer may still be being read by the ARM7
+			if (staged == 0)
+				_complete();
+
+			u32 n = (len & ~63) < SHA1_STAGE_SIZE - staged ? len & ~63 : SHA1_STAGE_SIZE - staged;
+			memcpy(stage + staged, src, n);
+			staged += n;
+			src += n;
+			len -= n;
+
+			if (staged == SHA1_STAGE_SIZE)
+			{
+				_submit(ctx, stage, staged / 64);
+				staged = 0;
+			}
+		}
+	}
+
+	if (staged > 0)
+		_submit(ctx, stage, staged / 64);
+
+	if (!async)
+		_complete();
+
+	memcpy(ctx->buffer, src, len);
+	ctx->used = len;
+}
+
+static void _engineFinal(void* digest, Sha1Context* ctx)
+{
+	u8* out = (u8*)digest;
+	u64 bits = ctx->total * 8;
+	u32 n = ctx->used;
+
+	_complete();
+
+	//padding is done here so the engine is only ever given whole blocks
+	memcpy(stage, ctx->buffer, n);
+	stage[n++] = 0x80;
+
+	u32 padded = (n + 8 <= 64) ? 64 : 128;
+	memset(stage + n, 0, padded - n);
+	for (int i = 0; i < 8; i++)
+		stage[padded - 1 - i] = bits >> (i * 8);
+
+	_submit(ctx, stage, padded / 64);
+	_complete();
+
+	for (int i = 0; i < 5; i++)
+	{
+		out[i * 4 + 0] = ctx->state[i] >> 24;
+		out[i * 4 + 1] = ctx->state[i] >> 16;
+		out[i * 4 + 2] = ctx->state[i] >> 8;
+		out[i * 4 + 3] = ctx->state[i];
+	}
+}
+
+//FIPS 180-2 two block example
+static bool _selfTest(u32 flags)
+{
+	static char const msg[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	static const u8 expected[SHA1_DIGEST_SIZE] = {
+		0x84, 0x98, 0x3E, 0x44, 0x1C, 0x3B, 0xD2, 0x6E, 0xBA, 0xAE,
+		0x4A, 0xA1, 0xF9, 0x51, 0x29, 0xE5, 0xE5, 0x46, 0x70, 0xF1
+	};
+
+	Sha1Context ctx;
+	u8 digest[SHA1_DIGEST_SIZE];
+
+	_engineInit(&ctx, flags);
+	_engineUpdate(&ctx, (u8 const*)msg, sizeof(msg) - 1, false);
+	_engineFinal(digest, &ctx);
+
+	//a digest finished in C says nothing about the engine
+	return !ctx.failed && memcmp(digest, expected, SHA1_DIGEST_SIZE) == 0;
+}
+
+static void _probe()
+{
+	engine = SHA1_BIOS;
+
+	if (!isDSiMode())
+		return;
+
+	//the hash registers may hold the state in either byte order
+	for (int swap = 1; swap >= 0 && !engineLost; swap--)
+	{
+		swapState = swap;
+
+		if (_selfTest(0))
+		{
+			engine = SHA1_ENGINE;
+			break;
+		}
+	}
+
+	if (engine == SHA1_ENGINE)
+	{
+		dmaWorks = _selfTest(SHA1_REQ_DMA);
+		defaultFlags = dmaWorks ? SHA1_REQ_DMA : 0;
+	}
+}
+
+bool sha1Hardware()
+{
+	if (engine == SHA1_UNTESTED)
+		_probe();
+
+	return engine == SHA1_ENGINE && !engineLost;
+}
+
+bool sha1SetDma(bool dma)
+{
+	if (!sha1Hardware() || (dma && !dmaWorks))
+		return false;
+
+	defaultFlags = dma ? SHA1_REQ_DMA : 0;
+	return true;
+}
+
+void sha1Init(Sha1Context* ctx)
+{
+	if (sha1Hardware())
+	{
+		_engineInit(ctx, defaultFlags);
+		return;
+	}
+
+	ctx->hardware = false;
+	ctx->sw.sha_block = 0;
+	swiSHA1Init(&ctx->sw);
+}
+
+void sha1Update(Sha1Context* ctx, const void* data, size_t len)
+{
+	if (ctx->hardware)
+		_engineUpdate(ctx, (u8 const*)data, len, false);
+	else
+		swiSHA1Update(&ctx->sw, data, len);
+}
+
+void sha1UpdateAsync(Sha1Context* ctx, const void* data, size_t len)
+{
+	if (ctx->hardware)
+		_engineUpdate(ctx, (u8 const*)data, len, true);
+	else
+		swiSHA1Update(&ctx->sw, data, len);
+}
+
+void sha1Final(void* digest, Sha1Context* ctx)
+{
+	if (ctx->hardware)
+		_engineFinal(digest, ctx);
+	else
+		swiSHA1Final(digest, &ctx->sw);
+}
+
+void sha1Calc(void* digest, const void* data, size_t len)
+{
+	Sha1Context ctx;
+	sha1Init(&ctx);
+	sha1Update(&ctx, data, len);
+	sha1Final(digest, &ctx);
+}
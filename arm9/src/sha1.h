@@ -0,0 +1,45 @@
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <nds/ndstypes.h>
+#include <nds/sha1.h>
+
+#define SHA1_DIGEST_SIZE 20
+
+//request flags, must match SHA1_REQ_* in the arm7 my_sha1.h
+#define SHA1_REQ_DMA BIT(0)
+
+//SHA-1 on the DSi hash engine, which only the ARM7 can reach. The engine
+//is checked against a known digest on first use and the BIOS routine is
+//used instead when it fails or in DS mode. A hash the engine fails partway
+//through is finished in C from the last good state, so digests never change.
+typedef struct {
+	bool hardware;
+	bool failed;
+	u32 flags;
+	u32 state[5];
+	u64 total;
+	u32 used;
+	u8 buffer[64];
+	swiSHA1context_t sw;
+} Sha1Context;
+
+void sha1Init(Sha1Context* ctx);
+void sha1Update(Sha1Context* ctx, const void* data, size_t len);
+void sha1Final(void* digest, Sha1Context* ctx);
+
+//returns while the ARM7 is still hashing, so the next chunk can be read or
+//decrypted meanwhile. The data must not change until the next sha1 call,
+//only word aligned main RAM overlaps, and the context must be finished
+//with sha1Final. With the BIOS fallback this is just sha1Update.
+void sha1UpdateAsync(Sha1Context* ctx, const void* data, size_t len);
+
+void sha1Calc(void* digest, const void* data, size_t len);
+
+//whether the engine passed its self-test
+bool sha1Hardware();
+
+//feed the engine by NDMA instead of ARM7 word writes, false if unsupported
+bool sha1SetDma(bool dma);
+
+#endif
@@ -0,0 +1,136 @@
+#include "stagetime.h"
+#include "main.h"
+#include "version.h"
+#include <sys/stat.h>
+
+//timers 2 and 3 cascaded at BUS_CLOCK/64, this is the clock for all timing
+//so 0 and 1 stay free for the profiler
+#define STAGE_TIMER 2
+#define STAGE_CLOCK (BUS_CLOCK >> 6)
+
+typedef struct {
+	char name[16];
+	unsigned long long bytes;
+	u32 ticks;
+} Stage;
+
+static Stage stages[STAGE_MAX];
+static int stageCount = 0;
+static int current = -1;
+static u32 startTicks = 0;
+static bool logged = false;
+
+u32 stageTicks()
+{
+	u16 hi, lo;
+
+	//the low half can carry between the two reads
+	do {
+		hi = TIMER_DATA(STAGE_TIMER + 1);
+		lo = TIMER_DATA(STAGE_TIMER);
+	} while (hi != TIMER_DATA(STAGE_TIMER + 1));
+
+	return (hi << 16) | lo;
+}
+
+u32 stageTicksToUsec(u32 ticks)
+{
+	return ((u64)ticks * 1000000) / STAGE_CLOCK;
+}
+
+static float _mbps(Stage const* s)
+{
+	u32 us = stageTicksToUsec(s->ticks);
+	return (us == 0) ? 0.f : (float)s->bytes / (float)us;
+}
+
+void stageStart()
+{
+	TIMER_CR(STAGE_TIMER) = 0;
+	TIMER_CR(STAGE_TIMER + 1) = 0;
+	TIMER_DATA(STAGE_TIMER) = 0;
+	TIMER_DATA(STAGE_TIMER + 1) = 0;
+	TIMER_CR(STAGE_TIMER + 1) = TIMER_ENABLE | TIMER_CASCADE;
+	TIMER_CR(STAGE_TIMER) = TIMER_ENABLE | TIMER_DIV_64;
+}
+
+//the clock keeps running, iotrace and the task hold timer read it too
+void stageReset()
+{
+	stageCount = 0;
+	current = -1;
+}
+
+void stageBegin(char const* name)
+{
+	if (current >= 0)
+		stageEnd(0);
+
+	if (!name || stageCount >= STAGE_MAX)
+		return;
+
+	current = stageCount++;
+	strncpy(stages[current].name, name, sizeof(stages[current].name) - 1);
+	stages[current].name[sizeof(stages[current].name) - 1] = '\0';
+	stages[current].bytes = 0;
+	stages[current].ticks = 0;
+
+	startTicks = stageTicks();
+}
+
+void stageEnd(unsigned long long bytes)
+{
+	if (current < 0)
+		return;
+
+	stages[current].ticks = stageTicks() - startTicks;
+	stages[current].bytes = bytes;
+	current = -1;
+}
+
+void stagePrint()
+{
+	iprintf("\nStage         Time      MB/s\n");
+
+	for (int i = 0; i < stageCount; i++)
+	{
+		Stage const* s = &stages[i];
+		u32 ms = stageTicksToUsec(s->ticks) / 1000;
+
+		if (s->bytes > 0)
+			printf("%-12s %6lums %8.2f\n", s->name, ms, _mbps(s));
+		else
+			printf("%-12s %6lums        -\n", s->name, ms);
+	}
+}
+
+bool stageLog(char const* title)
+{
+	mkdir("sd:/_nds", 0777);
+	mkdir("sd:/_nds/TADDeliveryTool", 0777);
+
+	bool exists = access(STAGE_LOG_PATH, F_OK) == 0;
+
+	FILE* f = fopen(STAGE_LOG_PATH, "a");
+	if (!f) return false;
+
+	if (!exists)
+		fprintf(f, "version,mode,title,stage,bytes,us,mbps\n");
+
+	for (int i = 0; i < stageCount; i++)
+	{
+		Stage const* s = &stages[i];
+		fprintf(f, "%s,%s,%s,%s,%llu,%lu,%.3f\n", VERSION, sdnandMode ? "sdnand" : "sysnand",
+				title ? title : "", s->name, s->bytes, stageTicksToUsec(s->ticks), _mbps(s));
+	}
+
+	fclose(f);
+
+	logged = true;
+	return true;
+}
+
+bool stageLogged()
+{
+	return logged;
+}
@@ -0,0 +1,25 @@
+#ifndef STAGETIME_H
+#define STAGETIME_H
+
+#include <nds/ndstypes.h>
+
+//hardware timer stopwatch for the stages of an install, results can be
+//shown on screen and appended to a CSV log on SD
+#define STAGE_LOG_PATH "sd:/_nds/TADDeliveryTool/timing.csv"
+#define STAGE_MAX 16
+
+//starts the clock, once at boot
+void stageStart();
+void stageReset();
+void stageBegin(char const* name);
+void stageEnd(unsigned long long bytes);
+
+void stagePrint();
+bool stageLog(char const* title);
+bool stageLogged();
+
+//free running BUS_CLOCK/64 count, running from stageStart
+u32 stageTicks();
+u32 stageTicksToUsec(u32 ticks);
+
+#endif
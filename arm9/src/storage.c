@@ -1,11 +1,15 @@
 #include "storage.h"
 #include "main.h"
 #include "message.h"
+#include "progress.h"
+#include "task.h"
 #include <errno.h>
 #include <dirent.h>
 
 #define TITLE_LIMIT 39
 
+static int _copyFilePart(char const* src, u32 offset, u32 size, char const* dst, bool truncate);
+
 //printing
 void printBytes(unsigned long long bytes)
 {
@@ -22,50 +26,6 @@ void printBytes(unsigned long long bytes)
 		printf("%.2fGB", (float)bytes / 1024.f / 1024.f / 1024.f);
 }
 
-//progress bar
-static int lastBars = 0;
-
-void printProgressBar(float percent)
-{
-	if (percent < 0.f) percent = 0.f;
-	if (percent > 1.f) percent = 1.f;
-
-	int bars = (int)(30.f * percent);
-
-	//skip redundant prints
-	if (bars != lastBars)
-	{
-		consoleSelect(&topScreen);
-
-		iprintf("\x1B[42m");	//green
-
-		//Print frame
-		if (lastBars <= 0)
-		{
-			iprintf("\x1b[23;0H[");
-			iprintf("\x1b[23;31H]");
-		}
-
-		//Print bars
-		if (bars > 0)
-		{
-			for (int i = 0; i < bars; i++)
-				iprintf("\x1b[23;%dH|", 1 + i);
-		}
-
-		lastBars = bars;
-
-		iprintf("\x1B[47m");	//white
-	}
-}
-
-void clearProgressBar()
-{
-	lastBars = 0;
-	consoleSelect(&topScreen);
-	iprintf("\x1b[23;0H                                ");
-}
-
 //files
 bool fileExists(char const* path)
 {
@@ -88,6 +48,20 @@ int copyFile(char const* src, char const* dst)
 }
 
 int copyFilePart(char const* src, u32 offset, u32 size, char const* dst)
+{
+	return _copyFilePart(src, offset, size, dst, true);
+}
+
+//copies over an existing file without truncating it, keeps its clusters
+int copyFileInto(char const* src, char const* dst)
+{
+	if (!src) return 1;
+
+	unsigned long long size = getFileSizePath(src);
+	return _copyFilePart(src, 0, size, dst, false);
+}
+
+static int _copyFilePart(char const* src, u32 offset, u32 size, char const* dst, bool truncate)
 {
 	if (!src) return 1;
 	if (!dst) return 2;
@@ -101,10 +75,10 @@ int copyFilePart(char const* src, u32 offset, u32 size, char const* dst)
 	}
 	else
 	{
-		if (fileExists(dst))
+		if (truncate && fileExists(dst))
 			remove(dst);
 
-		FILE* fout = fopen(dst, "wb");
+		FILE* fout = fopen(dst, truncate ? "wb" : "r+b");
 
 		if (!fout)
 		{
@@ -116,7 +90,7 @@ int copyFilePart(char const* src, u32 offset, u32 size, char const* dst)
 		{
 			fseek(fin, offset, SEEK_SET);
 
-			consoleSelect(&topScreen);
+			progressStart(size, true);
 
 			int bytesRead;
 			unsigned long long totalBytesRead = 0;
@@ -124,7 +98,7 @@ int copyFilePart(char const* src, u32 offset, u32 size, char const* dst)
 			#define BUFF_SIZE 128 //Arbitrary. A value too large freezes the ds.
 			char* buffer = (char*)malloc(BUFF_SIZE);
 
-			while (!programEnd)
+			while (!taskYield())
 			{
 				unsigned int toRead = BUFF_SIZE;
 				if (size - totalBytesRead < BUFF_SIZE)
@@ -134,13 +108,13 @@ int copyFilePart(char const* src, u32 offset, u32 size, char const* dst)
 				fwrite(buffer, bytesRead, 1, fout);
 
 				totalBytesRead += bytesRead;
-				printProgressBar( ((float)totalBytesRead / (float)size) );
+				progressSet(totalBytesRead);
 
 				if (bytesRead != BUFF_SIZE)
 					break;
 			}
 
-			clearProgressBar();
+			progressEnd();
 			consoleSelect(&bottomScreen);
 
 			free(buffer);
@@ -150,7 +124,7 @@ int copyFilePart(char const* src, u32 offset, u32 size, char const* dst)
 	}
 
 	fclose(fin);
-	return 0;
+	return taskStopped() ? 5 : 0;
 }
 
 unsigned long long getFileSize(FILE* f)
@@ -326,7 +300,7 @@ bool deleteDir(char const* path)
 	}
 	else
 	{
-		while ( (ent = readdir(dir)) )
+		while (!taskYield() && (ent = readdir(dir)))
 		{
 			if (strcmp(".", ent->d_name) == 0 || strcmp("..", ent->d_name) == 0)
 				continue;
@@ -366,6 +340,10 @@ bool deleteDir(char const* path)
 
 	closedir(dir);
 
+	//a cancel leaves the rest where it is
+	if (taskStopped())
+		return false;
+
 	iprintf("%s...", path);
 	if (remove(path) != 0)
 	{
@@ -10,14 +10,11 @@
 //printing
 void printBytes(unsigned long long bytes);
 
-//progress bar
-void printProgressBar(float percent);
-void clearProgressBar();
-
 //Files
 bool fileExists(char const* path);
 int copyFile(char const* src, char const* dst);
 int copyFilePart(char const* src, u32 offset, u32 size, char const* dst);
+int copyFileInto(char const* src, char const* dst);
 unsigned long long getFileSize(FILE* f);
 unsigned long long getFileSizePath(char const* path);
 bool padFile(char const* path, int size);
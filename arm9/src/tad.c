@@ -6,9 +6,13 @@
 */
 
 #include "tad.h"
+#include "tadheader.h"
 #include "storage.h"
 #include "rom.h"
+#include "sha1.h"
 #include "main.h"
+#include "stagetime.h"
+#include "progress.h"
 #include "nand/twltool/dsi.h"
 #include <nds/ndstypes.h>
 #include <malloc.h>
@@ -19,6 +23,9 @@
 #include <stdlib.h>
 #include <dirent.h>
 
+// Data titles are decrypted and hashed this much at a time
+#define TAD_HASH_CHUNK (16 * 1024)
+
 /*
     The common keys for decrypting TADs.
 
@@ -52,26 +59,6 @@ unsigned char content_iv[] = {
     0x00, 0x00, 0x00, 0x00 ,0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
-typedef struct {
-    uint32_t hdrSize;
-    uint16_t tadType;
-    uint16_t tadVersion;
-    uint32_t certSize;
-    uint32_t crlSize;
-    uint32_t ticketSize;
-    uint32_t tmdSize;
-    uint32_t srlSize;
-    uint32_t metaSize;
-} Header;
-typedef struct {
-    uint32_t hdrOffset;
-    uint32_t certOffset;
-    uint32_t crlOffset;
-    uint32_t ticketOffset;
-    uint32_t tmdOffset;
-    uint32_t srlOffset;
-    uint32_t metaOffset;
-} Tad;
 unsigned char srlCompany[2];
 unsigned char srlVerLow[1];
 unsigned char srlVerHigh[1];
@@ -143,29 +130,18 @@ char* openTad(char const* src) {
     https://github.com/rvtr/TwlIPL/commit/baca65d35d5d62d815c88e6374b895d5b0755277
     */
 
-    Header header;
-    fread(&header, sizeof(Header), 1, file);
+    TadHeader header;
+    fread(&header, sizeof(TadHeader), 1, file);
     iprintf("Parsing TAD header...\n");
-    Tad tad;
-    tad.hdrOffset = 0;
+    TadLayout tad;
 
     // 18803 = "Is". This is the standard TAD type.
-    // Others exist, but they are for Wii boot2 (ib) and netcard (NULL)
-    if (swap_endian_u16(header.tadType) == 18803) {
-        //iprintf("  tadType:      'Is'\n");
-    } else {
+    // All offsets in the TAD are aligned to 64 bytes, see tadheader.c
+    // TODO: Make sure offset calculation and alignment is correct by comparing that to total size
+    if (!tadParseHeader(&header, &tad)) {
         iprintf("  tadType:      UNKNOWN\nERROR: unexpected TAD type\n");
         return "ERROR";
     }
-
-    // All offsets in the TAD are aligned to 64 bytes.
-    // TODO: Make sure offset calculation and alignment is correct by comparing that to total size
-    tad.certOffset = round_up(swap_endian_u32(header.hdrSize), 64);
-    tad.crlOffset = round_up(tad.certOffset + swap_endian_u32(header.certSize), 64);
-    tad.ticketOffset = round_up(tad.crlOffset + swap_endian_u32(header.crlSize), 64);
-    tad.tmdOffset = round_up(tad.ticketOffset + swap_endian_u32(header.ticketSize), 64);
-    tad.srlOffset = round_up(tad.tmdOffset + swap_endian_u32(header.tmdSize), 64);
-    tad.metaOffset = round_up(tad.srlOffset + swap_endian_u32(header.srlSize), 64);
     /*
     Okay sooo this is stupid. Content size defined in header != true content size
     
@@ -194,15 +170,19 @@ char* openTad(char const* src) {
 
     iprintf("Copying output files...\n");
 
+    stageBegin("extract");
+
     iprintf("  Copying TMD...\n"); 
-    copyFilePart(src, tad.tmdOffset, swap_endian_u32(header.tmdSize), "sd:/_nds/TADDeliveryTool/tmp/temp.tmd");
+    copyFilePart(src, tad.tmdOffset, tad.tmdSize, "sd:/_nds/TADDeliveryTool/tmp/temp.tmd");
 
     iprintf("  Copying ticket...\n");
-    copyFilePart(src, tad.ticketOffset, swap_endian_u32(header.ticketSize), "sd:/_nds/TADDeliveryTool/tmp/temp.tik");
+    copyFilePart(src, tad.ticketOffset, tad.ticketSize, "sd:/_nds/TADDeliveryTool/tmp/temp.tik");
     
     iprintf("  Copying SRL...\n"); 
     copyFilePart(src, tad.srlOffset, swap_endian_u32(srlTrueSize), "sd:/_nds/TADDeliveryTool/tmp/temp.srl.enc");
 
+    stageEnd(tad.tmdSize + tad.ticketSize + swap_endian_u32(srlTrueSize));
+
     /*
     Get the title key + IV from the ticket.
     */
@@ -244,22 +224,30 @@ char* openTad(char const* src) {
 
     bool keyFail;
     iprintf("Trying dev common key...\n");
+    stageBegin("key dev");
     keyFail = decryptTad(devKey, title_key_iv, title_key_enc, content_iv, swap_endian_u32(srlTrueSize), srlTidLow, dataTitle, contentHash);
+    stageEnd(swap_endian_u32(srlTrueSize));
 
     if (keyFail == TRUE) {
         remove("sd:/_nds/TADDeliveryTool/tmp/temp.srl");
         iprintf("Key fail!\n\nTrying prod common key...\n");
+        stageBegin("key prod");
         keyFail = decryptTad(prodKey, title_key_iv, title_key_enc, content_iv, swap_endian_u32(srlTrueSize), srlTidLow, dataTitle, contentHash);
+        stageEnd(swap_endian_u32(srlTrueSize));
     }
     if (keyFail == TRUE) {
         remove("sd:/_nds/TADDeliveryTool/tmp/temp.srl");
         iprintf("Key fail!\n\nTrying debugger common key...\n");
+        stageBegin("key debugger");
         keyFail = decryptTad(debuggerKey, title_key_iv, title_key_enc, content_iv, swap_endian_u32(srlTrueSize), srlTidLow, dataTitle, contentHash);
+        stageEnd(swap_endian_u32(srlTrueSize));
     }
     if (keyFail == TRUE) {
         remove("sd:/_nds/TADDeliveryTool/tmp/temp.srl");
         iprintf("Key fail!\n\nTrying custom key...\n");
+        stageBegin("key custom");
         keyFail = decryptTad(customKey, title_key_iv, title_key_enc, content_iv, swap_endian_u32(srlTrueSize), srlTidLow, dataTitle, contentHash);
+        stageEnd(swap_endian_u32(srlTrueSize));
     }
     if (keyFail == TRUE) {
         remove("sd:/_nds/TADDeliveryTool/tmp/temp.srl");
@@ -308,24 +296,45 @@ bool decryptTad(unsigned char* commonKey,
     Luckily they tend to be small (10-300kb) so completely decrypting and checking a SHA1 hash is fast.
     */
 
+    progressStart(srlSize, true);
+
     if (dataTitle == TRUE) {
         // Copied SHA1 stuff from here.
         // https://github.com/DS-Homebrew/SafeNANDManager/blob/master/arm9/source/arm9.c#L96-L152
-        swiSHA1context_t ctx;
-        ctx.sha_block=0;
+        Sha1Context ctx;
         u8 sha1[20]={0};
-        swiSHA1Init(&ctx);
+        sha1Init(&ctx);
+
+        // Decrypt in chunks and let the ARM7 hash one chunk while the next is decrypted
+        u32 chunkSize = TAD_HASH_CHUNK;
+        u8* buffers = (u8*)memalign(32, TAD_HASH_CHUNK * 3);
+        u8* chunkEnc = buffers;
+        u8* chunkDec[2] = { buffers + TAD_HASH_CHUNK, buffers + TAD_HASH_CHUNK * 2 };
+
+        // Low on memory, go back to one AES block at a time
+        if (!buffers) {
+            chunkSize = 16;
+            chunkEnc = srl_buffer_enc;
+            chunkDec[0] = chunkDec[1] = srl_buffer_dec;
+        }
 
+        int k = 0;
         while (i < srlSize) {
-            fread(srl_buffer_enc, 1, 16, srlFile_enc);
-            decrypt_cbc(title_key_dec, content_iv, srl_buffer_enc, 16, 16, srl_buffer_dec);
-            fwrite(srl_buffer_dec, 1, 16, srlFile_dec);
-            printProgressBar( ((float)i / (float)srlSize) );
-            swiSHA1Update(&ctx, srl_buffer_dec, 16);
-            i=i+16;
+            // Whole AES blocks, same as reading 16 bytes at a time
+            u32 len = (srlSize - i + 15) & ~15;
+            if (len > chunkSize) len = chunkSize;
+
+            fread(chunkEnc, 1, len, srlFile_enc);
+            decrypt_cbc(title_key_dec, content_iv, chunkEnc, len, 16, chunkDec[k]);
+            fwrite(chunkDec[k], 1, len, srlFile_dec);
+            sha1UpdateAsync(&ctx, chunkDec[k], len);
+            k ^= 1;
+            i=i+len;
+            progressSet(i);
 
         }
-        swiSHA1Final(sha1, &ctx);
+        sha1Final(sha1, &ctx);
+        free(buffers);
 
         // Compare SHA1 hash of file to TMD
         for (int i = 0; i < 20; i++) {
@@ -340,7 +349,6 @@ bool decryptTad(unsigned char* commonKey,
             fread(srl_buffer_enc, 1, 16, srlFile_enc);
             decrypt_cbc(title_key_dec, content_iv, srl_buffer_enc, 16, 16, srl_buffer_dec);
             fwrite(srl_buffer_dec, 1, 16, srlFile_dec);
-            printProgressBar( ((float)i / (float)srlSize) );
     	   // Executable SRLs will always have a reverse order TID low at 0x230. 
     	   // Use this to check if the current common key works.
             if (i == 560) {
@@ -352,8 +360,10 @@ bool decryptTad(unsigned char* commonKey,
                 }
             }
             i=i+16;
+            progressSet(i);
         }
     }
+    progressEnd();
     fclose(srlFile_dec);
     fclose(srlFile_enc);
     // Restore IVs
@@ -368,17 +378,10 @@ void printTadInfo(char const* fpath)
     if (!fpath) return;
 
     FILE *file = fopen(fpath, "rb");
-    Header header;
-    fread(&header, sizeof(Header), 1, file);
-    Tad tad;
-    tad.hdrOffset = 0;
-    // All offsets in the TAD are aligned to 64 bytes.
-    tad.certOffset = round_up(swap_endian_u32(header.hdrSize), 64);
-    tad.crlOffset = round_up(tad.certOffset + swap_endian_u32(header.certSize), 64);
-    tad.ticketOffset = round_up(tad.crlOffset + swap_endian_u32(header.crlSize), 64);
-    tad.tmdOffset = round_up(tad.ticketOffset + swap_endian_u32(header.ticketSize), 64);
-    tad.srlOffset = round_up(tad.tmdOffset + swap_endian_u32(header.tmdSize), 64);
-    tad.metaOffset = round_up(tad.srlOffset + swap_endian_u32(header.srlSize), 64);
+    TadHeader header;
+    fread(&header, sizeof(TadHeader), 1, file);
+    TadLayout tad;
+    tadParseHeader(&header, &tad);
     // Get info from TMD.
     fseek(file, tad.tmdOffset+396, SEEK_SET);
     fread(srlTidHigh, 1, 4, file);
@@ -396,7 +399,7 @@ void printTadInfo(char const* fpath)
     iprintf("\x1B[42m");    //green
     printBytes(romSize);
     iprintf("\x1B[47m");    //white
-    iprintf(" (\x1B[42m%ld blocks\x1B[47m)\n", ((swap_endian_u32(header.srlSize) / BYTES_PER_BLOCK) * BYTES_PER_BLOCK + BYTES_PER_BLOCK) / BYTES_PER_BLOCK);
+    iprintf(" (\x1B[42m%ld blocks\x1B[47m)\n", ((tad.srlSize / BYTES_PER_BLOCK) * BYTES_PER_BLOCK + BYTES_PER_BLOCK) / BYTES_PER_BLOCK);
 
     iprintf("Game Code:\n  ");
     iprintf("\x1B[42m");    //green
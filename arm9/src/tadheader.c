@@ -0,0 +1,40 @@
+#include "tadheader.h"
+
+static inline uint32_t _be32(uint32_t x)
+{
+	uint8_t const* b = (uint8_t const*)&x;
+	return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+static inline uint16_t _be16(uint16_t x)
+{
+	uint8_t const* b = (uint8_t const*)&x;
+	return (b[0] << 8) | b[1];
+}
+
+static inline uint32_t _align(uint32_t v)
+{
+	return (v + TAD_ALIGN - 1) & ~(TAD_ALIGN - 1);
+}
+
+//fills in the layout even for an unknown type, returns false if it isn't "Is"
+bool tadParseHeader(TadHeader const* header, TadLayout* tad)
+{
+	if (!header || !tad) return false;
+
+	tad->ticketSize = _be32(header->ticketSize);
+	tad->tmdSize = _be32(header->tmdSize);
+	tad->srlSize = _be32(header->srlSize);
+
+	//all offsets in the TAD are aligned to 64 bytes
+	tad->hdrOffset = 0;
+	tad->certOffset = _align(_be32(header->hdrSize));
+	tad->crlOffset = _align(tad->certOffset + _be32(header->certSize));
+	tad->ticketOffset = _align(tad->crlOffset + _be32(header->crlSize));
+	tad->tmdOffset = _align(tad->ticketOffset + tad->ticketSize);
+	tad->srlOffset = _align(tad->tmdOffset + tad->tmdSize);
+	tad->metaOffset = _align(tad->srlOffset + tad->srlSize);
+
+	//others exist, but they are for Wii boot2 (ib) and netcard (NULL)
+	return _be16(header->tadType) == TAD_TYPE_IS;
+}
@@ -0,0 +1,41 @@
+#ifndef TADHEADER_H
+#define TADHEADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//the 32 byte big endian header at the start of a TAD, kept free of libnds
+//so the host benchmark in tools/hostbench can build it
+#define TAD_TYPE_IS 0x4973 // "Is"
+#define TAD_ALIGN   64
+
+typedef struct {
+	uint32_t hdrSize;
+	uint16_t tadType;
+	uint16_t tadVersion;
+	uint32_t certSize;
+	uint32_t crlSize;
+	uint32_t ticketSize;
+	uint32_t tmdSize;
+	uint32_t srlSize;
+	uint32_t metaSize;
+} TadHeader;
+
+//offsets and sizes of each section, in native byte order
+typedef struct {
+	uint32_t hdrOffset;
+	uint32_t certOffset;
+	uint32_t crlOffset;
+	uint32_t ticketOffset;
+	uint32_t tmdOffset;
+	uint32_t srlOffset;
+	uint32_t metaOffset;
+
+	uint32_t ticketSize;
+	uint32_t tmdSize;
+	uint32_t srlSize;
+} TadLayout;
+
+bool tadParseHeader(TadHeader const* header, TadLayout* tad);
+
+#endif
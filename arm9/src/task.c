@@ -0,0 +1,64 @@
+#include "task.h"
+#include "main.h"
+#include "stagetime.h"
+
+static bool canCancel = false;
+static bool cancelled = false;
+
+static bool holding = false;
+static u32 holdStart = 0;
+
+void taskBegin(bool cancellable)
+{
+	canCancel = cancellable;
+	cancelled = false;
+	holding = false;
+
+	//a key already held for a menu does not count towards a cancel
+	scanKeys();
+}
+
+bool taskEnd()
+{
+	bool result = cancelled;
+
+	canCancel = false;
+	cancelled = false;
+
+	return result;
+}
+
+bool taskYield()
+{
+	if (canCancel && !cancelled)
+	{
+		scanKeys();
+
+		if (keysDown() & TASK_CANCEL_KEY)
+		{
+			holding = true;
+			holdStart = stageTicks();
+		}
+		else if (!(keysHeld() & TASK_CANCEL_KEY))
+		{
+			holding = false;
+		}
+		else if (holding && stageTicksToUsec(stageTicks() - holdStart) >= TASK_CANCEL_USEC)
+		{
+			cancelled = true;
+		}
+	}
+
+	return taskStopped();
+}
+
+bool taskStopped()
+{
+	return programEnd || cancelled;
+}
+
+void taskCancel()
+{
+	if (canCancel)
+		cancelled = true;
+}
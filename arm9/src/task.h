@@ -0,0 +1,22 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <nds/ndstypes.h>
+
+//long operations run their work in chunks and call taskYield() between
+//them, which polls the keys so holding B can cancel a cancellable task
+#define TASK_CANCEL_KEY  KEY_B
+#define TASK_CANCEL_USEC 500000
+
+void taskBegin(bool cancellable);
+//true if the task was cancelled
+bool taskEnd();
+
+//true when the work should stop, at power off or on a cancel
+bool taskYield();
+bool taskStopped();
+
+//cancels a cancellable task as if B had been held, for the tests
+void taskCancel();
+
+#endif
@@ -1,8 +1,124 @@
 #include "main.h"
+#include "benchmark.h"
+#include "fatmap.h"
+#include "lz.h"
+#include "manifest.h"
+#include "menu.h"
 #include "message.h"
+#include "nand/nandio.h"
+#include "profiler.h"
+#include "sha1.h"
+#include "stagetime.h"
 #include "storage.h"
+#include "task.h"
+#include <dirent.h>
+#include <malloc.h>
+#include <sys/stat.h>
+
+#define BENCH_SECTORS 2048
+#define BENCH_CHUNK   64
+
+#define BACKUP_TEST_SRC    "sd:/_nds/TADDeliveryTool/tmp/backuptest.bin"
+#define BACKUP_TEST_DST    "sd:/_nds/TADDeliveryTool/tmp/backuptest.tlz"
+#define BACKUP_TEST_OUT    "sd:/_nds/TADDeliveryTool/tmp/backuptest.out"
+#define BACKUP_TEST_BLOCKS 4
+
+enum {
+	TEST_MENU_STORAGE,
+	TEST_MENU_PATH_BENCHMARK,
+	TEST_MENU_FRAGMENTATION,
+	TEST_MENU_BACKUP_CANCEL,
+	TEST_MENU_BENCHMARK_SUITE,
+	TEST_MENU_PROFILER,
+	TEST_MENU_BACK
+};
+
+static int subMenu();
+static void storageCheck();
+static void pathBenchmark();
+static void fragmentationReport();
+static void backupCancelCheck();
+static void profilerToggle();
 
 void testMenu()
+{
+	while (!programEnd)
+	{
+		switch (subMenu())
+		{
+			case TEST_MENU_STORAGE:
+				storageCheck();
+				break;
+
+			case TEST_MENU_PATH_BENCHMARK:
+				pathBenchmark();
+				break;
+
+			case TEST_MENU_FRAGMENTATION:
+				fragmentationReport();
+				break;
+
+			case TEST_MENU_BACKUP_CANCEL:
+				backupCancelCheck();
+				break;
+
+			case TEST_MENU_BENCHMARK_SUITE:
+				benchmarkSuite();
+				break;
+
+			case TEST_MENU_PROFILER:
+				profilerToggle();
+				break;
+
+			default:
+				return;
+		}
+	}
+}
+
+static int subMenu()
+{
+	int result = -1;
+
+	clearScreen(&topScreen);
+	iprintf("Tests\n");
+
+	Menu* m = newMenu();
+	setMenuHeader(m, "TEST");
+
+	addMenuItem(m, "Storage check", NULL, 0);
+	addMenuItem(m, "SD/MMC path benchmark", NULL, 0);
+	addMenuItem(m, "Title fragmentation", NULL, 0);
+	addMenuItem(m, "Backup cancel check", NULL, 0);
+	addMenuItem(m, "Benchmark suite", NULL, 0);
+	addMenuItem(m, profilerRunning() ? "Stop profiler" : "Start profiler", NULL, 0);
+	addMenuItem(m, "Back - [B]", NULL, 0);
+
+	printMenu(m);
+
+	while (!programEnd)
+	{
+		swiWaitForVBlank();
+		scanKeys();
+
+		if (moveCursor(m))
+			printMenu(m);
+
+		if (keysDown() & KEY_B)
+			break;
+
+		else if (keysDown() & KEY_A)
+		{
+			result = m->cursor;
+			break;
+		}
+	}
+
+	freeMenu(m);
+	return result;
+}
+
+static void storageCheck()
 {
 	//top screen
 	clearScreen(&topScreen);
@@ -72,4 +188,316 @@ void testMenu()
 	//end
 	iprintf("\nBack - [B]\n");
 	keyWait(KEY_B);
+}
+
+// Reads BENCH_SECTORS raw sectors, returns the time taken in ms
+static u32 benchRead(bool nand, u8* buffer, u32* sum)
+{
+	const DISC_INTERFACE* sd = get_io_dsisd();
+
+	u32 start = stageTicks();
+
+	for (u32 sector = 0; sector < BENCH_SECTORS; sector += BENCH_CHUNK)
+	{
+		bool ok = nand ? nand_ReadSectors(sector, BENCH_CHUNK, buffer) : sd->readSectors(sector, BENCH_CHUNK, buffer);
+		if (!ok)
+			return 0;
+	}
+
+	u32 ms = stageTicksToUsec(stageTicks() - start) / 1000;
+
+	//checksum of the last chunk, every path should read the same data
+	*sum = 0;
+	for (int i = 0; i < BENCH_CHUNK * 512; i++)
+		*sum += buffer[i] * (i + 1);
+
+	return ms;
+}
+
+static void pathBenchmark()
+{
+	const char* pathNames[NANDIO_PATH_COUNT] = { "16-bit", "32-bit", "NDMA" };
+
+	clearScreen(&bottomScreen);
+	clearScreen(&topScreen);
+	iprintf("SD/MMC Path Benchmark\n\n");
+	iprintf("Raw read of %d KiB each\n", BENCH_SECTORS / 2);
+	iprintf("(+1 = unaligned buffer)\n\n");
+	iprintf("path        NAND KB/s  SD KB/s\n");
+
+	u8* buffer = (u8*)memalign(32, BENCH_CHUNK * 512 + 32);
+	if (!buffer)
+	{
+		messageBox("\x1B[31mError:\x1B[33m Not enough memory.\n");
+		return;
+	}
+
+	u32 refSum[2] = { 0, 0 };
+	bool mismatch = false;
+
+	for (int path = 0; path < NANDIO_PATH_COUNT && !programEnd; path++)
+	{
+		if (nandio_set_data_path(path) != path)
+		{
+			iprintf("%-10s  not supported\n", pathNames[path]);
+			continue;
+		}
+
+		for (int offset = 0; offset <= 1; offset++)
+		{
+			iprintf("%-8s%s  ", pathNames[path], offset ? " +1" : "   ");
+
+			for (int dev = 0; dev < 2; dev++)
+			{
+				u32 sum = 0;
+				u32 ms = benchRead(dev == 0, buffer + offset, &sum);
+
+				if (ms == 0)
+					iprintf("%9s", "fail");
+				else
+					iprintf("%9lu", (BENCH_SECTORS / 2) * 1000 / ms);
+
+				if (path == 0 && offset == 0)
+					refSum[dev] = sum;
+				else if (sum != refSum[dev])
+					mismatch = true;
+
+				iprintf(dev == 0 ? "  " : "\n");
+			}
+		}
+	}
+
+	nandio_set_data_path(NANDIO_PATH_32);
+	free(buffer);
+
+	if (mismatch)
+		iprintf("\n\x1B[31mData mismatch between paths!\x1B[47m\n");
+
+	iprintf("\nBack - [B]\n");
+	keyWait(KEY_B);
+}
+
+static void fragmentationReport()
+{
+	const char* dirs[] = {
+		"00030004",
+		"00030005",
+		"00030015",
+		"00030017"
+	};
+
+	clearScreen(&bottomScreen);
+	clearScreen(&topScreen);
+	iprintf("Title Fragmentation\n\n");
+	iprintf("title     app       frags  KiB\n");
+
+	FatMap* fm = (FatMap*)malloc(sizeof(FatMap));
+	if (!fm || !fatMapOpen(fm, !sdnandMode))
+	{
+		free(fm);
+		messageBox("\x1B[31mError:\x1B[33m Could not read the FAT.\n");
+		return;
+	}
+
+	int files = 0;
+	int fragmented = 0;
+
+	for (int i = 0; i < sizeof(dirs) / sizeof(dirs[0]) && !programEnd; i++)
+	{
+		char dirPath[32];
+		sprintf(dirPath, "%s:/title/%s", sdnandMode ? "sd" : "nand", dirs[i]);
+
+		DIR* dir = opendir(dirPath);
+		if (!dir)
+			continue;
+
+		struct dirent* ent;
+		while ((ent = readdir(dir)) && !programEnd)
+		{
+			if (ent->d_type != DT_DIR || ent->d_name[0] == '.')
+				continue;
+
+			char contentPath[64];
+			sprintf(contentPath, "%s/%s/content", dirPath, ent->d_name);
+
+			DIR* content = opendir(contentPath);
+			if (!content)
+				continue;
+
+			struct dirent* app;
+			while ((app = readdir(content)))
+			{
+				if (!strstr(app->d_name, ".app"))
+					continue;
+
+				char appPath[96];
+				sprintf(appPath, "%s/%s", contentPath, app->d_name);
+
+				u32 clusters = 0;
+				u32 fragments = fatMapFragments(fm, getFileCluster(appPath), &clusters);
+
+				files++;
+				if (fragments > 1)
+					fragmented++;
+
+				iprintf("%s", fragments > 1 ? "\x1B[33m" : "");
+				iprintf("%.8s  %.8s  %5lu  %lu\n", ent->d_name, app->d_name, fragments, clusters * fm->bytesPerCluster / 1024);
+				iprintf("\x1B[47m");
+			}
+
+			closedir(content);
+		}
+
+		closedir(dir);
+	}
+
+	free(fm);
+
+	iprintf("\n%d of %d apps fragmented\n", fragmented, files);
+	iprintf("\nBack - [B]\n");
+	keyWait(KEY_B);
+}
+
+//a few LZ blocks, the changed one gets a different pattern
+static bool _backupTestWrite(int changed)
+{
+	FILE* f = fopen(BACKUP_TEST_SRC, "wb");
+	if (!f) return false;
+
+	u8* buffer = (u8*)malloc(LZ_BLOCK_SIZE);
+	bool result = buffer != NULL;
+
+	for (int i = 0; result && i < BACKUP_TEST_BLOCKS; i++)
+	{
+		for (int j = 0; j < LZ_BLOCK_SIZE; j++)
+			buffer[j] = (i == changed) ? j * 7 : (j >> 4) ^ i;
+
+		result = fwrite(buffer, 1, LZ_BLOCK_SIZE, f) == LZ_BLOCK_SIZE;
+	}
+
+	free(buffer);
+	fclose(f);
+	return result;
+}
+
+//the container has to unpack to what the manifest entry hashed
+static bool _backupTestMatches(ManifestEntry const* e)
+{
+	if (!e || lzDecompressFile(BACKUP_TEST_DST, BACKUP_TEST_OUT) != 0)
+		return false;
+
+	FILE* f = fopen(BACKUP_TEST_OUT, "rb");
+	u8* buffer = (u8*)malloc(LZ_BLOCK_SIZE);
+	bool result = f && buffer;
+
+	if (result)
+	{
+		Sha1Context ctx;
+		u8 sha1[MANIFEST_HASH_SIZE];
+		size_t len;
+
+		sha1Init(&ctx);
+		while ((len = fread(buffer, 1, LZ_BLOCK_SIZE, f)) > 0)
+			sha1Update(&ctx, buffer, len);
+		sha1Final(sha1, &ctx);
+
+		result = memcmp(sha1, e->sha1, MANIFEST_HASH_SIZE) == 0;
+	}
+
+	free(buffer);
+	if (f) fclose(f);
+	remove(BACKUP_TEST_OUT);
+	return result;
+}
+
+static void _backupTestResult(char const* name, bool ok)
+{
+	iprintf("%-24s", name);
+	iprintf(ok ? "\x1B[42m" : "\x1B[31m");	//green or red
+	iprintf(ok ? "ok\n" : "FAIL\n");
+	iprintf("\x1B[47m");	//white
+}
+
+static int _backupTestCancelled(Manifest* man)
+{
+	taskBegin(true);
+	taskCancel();
+	int result = manifestBackupFile(man, "bin", BACKUP_TEST_SRC, BACKUP_TEST_DST);
+	taskEnd();
+
+	return result;
+}
+
+//a cancelled backup has to keep the last good container and its hashes
+static void backupCancelCheck()
+{
+	clearScreen(&bottomScreen);
+	clearScreen(&topScreen);
+	iprintf("Backup Cancel Check\n\n");
+
+	mkdir("sd:/_nds/TADDeliveryTool", 0777);
+	mkdir("sd:/_nds/TADDeliveryTool/tmp", 0777);
+
+	Manifest man;
+	manifestInit(&man, 0, 0);
+
+	bool ok = _backupTestWrite(-1) && manifestBackupFile(&man, "bin", BACKUP_TEST_SRC, BACKUP_TEST_DST) == MANIFEST_BACKUP_DONE;
+	ManifestEntry* e = manifestFind(&man, "bin");
+	_backupTestResult("First backup", ok && _backupTestMatches(e));
+
+	if (ok && e)
+	{
+		u8 sha1[MANIFEST_HASH_SIZE];
+		memcpy(sha1, e->sha1, MANIFEST_HASH_SIZE);
+
+		//an update of the existing container, the old index stays
+		ok = _backupTestWrite(1) && _backupTestCancelled(&man) == MANIFEST_BACKUP_CANCELLED;
+		_backupTestResult("Cancelled update", ok && e->blocks && memcmp(e->sha1, sha1, MANIFEST_HASH_SIZE) == 0 && _backupTestMatches(e));
+
+		ok = manifestBackupFile(&man, "bin", BACKUP_TEST_SRC, BACKUP_TEST_DST) == MANIFEST_BACKUP_DONE;
+		_backupTestResult("Update after the cancel", ok && memcmp(e->sha1, sha1, MANIFEST_HASH_SIZE) != 0 && _backupTestMatches(e));
+
+		//without hashes the container is started over, nothing is left to keep
+		manifestFree(&man);
+		manifestInit(&man, 0, 0);
+		ok = _backupTestCancelled(&man) == MANIFEST_BACKUP_CANCELLED;
+		e = manifestFind(&man, "bin");
+		_backupTestResult("Cancelled new backup", ok && e && !e->blocks && access(BACKUP_TEST_DST, F_OK) != 0);
+	}
+
+	manifestFree(&man);
+	remove(BACKUP_TEST_SRC);
+	remove(BACKUP_TEST_DST);
+	rmdir("sd:/_nds/TADDeliveryTool/tmp");
+	rmdir("sd:/_nds/TADDeliveryTool");
+
+	iprintf("\nBack - [B]\n");
+	keyWait(KEY_B);
+}
+
+static void profilerToggle()
+{
+	if (!profilerRunning())
+	{
+		if (choiceBox("Start the sampling profiler?\n\nIt runs until it is stopped\nhere or the app exits.") == NO)
+			return;
+
+		if (!profilerStart())
+			messageBox("\x1B[31mError:\x1B[33m Not enough memory.\n");
+
+		return;
+	}
+
+	u32 samples = profilerSamples();
+
+	if (profilerDump())
+	{
+		char msg[128];
+		sprintf(msg, "%lu samples written to\n%s", samples, PROFILE_PATH);
+		messageBox(msg);
+	}
+	else
+	{
+		messageBox("\x1B[31mError:\x1B[33m Could not write the\nprofile.\n");
+	}
 }
\ No newline at end of file
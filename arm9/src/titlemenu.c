@@ -1,9 +1,14 @@
 #include "main.h"
+#include "defrag.h"
+#include "manifest.h"
 #include "rom.h"
 #include "menu.h"
 #include "message.h"
+#include "nand/crypto.h"
 #include "nand/nandio.h"
+#include "nand/ticket0.h"
 #include "storage.h"
+#include "task.h"
 #include <dirent.h>
 
 enum {
@@ -19,13 +24,18 @@ static void generateList(Menu* m);
 static void printItem(Menu* m);
 static int subMenu();
 static void backup(Menu* m);
+static void _backupFile(char const* src, char const* dst, Manifest* man, char const* ext);
+static void _backupTicket(tDSiHeader* h, char const* dst, Manifest* man);
 static bool delete(Menu* m);
 static void toggleReadOnly(Menu* m);
 
 void titleMenu()
 {
+	if (defragPending() && choiceBox("A defragment run was\ninterrupted. Resume it now?") == YES)
+		defragTitles();
+
 	Menu* m = newMenu();
-	setMenuHeader(m, "INSTALLED TITLES");
+	setMenuHeader(m, "INSTALLED TITLES  Defrag - [Y]");
 	generateList(m);
 
 	//no titles
@@ -52,6 +62,13 @@ void titleMenu()
 			if (keysDown() & KEY_B || m->itemCount <= 0)
 				break;
 
+			//works on every title, so it is not in the title submenu
+			else if (keysDown() & KEY_Y)
+			{
+				defragTitles();
+				printMenu(m);
+			}
+
 			else if (keysDown() & KEY_A)
 			{
 				readOnly = FAT_getAttr(m->items[m->cursor].value) & ATTR_READONLY;
@@ -277,9 +294,13 @@ static void backup(Menu* m)
 {
 	char* fpath = m->items[m->cursor].value;
 	char *backname = NULL;
+	bool update = false;
 
 	tDSiHeader* h = getRomHeader(fpath);
 
+	Manifest* man = (Manifest*)malloc(sizeof(Manifest));
+	manifestInit(man, h->tid_high, h->tid_low);
+
 	{
 		//make backup folder name
 		char label[13];
@@ -293,14 +314,25 @@ static void backup(Menu* m)
 
 		//make sure dir is unused
 		char* dstpath = (char*)malloc(strlen(BACKUP_PATH) + strlen(backname) + 32);
-		sprintf(dstpath, "%s/%s.nds", BACKUP_PATH, backname);
+		sprintf(dstpath, "%s/%s.tlz", BACKUP_PATH, backname);
 
 		int try = 1;
 		while (access(dstpath, F_OK) == 0)
 		{
+			//an earlier backup of the same title is updated in place
+			strcpy(strrchr(dstpath, '.'), ".man");
+			if (manifestLoad(man, dstpath) && man->tidHigh == h->tid_high && man->tidLow == h->tid_low)
+			{
+				update = true;
+				break;
+			}
+
+			manifestFree(man);
+			manifestInit(man, h->tid_high, h->tid_low);
+
 			try += 1;
 			sprintf(backname, "%s-%s(%d)", label, gamecode, try);
-			sprintf(dstpath, "%s/%s.nds", BACKUP_PATH, backname);
+			sprintf(dstpath, "%s/%s.tlz", BACKUP_PATH, backname);
 		}
 
 		free(dstpath);
@@ -308,7 +340,7 @@ static void backup(Menu* m)
 
 	bool choice = NO;
 	{
-		const char str[] = "Are you sure you want to backup\n";
+		const char* str = update ? "Are you sure you want to update\n" : "Are you sure you want to backup\n";
 		char* msg = (char*)malloc(strlen(str) + strlen(backname) + 2);
 		sprintf(msg, "%s%s?", str, backname);
 
@@ -344,6 +376,8 @@ static void backup(Menu* m)
 			}
 
 			clearScreen(&bottomScreen);
+			iprintf("Cancel - hold [B]\n\n");
+			taskBegin(true);
 
 			char path[256], dstpath[256];
 
@@ -361,17 +395,13 @@ static void backup(Menu* m)
 					fread(&appVersion, 1, 4, tmd);
 					fclose(tmd);
 
-					iprintf("%s -> \n%s...\n", path, dstpath);
-					copyFile(path, dstpath);
+					_backupFile(path, dstpath, man, "tmd");
 
 					//app
 					sprintf(path, "%s/content/%02x%02x%02x%02x.app", srcpath, appVersion[0], appVersion[1], appVersion[2], appVersion[3]);
-					sprintf(dstpath, "%s/%s.nds", BACKUP_PATH, backname);
+					sprintf(dstpath, "%s/%s.tlz", BACKUP_PATH, backname);
 					if (access(path, F_OK) == 0)
-					{
-						iprintf("%s -> \n%s...\n", path, dstpath);
-						copyFile(path, dstpath);
-					}
+						_backupFile(path, dstpath, man, "tlz");
 				}
 			}
 
@@ -379,33 +409,38 @@ static void backup(Menu* m)
 			sprintf(path, "%s/data/public.sav", srcpath);
 			sprintf(dstpath, "%s/%s.pub", BACKUP_PATH, backname);
 			if (access(path, F_OK) == 0)
-			{
-				iprintf("%s -> \n%s...\n", path, dstpath);
-				copyFile(path, dstpath);
-			}
+				_backupFile(path, dstpath, man, "pub");
 
 			//private save
 			sprintf(path, "%s/data/private.sav", srcpath);
 			sprintf(dstpath, "%s/%s.prv", BACKUP_PATH, backname);
 			if (access(path, F_OK) == 0)
-			{
-				iprintf("%s -> \n%s...\n", path, dstpath);
-				copyFile(path, dstpath);
-			}
+				_backupFile(path, dstpath, man, "prv");
 
 			//banner save
 			sprintf(path, "%s/data/banner.sav", srcpath);
 			sprintf(dstpath, "%s/%s.bnr", BACKUP_PATH, backname);
 			if (access(path, F_OK) == 0)
-			{
-				iprintf("%s -> \n%s...\n", path, dstpath);
-				copyFile(path, dstpath);
-			}
+				_backupFile(path, dstpath, man, "bnr");
+
+			//ticket
+			sprintf(dstpath, "%s/%s.tik", BACKUP_PATH, backname);
+			_backupTicket(h, dstpath, man);
 
-			messagePrint("\x1B[42m\nBackup finished.\x1B[47m");
+			sprintf(dstpath, "%s/%s.man", BACKUP_PATH, backname);
+			if (!manifestSave(man, dstpath))
+				remove(dstpath);
+
+			if (taskEnd())
+				messagePrint("\x1B[33m\nBackup cancelled.\x1B[47m");
+			else
+				messagePrint("\x1B[42m\nBackup finished.\x1B[47m");
 		}
 	}
 
+	manifestFree(man);
+	free(man);
+	free(backname);
 	free(h);
 }
 
@@ -451,17 +486,15 @@ static bool delete(Menu* m)
 				if (!sdnandMode && !nandio_unlock_writing())
 					return false;
 
+				//not cancellable, stopping between the content files would
+				//leave a title the system menu cannot load or remove
 				clearScreen(&bottomScreen);
+				result = deleteDir(dirPath);
 
-				if (deleteDir(dirPath))
-				{
-					result = true;
+				if (result)
 					messagePrint("\nTitle deleted.\n");
-				}
 				else
-				{
 					messagePrint("\nTitle could not be deleted.\n");
-				}
 
 				if (!sdnandMode)
 					nandio_lock_writing();
@@ -516,3 +549,96 @@ static void toggleReadOnly(Menu* m)
 
 	messageBox("Title's read-only status\nsuccesfully toggled.");
 }
+
+static void _backupResult(int result)
+{
+	if (result == MANIFEST_BACKUP_FAILED)
+	{
+		iprintf("\x1B[31m");	//red
+		iprintf("Failed\n");
+		iprintf("\x1B[47m");	//white
+	}
+	else if (result == MANIFEST_BACKUP_UNCHANGED)
+	{
+		iprintf("\x1B[33m");	//yellow
+		iprintf("Unchanged\n");
+		iprintf("\x1B[47m");	//white
+	}
+	else if (result == MANIFEST_BACKUP_CANCELLED)
+	{
+		iprintf("\x1B[33m");	//yellow
+		iprintf("Cancelled\n");
+		iprintf("\x1B[47m");	//white
+	}
+	else
+	{
+		iprintf("\x1B[42m");	//green
+		iprintf("Done\n");
+		iprintf("\x1B[47m");	//white
+	}
+}
+
+//every backup file is stored in the block LZ container, the app as .tlz
+static void _backupFile(char const* src, char const* dst, Manifest* man, char const* ext)
+{
+	//after a cancel the files not reached keep their last backup
+	if (taskStopped())
+		return;
+
+	iprintf("%s -> \n%s...", src, dst);
+	swiWaitForVBlank();
+
+	_backupResult(manifestBackupFile(man, ext, src, dst));
+}
+
+//stored decrypted, in the same form a TAD carries it
+static void _backupTicket(tDSiHeader* h, char const* dst, Manifest* man)
+{
+	if (taskStopped())
+		return;
+
+	char path[64];
+	sprintf(path, "%s:/ticket/%08lx/%08lx.tik", sdnandMode ? "sd" : "nand", h->tid_high, h->tid_low);
+
+	const u32 encryptedSize = sizeof(ticket_v0_t) + 0x20;
+	if (getFileSizePath(path) != encryptedSize)
+		return;
+
+	iprintf("%s -> \n%s...", path, dst);
+	swiWaitForVBlank();
+
+	int result = -1;
+	u8* buffer = (u8*)memalign(4, encryptedSize);
+
+	FILE* f = fopen(path, "rb");
+	if (f)
+	{
+		if (fread(buffer, 1, encryptedSize, f) == encryptedSize && dsi_es_block_crypt(buffer, encryptedSize, DECRYPT) == 0)
+			result = 0;
+
+		fclose(f);
+	}
+
+	if (result == 0)
+	{
+		mkdir("sd:/_nds/TADDeliveryTool", 0777);
+		mkdir("sd:/_nds/TADDeliveryTool/tmp", 0777);
+
+		f = fopen("sd:/_nds/TADDeliveryTool/tmp/backup.tik", "wb");
+		if (!f || fwrite(buffer, 1, sizeof(ticket_v0_t), f) != sizeof(ticket_v0_t))
+			result = -1;
+
+		if (f) fclose(f);
+
+		if (result == 0)
+			result = manifestBackupFile(man, "tik", "sd:/_nds/TADDeliveryTool/tmp/backup.tik", dst);
+
+		remove("sd:/_nds/TADDeliveryTool/tmp/backup.tik");
+		rmdir("sd:/_nds/TADDeliveryTool/tmp");
+		rmdir("sd:/_nds/TADDeliveryTool");
+	}
+
+	free(buffer);
+
+	_backupResult(result);
+}
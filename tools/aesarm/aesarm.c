@@ -0,0 +1,293 @@
+/*
+	Checks the ARM mode AES core against the PolarSSL C code it replaces.
+
+	aes.o and dsi.o are built with AES_ASM, so their word aligned paths go
+	to aes_arm.s. The ref_ objects are the same sources built without it.
+	Every mode is run over random keys, lengths and alignments, in place
+	and not, then both builds are timed. Under qemu-arm the times only say
+	how the two compare, not how fast a DSi is.
+
+	Exits non-zero if any output differs.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "polarssl/aes.h"
+#include "twltool/dsi.h"
+
+#define TEST_SIZE     4096
+#define TEST_ROUNDS   200
+#define BENCH_SIZE    (64 * 1024)
+#define BENCH_MIN_NS  500000000ULL
+
+int ref_aes_setkey_enc(aes_context* ctx, const unsigned char* key, int keysize);
+int ref_aes_setkey_dec(aes_context* ctx, const unsigned char* key, int keysize);
+int ref_aes_crypt_ecb(aes_context* ctx, int mode, const unsigned char input[16], unsigned char output[16]);
+int ref_aes_crypt_cbc(aes_context* ctx, int mode, int length, unsigned char iv[16],
+					  const unsigned char* input, unsigned char* output);
+void ref_dsi_set_key(dsi_context* ctx, const unsigned char key[16]);
+void ref_dsi_set_ctr(dsi_context* ctx, const unsigned char ctr[16]);
+void ref_dsi_crypt_ctr(dsi_context* ctx, const void* in, void* out, unsigned int len);
+
+static unsigned char bufIn[BENCH_SIZE + 16] __attribute__((aligned(16)));
+static unsigned char bufOut[BENCH_SIZE + 16] __attribute__((aligned(16)));
+static unsigned char bufRef[BENCH_SIZE + 16] __attribute__((aligned(16)));
+
+static int failures = 0;
+
+static void _random(unsigned char* out, int len)
+{
+	for (int i = 0; i < len; i++)
+		out[i] = rand();
+}
+
+static void _expect(char const* name, int round, unsigned char const* got, unsigned char const* want, int len)
+{
+	if (memcmp(got, want, len) == 0)
+		return;
+
+	int at = 0;
+	while (got[at] == want[at])
+		at++;
+
+	printf("  FAIL  %s, round %d, first difference at byte %d\n", name, round, at);
+	failures++;
+}
+
+//key sizes other than 128 only exercise the round count, the DSi has no use for them
+static int _keyBits(int round)
+{
+	static const int bits[] = { 128, 128, 192, 256 };
+	return bits[round % 4];
+}
+
+static void _checkEcb()
+{
+	int before = failures;
+
+	for (int round = 0; round < TEST_ROUNDS; round++)
+	{
+		unsigned char key[32];
+		_random(key, sizeof(key));
+		_random(bufIn, TEST_SIZE);
+
+		aes_context ctx, ref;
+		int mode = (round & 1) ? AES_DECRYPT : AES_ENCRYPT;
+
+		if (mode == AES_ENCRYPT)
+		{
+			aes_setkey_enc(&ctx, key, _keyBits(round));
+			ref_aes_setkey_enc(&ref, key, _keyBits(round));
+		}
+		else
+		{
+			aes_setkey_dec(&ctx, key, _keyBits(round));
+			ref_aes_setkey_dec(&ref, key, _keyBits(round));
+		}
+
+		for (int i = 0; i < TEST_SIZE; i += 16)
+		{
+			aes_crypt_ecb(&ctx, mode, bufIn + i, bufOut + i);
+			ref_aes_crypt_ecb(&ref, mode, bufIn + i, bufRef + i);
+		}
+
+		_expect(mode == AES_ENCRYPT ? "ecb encrypt" : "ecb decrypt", round, bufOut, bufRef, TEST_SIZE);
+	}
+
+	printf("  %s  ecb\n", failures == before ? "ok  " : "FAIL");
+}
+
+static void _checkCbcDecrypt()
+{
+	int before = failures;
+
+	for (int round = 0; round < TEST_ROUNDS; round++)
+	{
+		unsigned char key[32], iv[16], refIv[16];
+		_random(key, sizeof(key));
+		_random(iv, sizeof(iv));
+		memcpy(refIv, iv, sizeof(iv));
+
+		//odd rounds are misaligned and take the C path, which must still agree
+		int offset = (round & 1) ? 1 + round % 3 : 0;
+		int len = 16 * (1 + rand() % (TEST_SIZE / 16 - 1));
+		bool inPlace = round % 4 == 2;
+
+		_random(bufIn + offset, len);
+		memcpy(bufRef, bufIn + offset, len);
+		if (inPlace)
+			memcpy(bufOut + offset, bufIn + offset, len);
+
+		aes_context ctx, ref;
+		aes_setkey_dec(&ctx, key, _keyBits(round));
+		ref_aes_setkey_dec(&ref, key, _keyBits(round));
+
+		aes_crypt_cbc(&ctx, AES_DECRYPT, len, iv, inPlace ? bufOut + offset : bufIn + offset, bufOut + offset);
+		ref_aes_crypt_cbc(&ref, AES_DECRYPT, len, refIv, bufRef, bufRef);
+
+		_expect("cbc decrypt", round, bufOut + offset, bufRef, len);
+		_expect("cbc decrypt iv", round, iv, refIv, 16);
+	}
+
+	printf("  %s  cbc decrypt\n", failures == before ? "ok  " : "FAIL");
+}
+
+static void _checkCtr()
+{
+	int before = failures;
+
+	for (int round = 0; round < TEST_ROUNDS; round++)
+	{
+		unsigned char key[16], ctr[16];
+		_random(key, sizeof(key));
+		_random(ctr, sizeof(ctr));
+
+		//push the counter close to a carry through several bytes
+		if (round % 3 == 0)
+			memset(ctr, 0xFF, 1 + round % 16);
+
+		int offset = (round & 1) ? 2 : 0;
+		int len = 16 * (1 + rand() % (TEST_SIZE / 16 - 1));
+		_random(bufIn + offset, len);
+
+		dsi_context ctx, ref;
+		dsi_set_key(&ctx, key);
+		dsi_set_ctr(&ctx, ctr);
+		ref_dsi_set_key(&ref, key);
+		ref_dsi_set_ctr(&ref, ctr);
+
+		//two calls, so the counter left by the first one is checked too
+		int half = (len / 32) * 16;
+		dsi_crypt_ctr(&ctx, bufIn + offset, bufOut + offset, half);
+		dsi_crypt_ctr(&ctx, bufIn + offset + half, bufOut + offset + half, len - half);
+		ref_dsi_crypt_ctr(&ref, bufIn + offset, bufRef, len);
+
+		_expect("dsi ctr", round, bufOut + offset, bufRef, len);
+		_expect("dsi ctr counter", round, ctx.ctr, ref.ctr, 16);
+	}
+
+	printf("  %s  dsi ctr\n", failures == before ? "ok  " : "FAIL");
+}
+
+/************************ Benchmarks ******************************************/
+
+static unsigned long long _now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+typedef void (*BenchFunc)(int useAsm, unsigned int size);
+
+static aes_context benchEnc, benchDec, refEnc, refDec;
+static dsi_context benchCtr, refCtr;
+
+static double _mbps(BenchFunc func, int useAsm)
+{
+	unsigned long long bytes = 0;
+	unsigned long long start = _now();
+	unsigned long long elapsed = 0;
+
+	do {
+		func(useAsm, BENCH_SIZE);
+		bytes += BENCH_SIZE;
+		elapsed = _now() - start;
+	} while (elapsed < BENCH_MIN_NS);
+
+	return (bytes / 1048576.0) / (elapsed / 1e9);
+}
+
+static void _bench(char const* name, BenchFunc func)
+{
+	double c = _mbps(func, 0);
+	double a = _mbps(func, 1);
+	printf("  %-14s %9.2f MB/s C %9.2f MB/s asm  x%.2f\n", name, c, a, a / c);
+}
+
+static void _ecbEncrypt(int useAsm, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; i += 16)
+	{
+		if (useAsm)
+			aes_crypt_ecb(&benchEnc, AES_ENCRYPT, bufIn + i, bufOut + i);
+		else
+			ref_aes_crypt_ecb(&refEnc, AES_ENCRYPT, bufIn + i, bufOut + i);
+	}
+}
+
+static void _ecbDecrypt(int useAsm, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; i += 16)
+	{
+		if (useAsm)
+			aes_crypt_ecb(&benchDec, AES_DECRYPT, bufIn + i, bufOut + i);
+		else
+			ref_aes_crypt_ecb(&refDec, AES_DECRYPT, bufIn + i, bufOut + i);
+	}
+}
+
+static void _cbcDecrypt(int useAsm, unsigned int size)
+{
+	unsigned char iv[16] = { 0 };
+
+	if (useAsm)
+		aes_crypt_cbc(&benchDec, AES_DECRYPT, size, iv, bufIn, bufOut);
+	else
+		ref_aes_crypt_cbc(&refDec, AES_DECRYPT, size, iv, bufIn, bufOut);
+}
+
+static void _ctr(int useAsm, unsigned int size)
+{
+	if (useAsm)
+		dsi_crypt_ctr(&benchCtr, bufIn, bufOut, size);
+	else
+		ref_dsi_crypt_ctr(&refCtr, bufIn, bufOut, size);
+}
+
+static void _runBenchmarks()
+{
+	unsigned char key[16], ctr[16];
+	_random(key, sizeof(key));
+	_random(ctr, sizeof(ctr));
+	_random(bufIn, BENCH_SIZE);
+
+	aes_setkey_enc(&benchEnc, key, 128);
+	aes_setkey_dec(&benchDec, key, 128);
+	ref_aes_setkey_enc(&refEnc, key, 128);
+	ref_aes_setkey_dec(&refDec, key, 128);
+	dsi_set_key(&benchCtr, key);
+	dsi_set_ctr(&benchCtr, ctr);
+	ref_dsi_set_key(&refCtr, key);
+	ref_dsi_set_ctr(&refCtr, ctr);
+
+	_bench("ecb encrypt", _ecbEncrypt);
+	_bench("ecb decrypt", _ecbDecrypt);
+	_bench("cbc decrypt", _cbcDecrypt);
+	_bench("dsi ctr", _ctr);
+}
+
+int main(int argc, char** argv)
+{
+	srand(argc > 1 ? atoi(argv[1]) : 1);
+
+	printf("vectors\n");
+	_checkEcb();
+	_checkCbcDecrypt();
+	_checkCtr();
+
+	if (failures)
+	{
+		printf("%d failed\n", failures);
+		return 1;
+	}
+
+	printf("benchmarks, 128 bit keys\n");
+	_runBenchmarks();
+	return 0;
+}
@@ -0,0 +1,628 @@
+#!/usr/bin/env python3
+"""
+Runs the ARM mode AES core in arm9/src/nand/aes_arm.s on a small ARMv5
+interpreter and checks it against the PolarSSL C code, for when there is
+no ARM toolchain or qemu-arm to run aesarm.c with.
+
+  armsim.py aes_arm.o libsimref.so
+  armsim.py -r 20 -s 2 aes_arm.o libsimref.so
+
+The object is the assembled aes_arm.s (built with CRYPTO_TCM_OFF so it is
+all .text), the library is simref.c built for the host. Only the
+instructions aes_arm.s uses are implemented, anything else stops the run.
+
+The speed is a cycle count on an ARM946E-S model with everything in TCM:
+one cycle per instruction, load-use interlocks, LDM/STM by register
+count and taken branches. Cache misses and the real pipeline are not
+modelled, so it is an estimate to compare builds, not a measurement.
+"""
+
+import argparse
+import ctypes
+import random
+import struct
+import sys
+
+ARM9_HZ = 67027964
+
+CODE_BASE = 0x00001000
+TABLE_BASE = 0x00010000
+DATA_BASE = 0x00020000
+STACK_TOP = 0x000F0000
+MEM_SIZE = 0x00100000
+RETURN = 0xFFFFFFF0
+
+MASK = 0xFFFFFFFF
+
+
+class Fault(Exception):
+    pass
+
+
+def load_object(path):
+    """.text of an ARM ELF relocatable, its symbols and relocations"""
+    with open(path, "rb") as f:
+        elf = f.read()
+
+    if elf[:4] != b"\x7fELF" or elf[4] != 1 or elf[5] != 1:
+        raise Fault("%s is not a 32 bit little endian ELF" % path)
+
+    shoff, = struct.unpack_from("<I", elf, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x2E)
+    sections = [struct.unpack_from("<IIIIIIIIII", elf, shoff + i * shentsize) for i in range(shnum)]
+
+    def name(strtab, offset):
+        start = sections[strtab][4] + offset
+        return elf[start:elf.index(b"\0", start)].decode()
+
+    text = None
+    for i, s in enumerate(sections):
+        if name(shstrndx, s[0]) == ".text":
+            text = i
+    if text is None:
+        raise Fault("no .text in %s" % path)
+
+    code = bytearray(elf[sections[text][4]:sections[text][4] + sections[text][5]])
+
+    symbols = []
+    relocs = []
+    for s in sections:
+        if s[1] == 2:
+            for off in range(s[4], s[4] + s[5], 16):
+                st_name, value, size, info, other, shndx = struct.unpack_from("<IIIBBH", elf, off)
+                symbols.append((name(s[6], st_name), value, shndx))
+        elif s[1] == 9 and s[7] == text:
+            for off in range(s[4], s[4] + s[5], 8):
+                relocs.append(struct.unpack_from("<II", elf, off))
+
+    return code, text, symbols, relocs
+
+
+def link(code, text, symbols, relocs, externals):
+    """places .text at CODE_BASE, returns the global functions"""
+    def address(sym):
+        name, value, shndx = symbols[sym]
+        if shndx == text:
+            return CODE_BASE + value
+        if name in externals:
+            return externals[name]
+        raise Fault("undefined symbol %s" % name)
+
+    for offset, info in relocs:
+        kind = info & 0xFF
+        target = address(info >> 8)
+        place = CODE_BASE + offset
+        word, = struct.unpack_from("<I", code, offset)
+
+        if kind == 2:  # R_ARM_ABS32
+            word = (word + target) & MASK
+        elif kind in (28, 29):  # R_ARM_CALL, R_ARM_JUMP24
+            addend = ((word & 0xFFFFFF) ^ 0x800000) - 0x800000
+            delta = target + (addend << 2) - place
+            word = (word & 0xFF000000) | ((delta >> 2) & 0xFFFFFF)
+        else:
+            raise Fault("relocation type %d not handled" % kind)
+
+        struct.pack_into("<I", code, offset, word)
+
+    return {name: CODE_BASE + value for name, value, shndx in symbols
+            if shndx == text and not name.startswith("$")}
+
+
+def _ror(x, n):
+    n &= 31
+    return ((x >> n) | (x << (32 - n))) & MASK if n else x
+
+
+class Arm:
+    """just enough ARMv5 for aes_arm.s, with a rough ARM946E-S cycle count"""
+
+    def __init__(self):
+        self.mem = bytearray(MEM_SIZE)
+        self.r = [0] * 16
+        self.n = self.z = self.c = self.v = False
+        self.cycles = 0
+        self.ready = [0] * 16
+        self.decoded = {}
+
+    # memory
+
+    def _check(self, addr, size):
+        if addr + size > MEM_SIZE or addr & (size - 1):
+            raise Fault("bad %d byte access at %08X, pc %08X" % (size, addr, self.r[15]))
+
+    def read32(self, addr):
+        self._check(addr, 4)
+        return struct.unpack_from("<I", self.mem, addr)[0]
+
+    def write32(self, addr, value):
+        self._check(addr, 4)
+        struct.pack_into("<I", self.mem, addr, value & MASK)
+
+    def read8(self, addr):
+        self._check(addr, 1)
+        return self.mem[addr]
+
+    def write8(self, addr, value):
+        self._check(addr, 1)
+        self.mem[addr] = value & 0xFF
+
+    def write(self, addr, data):
+        self._check(addr, 1)
+        self.mem[addr:addr + len(data)] = data
+
+    def read(self, addr, size):
+        return bytes(self.mem[addr:addr + size])
+
+    # decoding
+
+    def _cond(self, cond):
+        if cond == 0xE:
+            return True
+        if cond == 0x0:
+            return self.z
+        if cond == 0x1:
+            return not self.z
+        if cond == 0x2:
+            return self.c
+        if cond == 0x3:
+            return not self.c
+        if cond == 0x4:
+            return self.n
+        if cond == 0x5:
+            return not self.n
+        if cond == 0xA:
+            return self.n == self.v
+        if cond == 0xB:
+            return self.n != self.v
+        raise Fault("condition %X not handled" % cond)
+
+    def _shift(self, value, kind, amount, carry):
+        """immediate shift of a register, returns the value and the carry out"""
+        if kind == 0:
+            if amount == 0:
+                return value, carry
+            return (value << amount) & MASK, bool((value >> (32 - amount)) & 1)
+        if kind == 1:
+            amount = amount or 32
+            return (value >> amount) if amount < 32 else 0, bool((value >> (amount - 1)) & 1)
+        if kind == 2:
+            amount = amount or 32
+            signed = value - (1 << 32) if value & 0x80000000 else value
+            return (signed >> min(amount, 31)) & MASK, bool((signed >> (amount - 1)) & 1)
+        if amount == 0:
+            return ((value >> 1) | (carry << 31)) & MASK, bool(value & 1)
+        return _ror(value, amount), bool((value >> (amount - 1)) & 1)
+
+    def _decode(self, addr):
+        w = self.read32(addr)
+        cond = w >> 28
+        if cond == 0xF:
+            raise Fault("unconditional space %08X at %08X" % (w, addr))
+
+        if (w >> 25) & 7 == 0b101:
+            offset = ((w & 0xFFFFFF) ^ 0x800000) - 0x800000
+            return ("b", cond, bool(w & (1 << 24)), (addr + 8 + (offset << 2)) & MASK)
+
+        if (w >> 26) & 3 == 0:
+            if not w & (1 << 25) and w & 0x10:
+                raise Fault("register shift or multiply %08X at %08X" % (w, addr))
+            op = (w >> 21) & 0xF
+            if w & (1 << 25):
+                rot = ((w >> 8) & 0xF) * 2
+                operand = ("imm", _ror(w & 0xFF, rot), rot != 0)
+            else:
+                operand = ("reg", w & 0xF, (w >> 5) & 3, (w >> 7) & 31)
+            return ("dp", cond, op, bool(w & (1 << 20)), (w >> 16) & 0xF, (w >> 12) & 0xF, operand)
+
+        if (w >> 26) & 3 == 1:
+            if w & (1 << 25):
+                if w & 0x10:
+                    raise Fault("media instruction %08X at %08X" % (w, addr))
+                offset = ("reg", w & 0xF, (w >> 5) & 3, (w >> 7) & 31)
+            else:
+                offset = ("imm", w & 0xFFF)
+            return ("mem", cond, bool(w & (1 << 24)), bool(w & (1 << 23)), bool(w & (1 << 22)),
+                    bool(w & (1 << 21)), bool(w & (1 << 20)), (w >> 16) & 0xF, (w >> 12) & 0xF, offset)
+
+        if (w >> 25) & 7 == 0b100:
+            if w & (1 << 22):
+                raise Fault("user bank LDM/STM %08X at %08X" % (w, addr))
+            regs = [i for i in range(16) if w & (1 << i)]
+            return ("block", cond, bool(w & (1 << 24)), bool(w & (1 << 23)), bool(w & (1 << 21)),
+                    bool(w & (1 << 20)), (w >> 16) & 0xF, regs)
+
+        raise Fault("instruction %08X at %08X not handled" % (w, addr))
+
+    # execution
+
+    def _get(self, reg, pc):
+        return (pc + 8) & MASK if reg == 15 else self.r[reg]
+
+    def _wait(self, regs):
+        """stall until the registers are ready"""
+        for reg in regs:
+            if self.ready[reg] > self.cycles:
+                self.cycles = self.ready[reg]
+
+    def step(self):
+        pc = self.r[15]
+        ins = self.decoded.get(pc)
+        if ins is None:
+            ins = self.decoded[pc] = self._decode(pc)
+
+        kind, cond = ins[0], ins[1]
+        if not self._cond(cond):
+            self.cycles += 1
+            self.r[15] = pc + 4
+            return
+
+        if kind == "b":
+            if ins[2]:
+                self.r[14] = pc + 4
+            self.r[15] = ins[3]
+            self.cycles += 3
+            return
+
+        if kind == "dp":
+            self._data(ins, pc)
+        elif kind == "mem":
+            self._memory(ins, pc)
+        else:
+            self._block(ins, pc)
+
+    def _data(self, ins, pc):
+        _, _, op, s, rn, rd, operand = ins
+
+        if operand[0] == "imm":
+            self._wait([rn])
+            value, carry = operand[1], self.c
+            if operand[2]:
+                carry = bool(value & 0x80000000)
+        else:
+            self._wait([rn, operand[1]])
+            value, carry = self._shift(self._get(operand[1], pc), operand[2], operand[3], self.c)
+
+        a = self._get(rn, pc)
+        logical = True
+        if op == 0x0 or op == 0x8:
+            result = a & value
+        elif op == 0x1 or op == 0x9:
+            result = a ^ value
+        elif op == 0xC:
+            result = a | value
+        elif op == 0xD:
+            result = value
+        elif op == 0xE:
+            result = a & ~value & MASK
+        elif op == 0xF:
+            result = ~value & MASK
+        elif op in (0x2, 0xA):
+            logical = False
+            result, carry, overflow = self._add(a, ~value & MASK, 1)
+        elif op == 0x3:
+            logical = False
+            result, carry, overflow = self._add(value, ~a & MASK, 1)
+        elif op in (0x4, 0xB):
+            logical = False
+            result, carry, overflow = self._add(a, value, 0)
+        else:
+            raise Fault("data processing op %X at %08X not handled" % (op, pc))
+
+        if s:
+            self.n = bool(result & 0x80000000)
+            self.z = result == 0
+            self.c = carry
+            if not logical:
+                self.v = overflow
+
+        self.cycles += 1
+        if op in (0x8, 0x9, 0xA, 0xB):
+            self.r[15] = pc + 4
+            return
+
+        if rd == 15:
+            self.r[15] = result & ~3
+            self.cycles += 2
+            return
+
+        self.r[rd] = result
+        self.r[15] = pc + 4
+
+    @staticmethod
+    def _add(a, b, carry):
+        total = a + b + carry
+        result = total & MASK
+        overflow = bool((~(a ^ b) & (a ^ result)) & 0x80000000)
+        return result, total > MASK, overflow
+
+    def _memory(self, ins, pc):
+        _, _, pre, up, byte, wback, load, rn, rd, offset = ins
+
+        if offset[0] == "imm":
+            self._wait([rn] if load else [rn, rd])
+            value = offset[1]
+        else:
+            self._wait([rn, offset[1]] if load else [rn, offset[1], rd])
+            value = self._shift(self._get(offset[1], pc), offset[2], offset[3], self.c)[0]
+
+        base = self._get(rn, pc)
+        moved = (base + value if up else base - value) & MASK
+        addr = moved if pre else base
+
+        if load:
+            data = self.read8(addr) if byte else self.read32(addr)
+        elif byte:
+            self.write8(addr, self._get(rd, pc))
+        else:
+            self.write32(addr, self._get(rd, pc))
+
+        if wback or not pre:
+            self.r[rn] = moved
+
+        self.cycles += 1
+        self.r[15] = pc + 4
+
+        if load:
+            if rd == 15:
+                self.r[15] = data & ~3
+                self.cycles += 4
+            else:
+                self.r[rd] = data
+                #the result can be used one cycle later, two for a byte
+                self.ready[rd] = self.cycles + (2 if byte else 1)
+
+    def _block(self, ins, pc):
+        _, _, pre, up, wback, load, rn, regs = ins
+        self._wait([rn] if load else [rn] + regs)
+
+        base = self.r[rn]
+        count = len(regs)
+        start = base if up else base - 4 * count
+        if pre == up:
+            start += 4
+
+        data = []
+        for i, reg in enumerate(regs):
+            addr = (start + 4 * i) & MASK
+            if load:
+                data.append(self.read32(addr))
+            else:
+                self.write32(addr, self._get(reg, pc))
+
+        if wback:
+            self.r[rn] = (base + 4 * count if up else base - 4 * count) & MASK
+
+        self.cycles += max(count, 2)
+        self.r[15] = pc + 4
+
+        if load:
+            for reg, value in zip(regs, data):
+                if reg == 15:
+                    self.r[15] = value & ~3
+                    self.cycles += 4
+                else:
+                    self.r[reg] = value
+            if regs[-1] != 15:
+                self.ready[regs[-1]] = self.cycles + 1
+
+    def call(self, func, *args, limit=50000000):
+        """AAPCS call, checks that r4-r11 and sp come back intact"""
+        sp = STACK_TOP
+        stacked = list(args[4:])
+        sp -= 4 * len(stacked)
+        for i, value in enumerate(stacked):
+            self.write32(sp + 4 * i, value)
+
+        saved = [random.getrandbits(32) for _ in range(8)]
+        self.r = list(args[:4]) + [0] * (4 - min(len(args), 4)) + saved + [0, sp, RETURN, func]
+        self.ready = [0] * 16
+
+        start = self.cycles
+        for _ in range(limit):
+            if self.r[15] == RETURN:
+                break
+            self.step()
+        else:
+            raise Fault("no return after %d instructions" % limit)
+
+        if self.r[4:12] != saved:
+            raise Fault("%08X does not preserve r4-r11" % func)
+        if self.r[13] != sp:
+            raise Fault("%08X returns with sp %08X, not %08X" % (func, self.r[13], sp))
+
+        return self.cycles - start
+
+
+class Sim:
+    def __init__(self, obj, lib):
+        self.ref = ctypes.CDLL(lib)
+        self.cpu = Arm()
+
+        tables = (ctypes.c_uint32 * 2048)()
+        fsb = (ctypes.c_ubyte * 256)()
+        rsb = (ctypes.c_ubyte * 256)()
+        self.tables = self.ref.sim_tables(tables, fsb, rsb)
+
+        #T0-T3 then the S-box each way, with the pointer arrays aes.c gives the core
+        externals = {}
+        addr = TABLE_BASE
+        for name, first, sbox in (("aes_arm_ftab", 0, fsb), ("aes_arm_rtab", 1024, rsb)):
+            pointers = []
+            for t in range(4):
+                if t < self.tables:
+                    self.cpu.write(addr, struct.pack("<256I", *tables[first + 256 * t:first + 256 * (t + 1)]))
+                    pointers.append(addr)
+                    addr += 1024
+                else:
+                    pointers.append(pointers[0])
+            self.cpu.write(addr, bytes(sbox))
+            pointers.append(addr)
+            addr += 256
+            self.cpu.write(addr, struct.pack("<5I", *pointers))
+            externals[name] = addr
+            addr += 32
+
+        code, text, symbols, relocs = load_object(obj)
+        self.funcs = link(code, text, symbols, relocs, externals)
+        self.cpu.write(CODE_BASE, code)
+
+        for name in ("aes_arm_encrypt", "aes_arm_decrypt", "aes_arm_cbc_decrypt", "aes_arm_ctr"):
+            if name not in self.funcs:
+                raise Fault("%s not in %s, was it built with AES_ASM?" % (name, obj))
+
+        self.rk = DATA_BASE
+        self.iv = DATA_BASE + 0x200
+        self.src = DATA_BASE + 0x400
+        self.dst = self.src + 0x10000
+
+    def setkey(self, decrypt, key, bits):
+        rk = (ctypes.c_uint32 * 68)()
+        nr = self.ref.sim_setkey(decrypt, key, bits, rk)
+        self.cpu.write(self.rk, struct.pack("<68I", *rk))
+        return nr
+
+    def ecb(self, decrypt, key, bits, data):
+        nr = self.setkey(decrypt, key, bits)
+        func = self.funcs["aes_arm_decrypt" if decrypt else "aes_arm_encrypt"]
+        self.cpu.write(self.src, data)
+
+        cycles = 0
+        for i in range(0, len(data), 16):
+            cycles += self.cpu.call(func, self.rk, nr, self.src + i, self.dst + i)
+
+        return self.cpu.read(self.dst, len(data)), cycles
+
+    def cbc_decrypt(self, key, bits, iv, data, in_place):
+        nr = self.setkey(True, key, bits)
+        out = self.src if in_place else self.dst
+        self.cpu.write(self.iv, iv)
+        self.cpu.write(self.src, data)
+
+        cycles = self.cpu.call(self.funcs["aes_arm_cbc_decrypt"], self.rk, nr, self.iv, self.src, out, len(data) // 16)
+        return self.cpu.read(out, len(data)), self.cpu.read(self.iv, 16), cycles
+
+    def ctr(self, key, ctr, data, split):
+        #dsi_set_key() takes the key in the DSi byte order
+        nr = self.setkey(False, key[::-1], 128)
+        self.cpu.write(self.iv, ctr)
+        self.cpu.write(self.src, data)
+
+        #two calls, so the counter left by the first one is checked too
+        cycles = 0
+        for start, end in ((0, split), (split, len(data))):
+            cycles += self.cpu.call(self.funcs["aes_arm_ctr"], self.rk, nr, self.iv,
+                                    self.src + start, self.dst + start, (end - start) // 16)
+
+        return self.cpu.read(self.dst, len(data)), self.cpu.read(self.iv, 16), cycles
+
+
+def _key_bits(round):
+    return (128, 128, 192, 256)[round % 4]
+
+
+def check(sim, rounds, size):
+    failures = 0
+
+    def expect(name, round, got, want):
+        nonlocal failures
+        if got == want:
+            return True
+        at = next(i for i in range(len(want)) if got[i] != want[i])
+        print("  FAIL  %s, round %d, first difference at byte %d" % (name, round, at))
+        failures += 1
+        return False
+
+    before = failures
+    for round in range(rounds):
+        key = random.randbytes(32)
+        data = random.randbytes(size)
+        decrypt = round & 1
+        want = ctypes.create_string_buffer(size)
+        sim.ref.sim_ecb(decrypt, key, _key_bits(round), data, want, size)
+        got = sim.ecb(decrypt, key, _key_bits(round), data)[0]
+        expect("ecb decrypt" if decrypt else "ecb encrypt", round, got, want.raw)
+    print("  %s  ecb" % ("ok  " if failures == before else "FAIL"))
+
+    before = failures
+    for round in range(rounds):
+        key = random.randbytes(32)
+        iv = random.randbytes(16)
+        length = 16 * random.randint(1, size // 16)
+        data = random.randbytes(length)
+        want = ctypes.create_string_buffer(length)
+        want_iv = ctypes.create_string_buffer(iv, 16)
+        sim.ref.sim_cbc_decrypt(key, _key_bits(round), want_iv, data, want, length)
+        got, got_iv, _ = sim.cbc_decrypt(key, _key_bits(round), iv, data, round % 4 == 2)
+        expect("cbc decrypt", round, got, want.raw)
+        expect("cbc decrypt iv", round, got_iv, want_iv.raw)
+    print("  %s  cbc decrypt" % ("ok  " if failures == before else "FAIL"))
+
+    before = failures
+    for round in range(rounds):
+        key = random.randbytes(16)
+        ctr = bytearray(random.randbytes(16))
+        #the counter carries from the last byte up, some rounds wrap all 16
+        if round % 3 == 0:
+            ctr[15 - round % 16:] = b"\xFF" * (1 + round % 16)
+        ctr = bytes(ctr)
+        length = 16 * random.randint(1, size // 16)
+        data = random.randbytes(length)
+        want = ctypes.create_string_buffer(length)
+        want_ctr = ctypes.create_string_buffer(ctr, 16)
+        sim.ref.sim_ctr(key, want_ctr, data, want, length)
+        got, got_ctr, _ = sim.ctr(key, ctr, data, (length // 32) * 16)
+        expect("dsi ctr", round, got, want.raw)
+        expect("dsi ctr counter", round, got_ctr, want_ctr.raw)
+    print("  %s  dsi ctr" % ("ok  " if failures == before else "FAIL"))
+
+    return failures
+
+
+def bench(sim, size):
+    key = random.randbytes(16)
+    data = random.randbytes(size)
+    blocks = size // 16
+
+    results = (
+        ("ecb encrypt", sim.ecb(False, key, 128, data)[1]),
+        ("ecb decrypt", sim.ecb(True, key, 128, data)[1]),
+        ("cbc decrypt", sim.cbc_decrypt(key, 128, bytes(16), data, False)[2]),
+        ("dsi ctr", sim.ctr(key, bytes(16), data, size)[2]),
+    )
+
+    for name, cycles in results:
+        mbps = size / 1048576.0 / (cycles / ARM9_HZ)
+        print("  %-14s %7.1f cycles/block %7.2f MB/s" % (name, cycles / blocks, mbps))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check aes_arm.s on an ARMv5 interpreter.")
+    parser.add_argument("object", help="aes_arm.s assembled with AES_ASM and CRYPTO_TCM_OFF")
+    parser.add_argument("library", help="simref.c built as a host shared library")
+    parser.add_argument("-r", "--rounds", type=int, default=40, help="random cases per mode, default 40")
+    parser.add_argument("-z", "--size", type=int, default=1024, help="largest case in bytes, default 1024")
+    parser.add_argument("-s", "--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    random.seed(args.seed)
+
+    try:
+        sim = Sim(args.object, args.library)
+        print("vectors, %s tables" % ("full" if sim.tables == 4 else "fewer"))
+        failures = check(sim, args.rounds, args.size)
+    except Fault as e:
+        print("  FAIL  %s" % e)
+        return 1
+
+    if failures:
+        print("%d failed" % failures)
+        return 1
+
+    print("benchmarks, 128 bit keys, modelled ARM946E-S at 67 MHz from TCM")
+    bench(sim, 4096)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
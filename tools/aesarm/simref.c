@@ -0,0 +1,91 @@
+/*
+	Host side of armsim.py, built as a shared library without AES_ASM.
+
+	Hands the PolarSSL tables and key schedules over as 32 bit words, the
+	layout the ARM core sees, and runs the C code the results are checked
+	against.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "polarssl/aes.c"
+#include "twltool/dsi.h"
+
+static void _words(uint32_t* out, const unsigned long* in, int count)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = (uint32_t)in[i];
+}
+
+//FT0-FT3 then RT0-RT3, 256 words each, T1-T3 are only filled for the full tables
+int sim_tables(uint32_t* t, unsigned char fsb[256], unsigned char rsb[256])
+{
+	aes_context ctx;
+	unsigned char key[16] = { 0 };
+	aes_setkey_enc(&ctx, key, 128);
+
+	memset(t, 0, 8 * 256 * sizeof(uint32_t));
+	_words(t, FT0, 256);
+	_words(t + 1024, RT0, 256);
+#if !defined(POLARSSL_AES_FEWER_TABLES)
+	_words(t + 256, FT1, 256);
+	_words(t + 512, FT2, 256);
+	_words(t + 768, FT3, 256);
+	_words(t + 1280, RT1, 256);
+	_words(t + 1536, RT2, 256);
+	_words(t + 1792, RT3, 256);
+#endif
+	memcpy(fsb, FSb, 256);
+	memcpy(rsb, RSb, 256);
+
+#if defined(POLARSSL_AES_FEWER_TABLES)
+	return 1;
+#else
+	return 4;
+#endif
+}
+
+//returns the round count, rk gets the schedule
+int sim_setkey(int decrypt, const unsigned char* key, int bits, uint32_t rk[68])
+{
+	aes_context ctx;
+
+	if (decrypt)
+		aes_setkey_dec(&ctx, key, bits);
+	else
+		aes_setkey_enc(&ctx, key, bits);
+
+	_words(rk, ctx.rk, 68);
+	return ctx.nr;
+}
+
+void sim_ecb(int decrypt, const unsigned char* key, int bits, const unsigned char* in, unsigned char* out, int len)
+{
+	aes_context ctx;
+
+	if (decrypt)
+		aes_setkey_dec(&ctx, key, bits);
+	else
+		aes_setkey_enc(&ctx, key, bits);
+
+	for (int i = 0; i < len; i += 16)
+		aes_crypt_ecb(&ctx, decrypt ? AES_DECRYPT : AES_ENCRYPT, in + i, out + i);
+}
+
+void sim_cbc_decrypt(const unsigned char* key, int bits, unsigned char iv[16], const unsigned char* in, unsigned char* out, int len)
+{
+	aes_context ctx;
+	aes_setkey_dec(&ctx, key, bits);
+	aes_crypt_cbc(&ctx, AES_DECRYPT, len, iv, in, out);
+}
+
+//ctr is in the order dsi_context keeps it, which is what aes_arm_ctr() takes
+void sim_ctr(const unsigned char key[16], unsigned char ctr[16], const unsigned char* in, unsigned char* out, int len)
+{
+	dsi_context ctx;
+	dsi_set_key(&ctx, key);
+	memcpy(ctx.ctr, ctr, 16);
+	dsi_crypt_ctr(&ctx, in, out, len);
+	memcpy(ctr, ctx.ctr, 16);
+}
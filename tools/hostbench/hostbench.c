@@ -0,0 +1,560 @@
+/*
+	Host build of the crypto and TAD parsing code from arm9/src.
+
+	Checks each module against known-answer vectors, then times it and
+	reports ns per block and MB/s. Results can be saved as a baseline and
+	later runs compared against it to catch regressions.
+
+	  hostbench               run the vectors and the benchmarks
+	  hostbench -k            vectors only
+	  hostbench -w FILE       save the results as a baseline
+	  hostbench -c FILE       compare against a baseline
+	  hostbench -t PERCENT    slowdown allowed by -c, default 10
+
+	Exits non-zero if a vector fails or a benchmark regressed.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "polarssl/aes.h"
+#include "twltool/dsi.h"
+#include "u128_math.h"
+#include "f_xy.h"
+#include "tadheader.h"
+
+#define BENCH_SIZE    (256 * 1024)
+#define BENCH_MIN_NS  200000000ULL
+#define MAX_RESULTS   32
+
+typedef struct {
+	char name[32];
+	double nsPerBlock;
+	double mbps;
+} Result;
+
+static Result results[MAX_RESULTS];
+static int resultCount = 0;
+
+static unsigned char bufIn[BENCH_SIZE];
+static unsigned char bufOut[BENCH_SIZE];
+
+/************************ Known answers ***************************************/
+
+static int failures = 0;
+
+static void _hex(char const* label, unsigned char const* data, int len)
+{
+	printf("    %-8s", label);
+	for (int i = 0; i < len; i++)
+		printf("%02x", data[i]);
+	printf("\n");
+}
+
+static void _expect(char const* name, unsigned char const* got, unsigned char const* want, int len)
+{
+	if (memcmp(got, want, len) == 0)
+	{
+		printf("  ok    %s\n", name);
+		return;
+	}
+
+	printf("  FAIL  %s\n", name);
+	_hex("got", got, len);
+	_hex("want", want, len);
+	failures++;
+}
+
+static void _fromHex(unsigned char* out, char const* hex)
+{
+	for (int i = 0; hex[i * 2] && hex[i * 2 + 1]; i++)
+		sscanf(hex + i * 2, "%2hhx", &out[i]);
+}
+
+//FIPS-197 appendix C.1
+static void _katAesEcb()
+{
+	unsigned char key[16], pt[16], want[16], got[16];
+	_fromHex(key, "000102030405060708090a0b0c0d0e0f");
+	_fromHex(pt, "00112233445566778899aabbccddeeff");
+	_fromHex(want, "69c4e0d86a7b0430d8cdb78070b4c55a");
+
+	aes_context ctx;
+	aes_setkey_enc(&ctx, key, 128);
+	aes_crypt_ecb(&ctx, AES_ENCRYPT, pt, got);
+	_expect("aes-128 ecb encrypt", got, want, 16);
+
+	aes_setkey_dec(&ctx, key, 128);
+	aes_crypt_ecb(&ctx, AES_DECRYPT, want, got);
+	_expect("aes-128 ecb decrypt", got, pt, 16);
+}
+
+//SP 800-38A F.2.1 and F.2.2, first two blocks
+static void _katAesCbc()
+{
+	unsigned char key[16], iv[16], pt[32], want[32], got[32];
+	_fromHex(key, "2b7e151628aed2a6abf7158809cf4f3c");
+	_fromHex(pt, "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51");
+	_fromHex(want, "7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b2");
+
+	aes_context ctx;
+	aes_setkey_enc(&ctx, key, 128);
+	_fromHex(iv, "000102030405060708090a0b0c0d0e0f");
+	aes_crypt_cbc(&ctx, AES_ENCRYPT, 32, iv, pt, got);
+	_expect("aes-128 cbc encrypt", got, want, 32);
+
+	aes_setkey_dec(&ctx, key, 128);
+	_fromHex(iv, "000102030405060708090a0b0c0d0e0f");
+	aes_crypt_cbc(&ctx, AES_DECRYPT, 32, iv, want, got);
+	_expect("aes-128 cbc decrypt", got, pt, 32);
+}
+
+//the DSi modes are the standard ones on byte reversed blocks, these
+//answers were made with OpenSSL on reversed keys, nonces and data
+static void _dsiVectors(unsigned char* key, unsigned char* ctr, unsigned char* pt)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		key[i] = i;
+		ctr[i] = 0x10 + i;
+	}
+
+	for (int i = 0; i < 48; i++)
+		pt[i] = i * 7 + 3;
+}
+
+static void _katDsiCtr()
+{
+	unsigned char key[16], ctr[16], pt[48], want[48], got[48];
+	_dsiVectors(key, ctr, pt);
+	_fromHex(want, "62ba5c352e40c42e352e5f9abfe5a59a183a188f7e5c11d2a8de9d0bd954a988"
+				   "d81d4b70a8c3af421f069a411c9b9d16");
+
+	dsi_context ctx;
+	dsi_set_key(&ctx, key);
+	dsi_set_ctr(&ctx, ctr);
+	dsi_crypt_ctr(&ctx, pt, got, 48);
+	_expect("dsi ctr", got, want, 48);
+}
+
+static void _katDsiCcm()
+{
+	unsigned char key[16], ctr[16], pt[48], want[48], wantMac[16], got[48], mac[16], back[48];
+	_dsiVectors(key, ctr, pt);
+	_fromHex(want, "b6dd9790126ec1fa5f0413dcc7ce8274759e59f2dd8efb5401ca7811a6f42c68"
+				   "589dc30862866be4e35423dd0516e8ba");
+	_fromHex(wantMac, "faafa512bdfb8d19d211b2759b1b094c");
+
+	unsigned char nonce[12];
+	for (int i = 0; i < 12; i++)
+		nonce[i] = 0xA0 + i;
+
+	dsi_context ctx;
+	dsi_init_ccm(&ctx, key, 16, 48, 0, nonce);
+	dsi_encrypt_ccm(&ctx, pt, got, 48, mac);
+	_expect("dsi ccm encrypt", got, want, 48);
+	_expect("dsi ccm mac", mac, wantMac, 16);
+
+	dsi_init_ccm(&ctx, key, 16, 48, 0, nonce);
+	dsi_decrypt_ccm(&ctx, want, back, 48, mac);
+	_expect("dsi ccm decrypt", back, pt, 48);
+	_expect("dsi ccm decrypt mac", mac, wantMac, 16);
+}
+
+//the cases the word code in dsi.c handles apart: a carry through several
+//counter words, an add larger than one, unaligned buffers and two calls
+//in a row. The answers were recorded from the byte code it replaced.
+static void _katDsiCtrCarry()
+{
+	unsigned char key[16], ctr[16], pt[81], want[80], got[81];
+	_dsiVectors(key, ctr, pt);
+	memset(ctr, 0xFF, 8);
+	for (int i = 48; i < 80; i++)
+		pt[i] = i * 13 + 1;
+
+	_fromHex(want, "1299bfce5e2ce7822e4ac87d7f1887e507d94543df82308b568ad45a13ab8dac"
+				   "6c614542e37cad7c08e2cd5e77006409ffd75281842f117b9e6ec5f23b2b9185"
+				   "2662c403a1b89ad48f2b8b742f18e070");
+
+	dsi_context ctx;
+	dsi_set_key(&ctx, key);
+	dsi_set_ctr(&ctx, ctr);
+
+	//one block unaligned, three in one call, then skip ahead
+	memmove(pt + 1, pt, 80);
+	dsi_crypt_ctr(&ctx, pt + 1, got + 1, 16);
+	memmove(got, got + 1, 16);
+	memmove(pt, pt + 1, 80);
+	dsi_crypt_ctr(&ctx, pt + 16, got + 16, 48);
+	dsi_add_ctr(&ctx, 0x89ABCDEF);
+	dsi_crypt_ctr_block(&ctx, pt + 64, got + 64);
+	_expect("dsi ctr carry", got, want, 80);
+}
+
+//a payload that is not a whole number of blocks
+static void _katDsiCcmTail()
+{
+	unsigned char key[16], ctr[16], pt[48], want[37], wantMac[16], got[48], mac[16], back[48];
+	_dsiVectors(key, ctr, pt);
+	_fromHex(want, "b6dd9790126ec1fa5f0413dcc7ce8274759e59f2dd8efb5401ca7811a6f42c68"
+				   "589dc30862");
+	_fromHex(wantMac, "41a2e0fe356ce0ceccfcce6239ca9746");
+
+	unsigned char nonce[12];
+	for (int i = 0; i < 12; i++)
+		nonce[i] = 0xA0 + i;
+
+	dsi_context ctx;
+	dsi_init_ccm(&ctx, key, 16, 37, 0, nonce);
+	dsi_encrypt_ccm(&ctx, pt, got, 37, mac);
+	_expect("dsi ccm tail encrypt", got, want, 37);
+	_expect("dsi ccm tail mac", mac, wantMac, 16);
+
+	dsi_init_ccm(&ctx, key, 16, 37, 0, nonce);
+	dsi_decrypt_ccm(&ctx, want, back, 37, mac);
+	_expect("dsi ccm tail decrypt", back, pt, 37);
+	_expect("dsi ccm tail decrypt mac", mac, wantMac, 16);
+}
+
+//the ticket and TMD block format around CCM
+static void _katDsiEs()
+{
+	unsigned char key[16], ctr[16], pt[48], buf[40 + 32], want[40 + 32];
+	_dsiVectors(key, ctr, pt);
+	_fromHex(want, "9ff2ae68454106125a2409a208d4da6568ad57421f55fe5a7720dcf4df249d9e"
+				   "953ea202ce68b77f6937100cf2f197e7ba4fe1a266f01e328850515253545556"
+				   "5758595a5bf674c0");
+
+	unsigned char nonce[12];
+	for (int i = 0; i < 12; i++)
+		nonce[i] = 0x50 + i;
+
+	dsi_es_context es;
+	dsi_es_init(&es, key);
+	dsi_es_set_nonce(&es, nonce);
+
+	memcpy(buf, pt, 40);
+	dsi_es_encrypt(&es, buf, buf + 40, 40);
+	_expect("dsi es encrypt", buf, want, sizeof(want));
+
+	int result = dsi_es_decrypt(&es, buf, buf + 40, 40);
+	_expect("dsi es decrypt", buf, pt, 40);
+	_expect("dsi es decrypt result", (unsigned char*)&result, (unsigned char const*)&(int){ 0 }, sizeof(int));
+}
+
+static void _katU128()
+{
+	unsigned char a[16], b[16], want[16];
+
+	//carry out of the low word
+	_fromHex(a, "ffffffff000000000000000000000000");
+	u128_add32(a, 1);
+	_fromHex(want, "00000000010000000000000000000000");
+	_expect("u128 add32 carry", a, want, 16);
+
+	//carry through every byte and wrap
+	memset(a, 0xFF, 16);
+	_fromHex(b, "01000000000000000000000000000000");
+	u128_add(a, b);
+	memset(want, 0, 16);
+	_expect("u128 add wrap", a, want, 16);
+
+	//borrow is the inverse
+	u128_sub(a, b);
+	memset(want, 0xFF, 16);
+	_expect("u128 sub borrow", a, want, 16);
+
+	//a rotate by 42 then back is the identity, by 8 is a byte shift
+	_fromHex(a, "00112233445566778899aabbccddeeff");
+	memcpy(want, a, 16);
+	u128_lrot(a, 42);
+	u128_rrot(a, 42);
+	_expect("u128 rotate round trip", a, want, 16);
+
+	u128_lrot(a, 8);
+	_fromHex(want, "ff00112233445566778899aabbccddee");
+	_expect("u128 lrot 8", a, want, 16);
+}
+
+//key = ((x ^ y) + magic) rol 42, little endian, worked out independently
+static void _katFxy()
+{
+	unsigned char x[16], key[16], want[16], xy[16];
+	_fromHex(x, "4e00000008070605a2141b004e696e74");
+	_fromHex(want, "2665923557c66a2494e84ccf8a5f303f");
+
+	F_XY(key, x, DSi_NAND_KEY_Y);
+	_expect("f_xy nand key", key, want, 16);
+
+	for (int i = 0; i < 16; i++)
+		want[i] = x[i] ^ DSi_NAND_KEY_Y[i];
+
+	F_XY_reverse(key, xy);
+	_expect("f_xy reverse", xy, want, 16);
+}
+
+//the KART_K04.tad header from the comment in tad.c
+static void _katTadHeader()
+{
+	unsigned char raw[32];
+	_fromHex(raw, "0000002049730000" "00000e8000000000" "000002a400000208" "000dfc0000000000");
+
+	TadLayout tad;
+	bool ok = tadParseHeader((TadHeader const*)raw, &tad);
+
+	uint32_t got[] = { ok, tad.certOffset, tad.crlOffset, tad.ticketOffset, tad.tmdOffset,
+					   tad.srlOffset, tad.metaOffset, tad.ticketSize, tad.tmdSize, tad.srlSize };
+	uint32_t want[] = { 1, 64, 3776, 3776, 4480, 5056, 921536, 676, 520, 916480 };
+	_expect("tad header layout", (unsigned char*)got, (unsigned char*)want, sizeof(want));
+
+	//anything but "Is" is refused
+	raw[4] = 'i';
+	bool bad = tadParseHeader((TadHeader const*)raw, &tad);
+	_expect("tad header bad type", (unsigned char*)&bad, (unsigned char const*)&(bool){ false }, sizeof(bool));
+}
+
+/************************ Benchmarks ******************************************/
+
+static unsigned long long _now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+typedef void (*BenchFunc)(void* ctx, unsigned int size);
+
+//runs func over BENCH_SIZE bytes until BENCH_MIN_NS have passed
+static void _bench(char const* name, BenchFunc func, void* ctx, unsigned int blockSize)
+{
+	unsigned long long bytes = 0;
+	unsigned long long start = _now();
+	unsigned long long elapsed = 0;
+
+	func(ctx, BENCH_SIZE);
+
+	do {
+		func(ctx, BENCH_SIZE);
+		bytes += BENCH_SIZE;
+		elapsed = _now() - start;
+	} while (elapsed < BENCH_MIN_NS);
+
+	Result* r = &results[resultCount++];
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->nsPerBlock = (double)elapsed / (bytes / blockSize);
+	r->mbps = (bytes / 1048576.0) / (elapsed / 1e9);
+
+	printf("  %-20s %10.1f ns/block %9.2f MB/s\n", r->name, r->nsPerBlock, r->mbps);
+}
+
+static void _aesEcb(void* ctx, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; i += 16)
+		aes_crypt_ecb((aes_context*)ctx, AES_ENCRYPT, bufIn + i, bufOut + i);
+}
+
+static void _aesCbc(void* ctx, unsigned int size)
+{
+	unsigned char iv[16] = { 0 };
+	aes_crypt_cbc((aes_context*)ctx, AES_ENCRYPT, size, iv, bufIn, bufOut);
+}
+
+static void _aesCbcDec(void* ctx, unsigned int size)
+{
+	unsigned char iv[16] = { 0 };
+	aes_crypt_cbc((aes_context*)ctx, AES_DECRYPT, size, iv, bufIn, bufOut);
+}
+
+static void _dsiCtr(void* ctx, unsigned int size)
+{
+	dsi_crypt_ctr((dsi_context*)ctx, bufIn, bufOut, size);
+}
+
+static void _dsiCcm(void* ctx, unsigned int size)
+{
+	unsigned char key[16] = { 0 };
+	unsigned char nonce[12] = { 0 };
+	unsigned char mac[16];
+
+	dsi_init_ccm((dsi_context*)ctx, key, 16, size, 0, nonce);
+	dsi_encrypt_ccm((dsi_context*)ctx, bufIn, bufOut, size, mac);
+}
+
+static void _fxy(void* ctx, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; i += 16)
+		F_XY(bufOut + i, bufIn + i, DSi_NAND_KEY_Y);
+}
+
+static void _u128Add32(void* ctx, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; i += 16)
+		u128_add32(bufOut + i, i);
+}
+
+static void _tadParse(void* ctx, unsigned int size)
+{
+	TadLayout tad;
+
+	for (unsigned int i = 0; i < size; i += 32)
+		tadParseHeader((TadHeader const*)(bufIn + i), &tad);
+}
+
+static void _runBenchmarks()
+{
+	for (int i = 0; i < BENCH_SIZE; i++)
+		bufIn[i] = rand();
+
+	unsigned char key[16] = { 0 };
+	aes_context aes;
+	dsi_context dsi;
+
+	printf("\nBenchmarks (%d KiB buffer)\n", BENCH_SIZE / 1024);
+
+	aes_setkey_enc(&aes, key, 128);
+	_bench("aes-ecb-enc", _aesEcb, &aes, 16);
+	_bench("aes-cbc-enc", _aesCbc, &aes, 16);
+
+	aes_setkey_dec(&aes, key, 128);
+	_bench("aes-cbc-dec", _aesCbcDec, &aes, 16);
+
+	dsi_set_key(&dsi, key);
+	dsi_set_ctr(&dsi, key);
+	_bench("dsi-ctr", _dsiCtr, &dsi, 16);
+	_bench("dsi-ccm-enc", _dsiCcm, &dsi, 16);
+
+	_bench("f_xy", _fxy, NULL, 16);
+	_bench("u128-add32", _u128Add32, NULL, 16);
+	_bench("tad-header", _tadParse, NULL, 32);
+}
+
+/************************ Baselines *******************************************/
+
+static bool _writeBaseline(char const* path)
+{
+	FILE* f = fopen(path, "w");
+	if (!f) return false;
+
+	for (int i = 0; i < resultCount; i++)
+		fprintf(f, "%s %.3f %.3f\n", results[i].name, results[i].nsPerBlock, results[i].mbps);
+
+	fclose(f);
+	return true;
+}
+
+//returns the number of regressions, -1 if the file can't be read
+static int _compareBaseline(char const* path, double tolerance)
+{
+	FILE* f = fopen(path, "r");
+	if (!f) return -1;
+
+	int regressions = 0;
+	char name[32];
+	double ns, mbps;
+
+	printf("\nCompared to %s (%.0f%% allowed)\n", path, tolerance);
+
+	while (fscanf(f, "%31s %lf %lf", name, &ns, &mbps) == 3)
+	{
+		Result* r = NULL;
+		for (int i = 0; i < resultCount; i++)
+		{
+			if (strcmp(results[i].name, name) == 0)
+				r = &results[i];
+		}
+
+		if (!r)
+		{
+			printf("  %-20s missing\n", name);
+			continue;
+		}
+
+		double change = (r->nsPerBlock - ns) * 100.0 / ns;
+		bool regressed = change > tolerance;
+
+		printf("  %-20s %10.1f -> %10.1f ns/block %+7.1f%%%s\n", name, ns, r->nsPerBlock, change,
+			   regressed ? "  REGRESSION" : "");
+
+		if (regressed)
+			regressions++;
+	}
+
+	fclose(f);
+	return regressions;
+}
+
+int main(int argc, char** argv)
+{
+	bool katOnly = false;
+	char const* writePath = NULL;
+	char const* comparePath = NULL;
+	double tolerance = 10.0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-k") == 0)
+			katOnly = true;
+		else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+			writePath = argv[++i];
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			comparePath = argv[++i];
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			tolerance = atof(argv[++i]);
+		else
+		{
+			fprintf(stderr, "usage: %s [-k] [-w baseline] [-c baseline] [-t percent]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	printf("Known answers\n");
+	_katAesEcb();
+	_katAesCbc();
+	_katDsiCtr();
+	_katDsiCcm();
+	_katDsiCtrCarry();
+	_katDsiCcmTail();
+	_katDsiEs();
+	_katU128();
+	_katFxy();
+	_katTadHeader();
+
+	if (failures > 0)
+	{
+		printf("\n%d vector(s) failed\n", failures);
+		return 1;
+	}
+
+	if (katOnly)
+		return 0;
+
+	_runBenchmarks();
+
+	if (writePath && !_writeBaseline(writePath))
+	{
+		fprintf(stderr, "could not write %s\n", writePath);
+		return 2;
+	}
+
+	if (comparePath)
+	{
+		int regressions = _compareBaseline(comparePath, tolerance);
+		if (regressions < 0)
+		{
+			fprintf(stderr, "could not read %s\n", comparePath);
+			return 2;
+		}
+
+		if (regressions > 0)
+		{
+			printf("\n%d benchmark(s) regressed\n", regressions);
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,334 @@
+/*
+	Reads an iotrace.bin dumped by an IO_TRACE build and reports the access
+	pattern and the latencies seen on the console, then replays the requests
+	against raw images on the host and reports the same for them.
+
+	  iotrace [options] iotrace.bin
+	    -n FILE   decrypted NAND image (e.g. from the NAND image backup)
+	    -s FILE   SD card image
+	    -d        replay what reached the NAND instead of the libfat requests
+	    -w        also replay writes, this modifies the images
+	    -k        keep the host page cache warm instead of dropping it
+
+	Sectors are 512 bytes. Without an image a device is only summarised.
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iotrace.h"
+
+#define SECTOR_SIZE 512
+#define HIST_BUCKETS 24
+
+static char const* deviceNames[] = { "nand", "sd" };
+static char const* opNames[] = { "read", "write", "dev-read", "dev-write" };
+
+typedef struct {
+	uint32_t* us;
+	uint32_t count;
+	uint32_t capacity;
+	unsigned long long sectors;
+	uint32_t sequential;
+	uint32_t failed;
+	uint32_t sizes[HIST_BUCKETS];
+} Stats;
+
+static void _add(Stats* s, uint32_t us)
+{
+	if (s->count == s->capacity)
+	{
+		s->capacity = s->capacity ? s->capacity * 2 : 256;
+		s->us = realloc(s->us, s->capacity * sizeof(uint32_t));
+		if (!s->us)
+		{
+			fprintf(stderr, "out of memory\n");
+			exit(2);
+		}
+	}
+
+	s->us[s->count++] = us;
+}
+
+static int _log2(uint32_t v)
+{
+	int b = 0;
+	while (v > 1 && b < HIST_BUCKETS - 1)
+	{
+		v >>= 1;
+		b++;
+	}
+	return b;
+}
+
+static int _cmp(void const* a, void const* b)
+{
+	uint32_t x = *(uint32_t const*)a;
+	uint32_t y = *(uint32_t const*)b;
+	return (x > y) - (x < y);
+}
+
+static uint32_t _percentile(Stats const* s, int p)
+{
+	uint32_t i = (uint32_t)((unsigned long long)(s->count - 1) * p / 100);
+	return s->us[i];
+}
+
+static void _print(char const* label, Stats* s)
+{
+	if (s->count == 0)
+		return;
+
+	qsort(s->us, s->count, sizeof(uint32_t), _cmp);
+
+	unsigned long long sum = 0;
+	uint32_t hist[HIST_BUCKETS] = { 0 };
+	for (uint32_t i = 0; i < s->count; i++)
+	{
+		sum += s->us[i];
+		hist[_log2(s->us[i])]++;
+	}
+
+	printf("\n%s: %u requests, %llu sectors, %u%% sequential", label, s->count, s->sectors,
+		   (unsigned)(s->sequential * 100ULL / s->count));
+	if (s->failed)
+		printf(", %u failed", s->failed);
+	printf("\n");
+
+	printf("  latency us  min %u  p50 %u  p90 %u  p99 %u  max %u  mean %llu\n",
+		   s->us[0], _percentile(s, 50), _percentile(s, 90), _percentile(s, 99),
+		   s->us[s->count - 1], sum / s->count);
+
+	printf("  latency     ");
+	for (int b = 0; b < HIST_BUCKETS; b++)
+	{
+		if (hist[b])
+			printf(" <%uus:%u", 2u << b, hist[b]);
+	}
+	printf("\n");
+
+	printf("  size        ");
+	for (int b = 0; b < HIST_BUCKETS; b++)
+	{
+		if (s->sizes[b])
+			printf(" %u+:%u", 1u << b, s->sizes[b]);
+	}
+	printf("\n");
+}
+
+static void _free(Stats* s)
+{
+	free(s->us);
+	memset(s, 0, sizeof(Stats));
+}
+
+static unsigned long long _now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char** argv)
+{
+	char const* images[2] = { NULL, NULL };
+	bool deviceLevel = false;
+	bool writes = false;
+	bool keepCache = false;
+	char const* tracePath = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			images[IOTRACE_NAND] = argv[++i];
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			images[IOTRACE_SD] = argv[++i];
+		else if (strcmp(argv[i], "-d") == 0)
+			deviceLevel = true;
+		else if (strcmp(argv[i], "-w") == 0)
+			writes = true;
+		else if (strcmp(argv[i], "-k") == 0)
+			keepCache = true;
+		else if (argv[i][0] != '-' && !tracePath)
+			tracePath = argv[i];
+		else
+			tracePath = NULL, i = argc;
+	}
+
+	if (!tracePath)
+	{
+		fprintf(stderr, "usage: %s [-n nand.bin] [-s sd.img] [-d] [-w] [-k] iotrace.bin\n", argv[0]);
+		return 2;
+	}
+
+	FILE* f = fopen(tracePath, "rb");
+	if (!f)
+	{
+		perror(tracePath);
+		return 2;
+	}
+
+	IoTraceHeader header;
+	if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != IOTRACE_MAGIC ||
+		header.version != IOTRACE_VERSION || header.tickRate == 0)
+	{
+		fprintf(stderr, "%s: not an iotrace dump\n", tracePath);
+		return 2;
+	}
+
+	IoTraceEntry* entries = malloc(header.count * sizeof(IoTraceEntry) + 1);
+	if (!entries || fread(entries, sizeof(IoTraceEntry), header.count, f) != header.count)
+	{
+		fprintf(stderr, "%s: truncated\n", tracePath);
+		return 2;
+	}
+	fclose(f);
+
+	printf("%u requests, %u older ones dropped, %u ticks/s\n", header.count, header.dropped, header.tickRate);
+
+	//what the console saw
+	Stats recorded[2][4];
+	memset(recorded, 0, sizeof(recorded));
+	uint32_t next[2][4] = { { 0 } };
+
+	for (uint32_t i = 0; i < header.count; i++)
+	{
+		IoTraceEntry const* e = &entries[i];
+		if (e->device > IOTRACE_SD || e->op > IOTRACE_DEV_WRITE)
+			continue;
+
+		Stats* s = &recorded[e->device][e->op];
+		_add(s, (uint32_t)((unsigned long long)e->duration * 1000000 / header.tickRate));
+		s->sectors += e->count;
+		s->sizes[_log2(e->count)]++;
+
+		if (i > 0 && e->sector == next[e->device][e->op])
+			s->sequential++;
+		next[e->device][e->op] = e->sector + e->count;
+
+		if (!e->ok)
+			s->failed++;
+	}
+
+	printf("\n== recorded on the console ==\n");
+	for (int d = 0; d < 2; d++)
+	{
+		for (int o = 0; o < 4; o++)
+		{
+			char label[32];
+			snprintf(label, sizeof(label), "%s %s", deviceNames[d], opNames[o]);
+			_print(label, &recorded[d][o]);
+			_free(&recorded[d][o]);
+		}
+	}
+
+	//the same requests on the host
+	int readOp = deviceLevel ? IOTRACE_DEV_READ : IOTRACE_READ;
+	int writeOp = deviceLevel ? IOTRACE_DEV_WRITE : IOTRACE_WRITE;
+
+	for (int d = 0; d < 2; d++)
+	{
+		if (!images[d])
+			continue;
+
+		int fd = open(images[d], writes ? O_RDWR : O_RDONLY);
+		if (fd < 0)
+		{
+			perror(images[d]);
+			continue;
+		}
+
+		off_t size = lseek(fd, 0, SEEK_END);
+
+		if (!keepCache)
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+		Stats replayed[2];
+		memset(replayed, 0, sizeof(replayed));
+		uint32_t skipped = 0;
+		uint32_t outside = 0;
+		uint32_t nextSector[2] = { 0, 0 };
+
+		unsigned char* buffer = NULL;
+		size_t bufferSize = 0;
+
+		for (uint32_t i = 0; i < header.count; i++)
+		{
+			IoTraceEntry const* e = &entries[i];
+			if (e->device != d || (e->op != readOp && e->op != writeOp))
+				continue;
+
+			bool write = (e->op == writeOp);
+			if (write && !writes)
+			{
+				skipped++;
+				continue;
+			}
+
+			off_t offset = (off_t)e->sector * SECTOR_SIZE;
+			size_t len = (size_t)e->count * SECTOR_SIZE;
+			if (offset + (off_t)len > size)
+			{
+				outside++;
+				continue;
+			}
+
+			if (len > bufferSize)
+			{
+				bufferSize = len;
+				buffer = realloc(buffer, bufferSize);
+				if (!buffer)
+				{
+					fprintf(stderr, "out of memory\n");
+					return 2;
+				}
+				memset(buffer, 0, bufferSize);
+			}
+
+			Stats* s = &replayed[write];
+			unsigned long long start = _now();
+
+			bool ok;
+			if (write)
+				ok = pwrite(fd, buffer, len, offset) == (ssize_t)len && fdatasync(fd) == 0;
+			else
+				ok = pread(fd, buffer, len, offset) == (ssize_t)len;
+
+			_add(s, (uint32_t)((_now() - start) / 1000));
+			s->sectors += e->count;
+			s->sizes[_log2(e->count)]++;
+			if (e->sector == nextSector[write])
+				s->sequential++;
+			nextSector[write] = e->sector + e->count;
+			if (!ok)
+				s->failed++;
+		}
+
+		printf("\n== replayed on %s ==\n", images[d]);
+		if (skipped)
+			printf("%u writes skipped, use -w to replay them\n", skipped);
+		if (outside)
+			printf("%u requests past the end of the image\n", outside);
+
+		char label[32];
+		snprintf(label, sizeof(label), "%s %s", deviceNames[d], opNames[readOp]);
+		_print(label, &replayed[0]);
+		snprintf(label, sizeof(label), "%s %s", deviceNames[d], opNames[writeOp]);
+		_print(label, &replayed[1]);
+
+		_free(&replayed[0]);
+		_free(&replayed[1]);
+		free(buffer);
+		close(fd);
+	}
+
+	free(entries);
+	return 0;
+}
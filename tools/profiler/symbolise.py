@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""
+Aggregates a profile.txt from the Test menu profiler per function.
+
+  symbolise.py profile.txt arm9/build/TDT.map
+  symbolise.py profile.txt arm9/TDT.elf         (uses nm, includes statics)
+
+  -f / --files   also total the samples per object file (map only)
+  -n / --top N   only print the N hottest functions, default 40
+"""
+
+import argparse
+import bisect
+import re
+import shutil
+import subprocess
+import sys
+
+SYMBOL = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+([A-Za-z_.$][\w.$]*)\s*$")
+SECTION = re.compile(r"^\s*(\.\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S+)\s*$")
+
+
+def load_profile(path):
+    info = {}
+    samples = []
+
+    with open(path) as f:
+        for line in f:
+            if line.startswith("#"):
+                words = line[1:].split()
+                for key, value in zip(words[0::2], words[1::2]):
+                    info[key] = value
+                continue
+
+            parts = line.split()
+            if len(parts) == 2:
+                samples.append((int(parts[0], 16), int(parts[1])))
+
+    return info, samples
+
+
+def load_map(path):
+    symbols = []
+    objects = []
+    in_memory_map = False
+
+    with open(path) as f:
+        for line in f:
+            if line.startswith("Linker script and memory map"):
+                in_memory_map = True
+                continue
+            if not in_memory_map:
+                continue
+
+            m = SYMBOL.match(line)
+            if m:
+                symbols.append((int(m.group(1), 16), m.group(2)))
+                continue
+
+            m = SECTION.match(line)
+            if m and (m.group(1) is None or m.group(1).startswith(".text") or m.group(1).startswith(".itcm")):
+                start = int(m.group(2), 16)
+                size = int(m.group(3), 16)
+                if size > 0:
+                    objects.append((start, start + size, m.group(4).split("/")[-1]))
+
+    return symbols, objects
+
+
+def load_elf(path):
+    nm = shutil.which("arm-none-eabi-nm") or shutil.which("nm")
+    if not nm:
+        sys.exit("no nm found to read " + path)
+
+    out = subprocess.run([nm, "-n", "--defined-only", path], capture_output=True, text=True, check=True).stdout
+    symbols = []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 3 and parts[1] in "tTwW" and not parts[2].startswith("$"):
+            symbols.append((int(parts[0], 16), parts[2]))
+
+    return symbols, []
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Per function totals for a TDT profile")
+    parser.add_argument("profile")
+    parser.add_argument("symbols", help="linker .map or .elf")
+    parser.add_argument("-f", "--files", action="store_true")
+    parser.add_argument("-n", "--top", type=int, default=40)
+    args = parser.parse_args()
+
+    info, samples = load_profile(args.profile)
+
+    if args.symbols.endswith(".elf"):
+        symbols, objects = load_elf(args.symbols)
+    else:
+        symbols, objects = load_map(args.symbols)
+
+    symbols.sort()
+    addrs = [a for a, _ in symbols]
+
+    total = sum(n for _, n in samples) + int(info.get("other", 0))
+    if total == 0:
+        sys.exit("no samples")
+
+    functions = {}
+    files = {}
+    for pc, n in samples:
+        i = bisect.bisect_right(addrs, pc) - 1
+        name = symbols[i][1] if i >= 0 else "?"
+        functions[name] = functions.get(name, 0) + n
+
+        for start, end, obj in objects:
+            if start <= pc < end:
+                files[obj] = files.get(obj, 0) + n
+                break
+
+    print("%s, %d samples at %s Hz, %s outside code" % (info.get("TDT", "?"), total, info.get("hz", "?"), info.get("other", "0")))
+    print()
+    print("%8s %7s  %s" % ("samples", "%", "function"))
+    for name, n in sorted(functions.items(), key=lambda x: -x[1])[:args.top]:
+        print("%8d %6.2f%%  %s" % (n, n * 100.0 / total, name))
+
+    if args.files and files:
+        print()
+        print("%8s %7s  %s" % ("samples", "%", "object"))
+        for obj, n in sorted(files.items(), key=lambda x: -x[1]):
+            print("%8d %6.2f%%  %s" % (n, n * 100.0 / total, obj))
+
+
+if __name__ == "__main__":
+    main()